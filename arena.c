@@ -0,0 +1,311 @@
+//
+//  arena.c
+//  GL threads
+//
+//  Arena holding the simulation's state (see arena.h)
+//
+//  Nathan Larson 2017-05-02
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#include "simulation.h"
+#include "placement.h"
+#include "arena.h"
+
+
+//-----------------------------------------------------------------------------
+//	Data types and constants
+//-----------------------------------------------------------------------------
+
+// size of the huge pages the arena is aligned to (the x86-64 and arm64 default)
+#define ARENA_HUGE_PAGE_SIZE		(2UL << 20)
+#define ARENA_ALIGNMENT				64
+#define MAX_ARENA_ALLOCATIONS		64
+// first touch: at most one thread per CPU, and none for less than this many bytes
+#define MAX_FIRST_TOUCH_THREADS		64
+#define FIRST_TOUCH_BYTES_PER_THREAD	(1UL << 20)
+
+typedef struct ArenaAllocation {
+								const char* what;
+								char* base;
+								size_t bytes;
+								// pages left to be touched as they are used
+								unsigned char isLazy;
+								// already first touched by firstTouchArena
+								unsigned char isTouched;
+} ArenaAllocation;
+
+
+//-----------------------------------------------------------------------------
+//	Global variables
+//-----------------------------------------------------------------------------
+
+const char* const HUGE_PAGE_NAMES[] = {"none", "transparent", "explicit", NULL};
+unsigned int hugePageMode = HUGE_PAGES_TRANSPARENT;
+
+static char* arenaBase = NULL;
+static size_t arenaSize = 0, arenaUsed = 0;
+// kind of pages actually backing the arena (hugePageMode, unless it wasn't available)
+static unsigned int arenaPages = HUGE_PAGES_NONE;
+
+static ArenaAllocation allocations[MAX_ARENA_ALLOCATIONS];
+static unsigned int numAllocations = 0;
+// allocations happen at startup (and when the watchdog starts), but may overlap
+static pthread_mutex_t arenaLock = PTHREAD_MUTEX_INITIALIZER;
+
+static ArenaAllocation* firstTouchList[MAX_ARENA_ALLOCATIONS];
+static unsigned int firstTouchCount = 0, firstTouchThreads = 1;
+
+
+//-----------------------------------------------------------------------------
+//	Reservation
+//-----------------------------------------------------------------------------
+
+void reserveArena(size_t bytes)
+{
+	arenaSize = (bytes + ARENA_HUGE_PAGE_SIZE - 1) / ARENA_HUGE_PAGE_SIZE * ARENA_HUGE_PAGE_SIZE;
+
+	// huge pages from the pool are reserved up front, so the pool must hold the whole arena
+	if (hugePageMode == HUGE_PAGES_EXPLICIT)
+	{
+		void* base = mmap(NULL, arenaSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (base != MAP_FAILED)
+		{
+			arenaBase = (char*) base;
+			arenaPages = HUGE_PAGES_EXPLICIT;
+			return;
+		}
+		fprintf(stderr, "Not enough huge pages for the arena (%zu MB): using transparent huge pages\n", arenaSize >> 20);
+	}
+
+	// reserve one more huge page to align the arena on a huge page boundary, then give
+	// back the ends.  Pages are only allocated when written.
+	char* base = (char*) mmap(NULL, arenaSize + ARENA_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+							  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (base == MAP_FAILED)
+	{
+		fprintf(stderr, "Could not reserve the arena (%zu MB)\n", arenaSize >> 20);
+		exit(EXIT_FAILURE);
+	}
+	char* aligned = (char*) (((unsigned long) base + ARENA_HUGE_PAGE_SIZE - 1) & ~(ARENA_HUGE_PAGE_SIZE - 1));
+	if (aligned > base)
+		munmap(base, (size_t) (aligned - base));
+	munmap(aligned + arenaSize, (size_t) (base + ARENA_HUGE_PAGE_SIZE - aligned));
+	arenaBase = aligned;
+
+	arenaPages = HUGE_PAGES_NONE;
+	if (hugePageMode != HUGE_PAGES_NONE && madvise(arenaBase, arenaSize, MADV_HUGEPAGE) == 0)
+		arenaPages = HUGE_PAGES_TRANSPARENT;
+}
+
+void releaseArena(void)
+{
+	if (arenaBase != NULL)
+		munmap(arenaBase, arenaSize);
+	arenaBase = NULL;
+}
+
+
+//-----------------------------------------------------------------------------
+//	Allocation
+//-----------------------------------------------------------------------------
+
+static void* allocate(size_t count, size_t elemSize, size_t alignment, int isLazy, const char* what)
+{
+	size_t bytes;
+	if (arenaBase == NULL || !checkedArrayBytes(count, elemSize, &bytes))
+	{
+		fprintf(stderr, "Could not allocate %s (%zu x %zu bytes)\n", what, count, elemSize);
+		exit(EXIT_FAILURE);
+	}
+
+	pthread_mutex_lock(&arenaLock);
+	size_t offset = (arenaUsed + alignment - 1) / alignment * alignment;
+	if (offset > arenaSize || bytes > arenaSize - offset)
+	{
+		fprintf(stderr, "The arena is exhausted: could not allocate %s (%zu bytes, %zu of %zu used)\n", what, bytes, arenaUsed, arenaSize);
+		exit(EXIT_FAILURE);
+	}
+	// a lazy allocation takes whole pages, so that nothing else shares its last one
+	arenaUsed = offset + bytes;
+	if (isLazy)
+		arenaUsed = offset + (bytes + alignment - 1) / alignment * alignment;
+	if (numAllocations < MAX_ARENA_ALLOCATIONS)
+	{
+		ArenaAllocation* allocation = &allocations[numAllocations++];
+		allocation->what = what;
+		allocation->base = arenaBase + offset;
+		allocation->bytes = bytes;
+		allocation->isLazy = (unsigned char) isLazy;
+		allocation->isTouched = 0;
+	}
+	pthread_mutex_unlock(&arenaLock);
+	return arenaBase + offset;
+}
+
+void* arenaAlloc(size_t count, size_t elemSize, const char* what)
+{
+	return allocate(count, elemSize, ARENA_ALIGNMENT, 0, what);
+}
+
+void* arenaAllocLazy(size_t count, size_t elemSize, const char* what)
+{
+	// a lazy range is only touched here and there (a tile at a time), so it stays on base
+	// pages: a transparent huge page would fault in 2 MB for each tile touched.  Its
+	// pages are still aligned on huge pages, so that it doesn't split the huge pages
+	// of its neighbors.
+	size_t alignment = (arenaPages != HUGE_PAGES_NONE ? ARENA_HUGE_PAGE_SIZE : (size_t) sysconf(_SC_PAGESIZE));
+	char* base = (char*) allocate(count, elemSize, alignment, 1, what);
+	if (arenaPages == HUGE_PAGES_TRANSPARENT)
+		madvise(base, (count * elemSize + alignment - 1) / alignment * alignment, MADV_NOHUGEPAGE);
+	return base;
+}
+
+
+//-----------------------------------------------------------------------------
+//	First touch
+//-----------------------------------------------------------------------------
+
+/*
+ * Thread k of the team zeroes the k-th share of each array on the list
+ */
+static void* firstTouchThread(void* arg)
+{
+	unsigned int k = (unsigned int) (unsigned long) arg;
+	int cpu = placementCpuForThread(k);
+	if (cpu >= 0)
+	{
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	}
+
+	for (unsigned int a=0; a<firstTouchCount; a++)
+	{
+		ArenaAllocation* allocation = firstTouchList[a];
+		size_t start = allocation->bytes / firstTouchThreads * k;
+		size_t end = (k + 1 == firstTouchThreads) ? allocation->bytes : allocation->bytes / firstTouchThreads * (k + 1);
+		memset(allocation->base + start, 0, end - start);
+	}
+	return NULL;
+}
+
+void firstTouchArena(void)
+{
+	pthread_mutex_lock(&arenaLock);
+	size_t bytes = 0;
+	firstTouchCount = 0;
+	for (unsigned int a=0; a<numAllocations; a++)
+	{
+		if (allocations[a].isLazy || allocations[a].isTouched)
+			continue;
+		allocations[a].isTouched = 1;
+		firstTouchList[firstTouchCount++] = &allocations[a];
+		bytes += allocations[a].bytes;
+	}
+
+	long numCpus = sysconf(_SC_NPROCESSORS_ONLN);
+	firstTouchThreads = (unsigned int) (bytes / FIRST_TOUCH_BYTES_PER_THREAD);
+	if (numCpus > 0 && firstTouchThreads > (unsigned int) numCpus)
+		firstTouchThreads = (unsigned int) numCpus;
+	if (firstTouchThreads > MAX_FIRST_TOUCH_THREADS)
+		firstTouchThreads = MAX_FIRST_TOUCH_THREADS;
+	if (firstTouchThreads == 0)
+		firstTouchThreads = 1;
+
+	// a small arena isn't worth starting threads for
+	pthread_t team[MAX_FIRST_TOUCH_THREADS];
+	unsigned int numStarted = 0;
+	for (unsigned int k=1; k<firstTouchThreads; k++)
+	{
+		if (pthread_create(&team[numStarted], NULL, firstTouchThread, (void*) (unsigned long) k) != 0)
+			firstTouchThread((void*) (unsigned long) k);
+		else
+			numStarted++;
+	}
+	firstTouchThread((void*) 0UL);
+	for (unsigned int k=0; k<numStarted; k++)
+		pthread_join(team[k], NULL);
+	pthread_mutex_unlock(&arenaLock);
+}
+
+
+//-----------------------------------------------------------------------------
+//	Footprint
+//-----------------------------------------------------------------------------
+
+static void formatBytes(char* str, size_t size, unsigned long long bytes)
+{
+	static const char* const UNITS[] = {"B", "KB", "MB", "GB", "TB"};
+	double value = (double) bytes;
+	unsigned int unit = 0;
+	while (unit < 4 && value >= 1024.)
+	{
+		value /= 1024.;
+		unit++;
+	}
+	snprintf(str, size, unit > 0 ? "%.1f %s" : "%.0f %s", value, UNITS[unit]);
+}
+
+/*
+ * Anonymous memory of the process in transparent huge pages, in bytes (0 if unknown)
+ */
+static unsigned long long transparentHugePageBytes(void)
+{
+	FILE* fp = fopen("/proc/self/smaps_rollup", "r");
+	if (fp == NULL)
+		return 0;
+	char line[256];
+	unsigned long long kb = 0;
+	while (fgets(line, sizeof(line), fp) != NULL)
+	{
+		if (sscanf(line, "AnonHugePages: %llu kB", &kb) == 1)
+			break;
+	}
+	fclose(fp);
+	return kb << 10;
+}
+
+void printArenaFootprint(void)
+{
+	static const char* const PAGE_DESCRIPTIONS[NUM_HUGE_PAGE_MODES] = {"base pages", "transparent huge pages", "explicit huge pages"};
+	char reserved[32], used[32], size[32];
+
+	pthread_mutex_lock(&arenaLock);
+	formatBytes(reserved, sizeof(reserved), arenaSize);
+	formatBytes(used, sizeof(used), arenaUsed);
+	printf("Arena: %s reserved, %s allocated, %s", reserved, used, PAGE_DESCRIPTIONS[arenaPages]);
+	if (arenaPages == HUGE_PAGES_TRANSPARENT)
+	{
+		formatBytes(size, sizeof(size), transparentHugePageBytes());
+		printf(" (%s in use)", size);
+	}
+	printf("\n");
+
+	// allocations with the same name are added up
+	for (unsigned int a=0; a<numAllocations; a++)
+	{
+		int isFirst = 1;
+		for (unsigned int b=0; b<a && isFirst; b++)
+			isFirst = strcmp(allocations[b].what, allocations[a].what) != 0;
+		if (!isFirst)
+			continue;
+		unsigned long long bytes = 0;
+		for (unsigned int b=a; b<numAllocations; b++)
+		{
+			if (strcmp(allocations[b].what, allocations[a].what) == 0)
+				bytes += allocations[b].bytes;
+		}
+		formatBytes(size, sizeof(size), bytes);
+		printf("  %-24s %10s%s\n", allocations[a].what, size, allocations[a].isLazy ? " (allocated as touched)" : "");
+	}
+	pthread_mutex_unlock(&arenaLock);
+}
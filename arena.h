@@ -0,0 +1,57 @@
+//
+//  arena.h
+//  GL threads
+//
+//  Arena holding the simulation's state: one range of address space is reserved at
+//  startup, sized for the whole grid and the traveler slots, and the arrays are carved
+//  from it instead of being allocated one by one.  The range only takes memory where
+//  it is written, so the grid's tiles still cost nothing until a traveler touches
+//  them.  With -hugePages transparent (the default) the kernel is asked to back the
+//  arena with transparent huge pages, except for the lazy allocations (the tiles),
+//  which stay on base pages so that a touched tile doesn't cost a whole huge page.
+//  With -hugePages explicit the whole arena is mapped from the huge page pool
+//  (falling back on transparent huge pages if the pool is too small).  Arena memory
+//  reads as zeros, and is released all at once at exit.
+//
+//  The arrays are first touched, and so placed on NUMA nodes, by a team of threads
+//  that each zero their share of every array (pinned like the simulation threads when
+//  a placement policy is set), rather than by the main thread.
+//
+//  Nathan Larson 2017-05-02
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+typedef enum HugePageMode {
+								HUGE_PAGES_NONE = 0,
+								HUGE_PAGES_TRANSPARENT,
+								HUGE_PAGES_EXPLICIT,
+								//
+								NUM_HUGE_PAGE_MODES
+} HugePageMode;
+
+extern const char* const HUGE_PAGE_NAMES[];
+extern unsigned int hugePageMode;
+
+// Reserve the arena: bytes of address space (rounded up to whole huge pages)
+void reserveArena(size_t bytes);
+
+// Allocate count elements of elemSize bytes, aligned to a cache line, exiting with a
+// message if the arena is exhausted.  arenaAllocLazy allocates on page boundaries,
+// and leaves the pages to be first touched as they are used (for the grid's tiles).
+void* arenaAlloc(size_t count, size_t elemSize, const char* what);
+void* arenaAllocLazy(size_t count, size_t elemSize, const char* what);
+
+// First touch, in parallel, the arrays allocated since the last call (but not the
+// lazy ones).  To be called before they are initialized.
+void firstTouchArena(void);
+
+// Print the arena's size, page size and allocations
+void printArenaFootprint(void);
+
+// Give the whole arena back
+void releaseArena(void);
+
+#endif // ARENA_H
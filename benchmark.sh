@@ -0,0 +1,51 @@
+#!/bin/sh
+#
+#  benchmark.sh
+#  GL threads
+#
+#  Runs the simulation headless over a sweep of settings and prints one line per run.
+#  Each sweep variable is a space-separated list; any other option can be passed
+#  through EXTRA, e.g.
+#      POLICIES="random aware" TRAVELERS="64 256 1024" ./benchmark.sh
+#      ENGINES="threads regions" EXTRA="-regionRows 8 -regionCols 8" ./benchmark.sh
+#      PLACEMENTS="none compact scatter region" ENGINES=regions ./benchmark.sh
+#      LOCKS="pthread adaptive ticket mcs" EXTRA="-inkShards 8" ./benchmark.sh
+#      INK_MODES="reserve stream" EXTRA="-maxLevel 50 -addInk 10" ./benchmark.sh
+#      EXTRA="-inkShards 8" DURATION=10 ./benchmark.sh
+
+TRAVEL=${TRAVEL:-./travel}
+DURATION=${DURATION:-5}
+ROWS=${ROWS:-256}
+COLS=${COLS:-256}
+TRAVELERS=${TRAVELERS:-"64 256 1024"}
+POLICIES=${POLICIES:-"random aware"}
+ENGINES=${ENGINES:-"threads"}
+PLACEMENTS=${PLACEMENTS:-"none"}
+LOCKS=${LOCKS:-"pthread"}
+INK_MODES=${INK_MODES:-"reserve"}
+EXTRA=${EXTRA:-""}
+
+# unpaced, steady-state runs with enough ink that the travelers are never starved
+# (EXTRA comes after these, so it can limit the ink to compare the ink modes)
+COMMON="-headless 1 -steady 1 -stepTime 0 -watchdog 0 -maxLevel 1000000 -addInk 100000 -duration $DURATION"
+
+printf "%-10s %-8s %-9s %-8s %-8s %-8s %7s %12s %14s %12s %10s\n" travelers engine placement lock ink policy pinned moves/s blocked_s backoffs reroutes
+for travelers in $TRAVELERS; do
+	for engine in $ENGINES; do
+		for placement in $PLACEMENTS; do
+			for lock in $LOCKS; do
+				for ink in $INK_MODES; do
+					for policy in $POLICIES; do
+						$TRAVEL $COMMON -rows $ROWS -cols $COLS -travelers $travelers -engine $engine -placement $placement \
+								-lock $lock -inkMode $ink -movePolicy $policy $EXTRA |
+						awk -v t=$travelers -v e=$engine -v l=$placement -v k=$lock -v m=$ink -v p=$policy '
+							/moves\/s/ { gsub(/[(]/, "", $0); for (i=1; i<=NF; i++) if ($i == "moves/s),") rate = $(i-1) }
+							/threads pinned/ { for (i=1; i<=NF; i++) if ($i == "threads") pinned = $(i-1) }
+							/^backoffs/ { gsub(/,/, "", $0); backoffs = $2; reroutes = $4; blocked = $7 }
+							END { printf "%-10s %-8s %-9s %-8s %-8s %-8s %7s %12s %14s %12s %10s\n", t, e, l, k, m, p, pinned, rate, blocked, backoffs, reroutes }'
+					done
+				done
+			done
+		done
+	done
+done
@@ -0,0 +1,98 @@
+//
+//  commandQueue.h
+//  GL threads
+//
+//  Bounded lock-free multi-producer/single-consumer queue of commands (see
+//  SimCommand in gl_frontEnd.h).  Any thread may push; exactly one thread may pop.
+//  Each cell carries a sequence number telling whose turn it is: a producer claims
+//  a position with a compare-and-swap on the tail, fills the cell and publishes it
+//  by advancing its sequence, and the consumer hands the cell back to the producers
+//  of the next round the same way.  Pushing never waits: when the queue is full,
+//  the push fails.
+//
+//  Nathan Larson 2017-05-02
+
+#ifndef COMMAND_QUEUE_H
+#define COMMAND_QUEUE_H
+
+#include <stdlib.h>
+
+#include "gl_frontEnd.h"
+
+typedef struct CommandCell {
+								unsigned int sequence;
+								SimCommand command;
+} CommandCell;
+
+typedef struct CommandQueue {
+								// producers: next position to claim
+								unsigned int tail __attribute__((aligned(64)));
+								// consumer: next position to pop
+								unsigned int head __attribute__((aligned(64)));
+								// ring buffer (power-of-two size)
+								CommandCell* cells __attribute__((aligned(64)));
+								unsigned int mask;
+} CommandQueue;
+
+/*
+ * Allocate a queue holding up to capacity commands, rounded up to a power of two.
+ * Returns 0 if memory runs out.
+ */
+static inline int commandQueueInit(CommandQueue* q, unsigned int capacity)
+{
+	unsigned int size = 1;
+	while (size < capacity)
+		size *= 2;
+	q->cells = (CommandCell*) malloc(size * sizeof(CommandCell));
+	if (q->cells == NULL)
+		return 0;
+	for (unsigned int k=0; k<size; k++)
+		q->cells[k].sequence = k;
+	q->mask = size - 1;
+	q->head = q->tail = 0;
+	return 1;
+}
+
+/*
+ * Producer side (any thread): push a command.  Returns 0 if the queue is full.
+ */
+static inline int commandQueuePush(CommandQueue* q, SimCommand command)
+{
+	unsigned int position = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+	CommandCell* cell;
+	while (1)
+	{
+		cell = &q->cells[position & q->mask];
+		int lag = (int) (__atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) - position);
+		if (lag == 0)
+		{
+			// the cell is free for this round: claim the position
+			if (__atomic_compare_exchange_n(&q->tail, &position, position + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		}
+		else if (lag < 0)
+			return 0;		// the consumer hasn't popped this cell's previous command yet
+		else
+			position = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+	}
+	cell->command = command;
+	__atomic_store_n(&cell->sequence, position + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+/*
+ * Consumer side: pop a command into *command.  Returns 0 if the queue is empty (or
+ * if the next command was claimed but isn't written yet).
+ */
+static inline int commandQueuePop(CommandQueue* q, SimCommand* command)
+{
+	CommandCell* cell = &q->cells[q->head & q->mask];
+	if (__atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) != q->head + 1)
+		return 0;
+	*command = cell->command;
+	__atomic_store_n(&cell->sequence, q->head + q->mask + 1, __ATOMIC_RELEASE);
+	q->head++;
+	return 1;
+}
+
+#endif // COMMAND_QUEUE_H
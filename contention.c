@@ -0,0 +1,88 @@
+//
+//  contention.c
+//  GL threads
+//
+//  Per-square contention counters (see contention.h)
+//
+//  Nathan Larson 2017-05-02
+
+#include <stdio.h>
+#include <limits.h>
+
+#include "simulation.h"
+#include "contention.h"
+
+// number of squares listed by printContentionSummary
+#define CONTENTION_HOT_SQUARES		5
+
+__thread ContentionBuffer contentionBuffer = {0};
+
+
+void flushContention(void)
+{
+	ContentionBuffer* buffer = &contentionBuffer;
+	for (unsigned int k=0; k<buffer->count; k++)
+	{
+		unsigned int row = TRAVELER_ROW(buffer->sample[k].position), col = TRAVELER_COL(buffer->sample[k].position);
+		GridTile* tile = touchTile(row, col);
+		size_t t = (size_t) (row >> GRID_TILE_SHIFT) * grid.numTileCols + (col >> GRID_TILE_SHIFT);
+		unsigned int* counter = &grid.contention[t].blockedTime[((row & GRID_TILE_MASK) << GRID_TILE_SHIFT) | (col & GRID_TILE_MASK)];
+
+		// add the sample in microseconds, saturating
+		unsigned long long micros = (buffer->sample[k].blockedTime + 500) / 1000;
+		unsigned int oldTime = __atomic_load_n(counter, __ATOMIC_RELAXED), newTime;
+		do
+			newTime = (micros >= UINT_MAX - oldTime) ? UINT_MAX : oldTime + (unsigned int) micros;
+		while (!__atomic_compare_exchange_n(counter, &oldTime, newTime, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+		// the counters are published after they are written
+		if (__atomic_load_n(&tile->hasContention, __ATOMIC_RELAXED) == 0)
+			__atomic_store_n(&tile->hasContention, 1, __ATOMIC_RELEASE);
+	}
+	buffer->count = 0;
+	buffer->since = 0;
+}
+
+void printContentionSummary(void)
+{
+	// keep the hottest squares, hottest first, with an insertion sort
+	unsigned int hotPosition[CONTENTION_HOT_SQUARES];
+	unsigned long long hotTime[CONTENTION_HOT_SQUARES];
+	unsigned int numHot = 0;
+	unsigned long long total = 0;
+
+	for (size_t t=0; t<(size_t) grid.numTileRows * grid.numTileCols; t++)
+	{
+		GridTile* tile = __atomic_load_n(&grid.tiles[t], __ATOMIC_ACQUIRE);
+		const TileContention* counters = (tile == NULL) ? NULL : tileContention(&grid, tile, t);
+		if (counters == NULL)
+			continue;
+		for (unsigned int k=0; k<GRID_TILE_SIZE*GRID_TILE_SIZE; k++)
+		{
+			unsigned long long blockedTime = __atomic_load_n(&counters->blockedTime[k], __ATOMIC_RELAXED) * 1000ULL;
+			if (blockedTime == 0)
+				continue;
+			total += blockedTime;
+			if (numHot == CONTENTION_HOT_SQUARES && blockedTime <= hotTime[numHot - 1])
+				continue;
+
+			unsigned int row = (unsigned int) (t / grid.numTileCols) * GRID_TILE_SIZE + (k >> GRID_TILE_SHIFT);
+			unsigned int col = (unsigned int) (t % grid.numTileCols) * GRID_TILE_SIZE + (k & GRID_TILE_MASK);
+			unsigned int j = (numHot < CONTENTION_HOT_SQUARES) ? numHot++ : numHot - 1;
+			for (; j > 0 && hotTime[j - 1] < blockedTime; j--)
+			{
+				hotTime[j] = hotTime[j - 1];
+				hotPosition[j] = hotPosition[j - 1];
+			}
+			hotTime[j] = blockedTime;
+			hotPosition[j] = TRAVELER_POSITION(row, col);
+		}
+	}
+
+	printf("square contention: %.3f s blocked (flushed so far)", total * 1e-9);
+	if (numHot > 0)
+		printf(", hottest");
+	for (unsigned int j=0; j<numHot; j++)
+		printf("%s (%u, %u) %.3f s", j > 0 ? "," : "", TRAVELER_ROW(hotPosition[j]), TRAVELER_COL(hotPosition[j]), hotTime[j] * 1e-9);
+	printf("\n");
+}
@@ -0,0 +1,86 @@
+//
+//  contention.h
+//  GL threads
+//
+//  Per-square contention: the time travelers spend blocked waiting for each square
+//  is added up, in microseconds, in its tile's counters (TileContention), so that the
+//  grid pane can show it as a heatmap ('h').  The counters are kept apart from the
+//  tiles, and a tile's only take memory once a traveler was blocked on one of its
+//  squares (GridTile.hasContention).  Blocked travelers don't add to them directly:
+//  each thread appends (square, time) samples to a buffer of its own, and merges the
+//  buffer into the tiles when it is full, once its oldest sample is older than
+//  CONTENTION_FLUSH_PERIOD (checked at each step of the engines), and when the thread
+//  ends.  A thread that doesn't block never touches any of it.
+//
+//  Nathan Larson 2017-05-02
+
+#ifndef CONTENTION_H
+#define CONTENTION_H
+
+#include "gl_frontEnd.h"
+#include "lifecycle.h"
+
+#define CONTENTION_BUFFER_SIZE		64
+// in nanoseconds
+#define CONTENTION_FLUSH_PERIOD		100000000ULL
+
+typedef struct ContentionSample {
+								// TRAVELER_POSITION of the square
+								unsigned int position;
+								// in nanoseconds
+								unsigned long long blockedTime;
+} ContentionSample;
+
+typedef struct ContentionBuffer {
+								unsigned int count;
+								// time of the first sample in the buffer
+								unsigned long long since;
+								ContentionSample sample[CONTENTION_BUFFER_SIZE];
+} ContentionBuffer;
+
+extern __thread ContentionBuffer contentionBuffer;
+
+// Add the samples of the calling thread's buffer to the tiles, and empty it
+void flushContention(void);
+
+/*
+ * A traveler was blocked for blockedTime nanoseconds waiting for square (row, col).
+ * Successive waits for the same square share a sample.
+ */
+static inline void noteContention(unsigned int row, unsigned int col, unsigned long long blockedTime)
+{
+	if (blockedTime == 0)
+		return;
+	ContentionBuffer* buffer = &contentionBuffer;
+	unsigned int position = TRAVELER_POSITION(row, col);
+	unsigned long long now = lifecycleClock();
+	if (buffer->count > 0 && buffer->sample[buffer->count - 1].position == position)
+		buffer->sample[buffer->count - 1].blockedTime += blockedTime;
+	else
+	{
+		if (buffer->count == 0)
+			buffer->since = now;
+		buffer->sample[buffer->count].position = position;
+		buffer->sample[buffer->count].blockedTime = blockedTime;
+		buffer->count++;
+	}
+	if (buffer->count == CONTENTION_BUFFER_SIZE || now - buffer->since >= CONTENTION_FLUSH_PERIOD)
+		flushContention();
+}
+
+/*
+ * Merge the calling thread's buffer once its oldest sample is older than
+ * CONTENTION_FLUSH_PERIOD.  The engines call this at each step or tick, so that the
+ * samples of a thread that stopped blocking (and never exits) still reach the tiles.
+ */
+static inline void flushStaleContention(void)
+{
+	ContentionBuffer* buffer = &contentionBuffer;
+	if (buffer->count > 0 && lifecycleClock() - buffer->since >= CONTENTION_FLUSH_PERIOD)
+		flushContention();
+}
+
+// Print the squares where the travelers were blocked longest (headless summary)
+void printContentionSummary(void);
+
+#endif // CONTENTION_H
@@ -0,0 +1,344 @@
+//
+//  frameExport.c
+//  GL threads
+//
+//  Frame export (see frameExport.h)
+//
+//  Nathan Larson 2017-05-02
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "simulation.h"
+#include "lock.h"
+#include "raster.h"
+#include "frameExport.h"
+
+
+//-----------------------------------------------------------------------------
+//	Data types and constants
+//-----------------------------------------------------------------------------
+
+#define EXPORT_FILE_FORMAT			"frame.%06llu.%s"
+// longest stored deflate block
+#define PNG_BLOCK_SIZE				65535
+
+//	Indices of buffers passed from one thread to the other (one pushes, the other
+//	pops).  A ring never holds more than all the buffers, so it never fills.
+typedef struct ExportRing {
+								unsigned int head __attribute__((aligned(64)));
+								unsigned int tail __attribute__((aligned(64)));
+								unsigned int slot[MAX_EXPORT_BUFFERS];
+} ExportRing;
+
+
+//-----------------------------------------------------------------------------
+//	Global variables
+//-----------------------------------------------------------------------------
+
+const char* const EXPORT_FORMAT_NAMES[] = {"ppm", "raw", "png", NULL};
+unsigned int exportPeriod = 0;
+unsigned int exportFormat = EXPORT_PPM;
+unsigned int exportBuffers = 4;
+
+unsigned long long framesExported = 0, framesDropped = 0;
+// snapshots taken, bytes written, and time spent taking snapshots and encoding frames (in nanoseconds)
+static unsigned long long numSnapshots = 0, bytesExported = 0, snapshotTime = 0, encodeTime = 0;
+static unsigned int writeFailed = 0;
+
+//	the pool: snapshots go from the free ring to the capture thread, to the ready
+//	ring, to the encoder thread, and back to the free ring
+static FrameSnapshot* snapshots;
+static ExportRing freeRing, readyRing;
+static EventCount snapshotReady;
+
+//	encoder thread only
+static unsigned char* framePixels;
+static unsigned char* fileBuffer;
+static size_t fileBufferSize = 0;
+static unsigned int crcTable[256];
+
+
+//-----------------------------------------------------------------------------
+//	Buffer rings
+//-----------------------------------------------------------------------------
+
+static void ringPush(ExportRing* ring, unsigned int index)
+{
+	unsigned int tail = ring->tail;
+	ring->slot[tail % MAX_EXPORT_BUFFERS] = index;
+	__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static int ringIsEmpty(ExportRing* ring)
+{
+	return ring->head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+}
+
+static int ringPop(ExportRing* ring, unsigned int* index)
+{
+	if (ringIsEmpty(ring))
+		return 0;
+	*index = ring->slot[ring->head % MAX_EXPORT_BUFFERS];
+	ring->head++;
+	return 1;
+}
+
+static unsigned long long elapsedSince(const struct timespec* start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000000000ULL + now.tv_nsec - start->tv_nsec;
+}
+
+
+//-----------------------------------------------------------------------------
+//	Encoding
+//-----------------------------------------------------------------------------
+
+static unsigned char* putBigEndian(unsigned char* p, unsigned int value)
+{
+	p[0] = (unsigned char) (value >> 24);
+	p[1] = (unsigned char) (value >> 16);
+	p[2] = (unsigned char) (value >> 8);
+	p[3] = (unsigned char) value;
+	return p + 4;
+}
+
+static unsigned int crc32(unsigned int crc, const unsigned char* data, size_t size)
+{
+	crc = ~crc;
+	for (size_t k=0; k<size; k++)
+		crc = crcTable[(crc ^ data[k]) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
+
+/*
+ * Close the PNG chunk whose length field is at start: fill in its length and append
+ * its CRC.  Returns the end of the chunk.
+ */
+static unsigned char* endChunk(unsigned char* start, unsigned char* end)
+{
+	putBigEndian(start, (unsigned int) (end - start - 8));
+	return putBigEndian(end, crc32(0, start + 4, (size_t) (end - start - 4)));
+}
+
+/*
+ * Encode the frame as a PNG in fileBuffer: the rows, each behind filter type 0,
+ * in a zlib stream of stored deflate blocks.  Returns its size.
+ */
+static size_t encodePng(const unsigned char* pixels, unsigned int width, unsigned int height)
+{
+	const size_t rowBytes = (size_t) width * 3 + 1, rawBytes = rowBytes * height;
+	const size_t numBlocks = (rawBytes + PNG_BLOCK_SIZE - 1) / PNG_BLOCK_SIZE;
+	const size_t size = 8 + 25 + (12 + 2 + numBlocks * 5 + rawBytes + 4) + 12;
+	if (size > fileBufferSize)
+	{
+		free(fileBuffer);
+		fileBuffer = (unsigned char*) checkedMalloc(size, 1, "PNG frame");
+		fileBufferSize = size;
+	}
+
+	static const unsigned char SIGNATURE[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+	unsigned char* p = fileBuffer;
+	memcpy(p, SIGNATURE, 8);
+	p += 8;
+
+	unsigned char* chunk = p;
+	p = putBigEndian(p + 4, 0x49484452);		// IHDR
+	p = putBigEndian(p, width);
+	p = putBigEndian(p, height);
+	*p++ = 8;		// bits per channel
+	*p++ = 2;		// RGB
+	*p++ = 0;		// deflate
+	*p++ = 0;		// adaptive filtering
+	*p++ = 0;		// not interlaced
+	p = endChunk(chunk, p);
+
+	chunk = p;
+	p = putBigEndian(p + 4, 0x49444154);		// IDAT
+	*p++ = 0x78;
+	*p++ = 0x01;
+	unsigned int a = 1, b = 0;					// Adler-32 of the uncompressed stream
+	size_t blockLeft = 0, left = rawBytes;
+	for (unsigned int y=0; y<height; y++)
+	{
+		for (size_t x=0; x<rowBytes; x++)
+		{
+			if (blockLeft == 0)
+			{
+				blockLeft = left < PNG_BLOCK_SIZE ? left : PNG_BLOCK_SIZE;
+				*p++ = (left == blockLeft);		// last block, stored
+				*p++ = (unsigned char) blockLeft;
+				*p++ = (unsigned char) (blockLeft >> 8);
+				*p++ = (unsigned char) ~blockLeft;
+				*p++ = (unsigned char) (~blockLeft >> 8);
+			}
+			unsigned char byte = (x == 0) ? 0 : pixels[(size_t) y * (rowBytes - 1) + x - 1];
+			*p++ = byte;
+			a = (a + byte) % 65521;
+			b = (b + a) % 65521;
+			blockLeft--;
+			left--;
+		}
+	}
+	p = putBigEndian(p, (b << 16) | a);
+	p = endChunk(chunk, p);
+
+	chunk = p;
+	p = putBigEndian(p + 4, 0x49454E44);		// IEND
+	p = endChunk(chunk, p);
+	return (size_t) (p - fileBuffer);
+}
+
+/*
+ * Write the frame in framePixels to the next file of the sequence.  Returns 0 if it
+ * couldn't be written.
+ */
+static int writeFrame(void)
+{
+	const unsigned int width = rasterWidth(), height = rasterHeight();
+	char name[64];
+	snprintf(name, sizeof(name), EXPORT_FILE_FORMAT, framesExported, EXPORT_FORMAT_NAMES[exportFormat]);
+
+	const unsigned char* data = framePixels;
+	size_t size = (size_t) width * height * 3;
+	char header[32];
+	size_t headerSize = 0;
+	if (exportFormat == EXPORT_PNG)
+	{
+		size = encodePng(framePixels, width, height);
+		data = fileBuffer;
+	}
+	else if (exportFormat == EXPORT_PPM)
+		headerSize = (size_t) snprintf(header, sizeof(header), "P6\n%u %u\n255\n", width, height);
+
+	FILE* fp = fopen(name, "wb");
+	int ok = (fp != NULL && fwrite(header, 1, headerSize, fp) == headerSize && fwrite(data, 1, size, fp) == size);
+	if (fp != NULL && fclose(fp) != 0)
+		ok = 0;
+	if (!ok)
+	{
+		// report the first failure only: the next frames would most likely fail the same way
+		if (writeFailed++ == 0)
+			perror(name);
+		return 0;
+	}
+	__atomic_store_n(&bytesExported, bytesExported + headerSize + size, __ATOMIC_RELAXED);
+	return 1;
+}
+
+
+//-----------------------------------------------------------------------------
+//	Threads
+//-----------------------------------------------------------------------------
+
+/*
+ * Every exportPeriod ms, take a snapshot into a free buffer and queue it, or drop the
+ * frame if the encoder has all the buffers
+ */
+static void* captureThread(void* arg)
+{
+	(void) arg;
+	struct timespec next;
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	while (1)
+	{
+		unsigned int index;
+		if (ringPop(&freeRing, &index))
+		{
+			struct timespec start;
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			takeSnapshot(&snapshots[index]);
+			__atomic_store_n(&snapshotTime, snapshotTime + elapsedSince(&start), __ATOMIC_RELAXED);
+			__atomic_store_n(&numSnapshots, numSnapshots + 1, __ATOMIC_RELAXED);
+			ringPush(&readyRing, index);
+			eventNotifyAll(&snapshotReady);
+		}
+		else
+			__atomic_add_fetch(&framesDropped, 1, __ATOMIC_RELAXED);
+
+		next.tv_nsec += (long) exportPeriod * 1000000L;
+		next.tv_sec += next.tv_nsec / 1000000000L;
+		next.tv_nsec %= 1000000000L;
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+	}
+	return NULL;
+}
+
+/*
+ * Rasterize the queued snapshots, hand their buffers back, and write the frames
+ */
+static void* encoderThread(void* arg)
+{
+	(void) arg;
+	while (1)
+	{
+		unsigned int index;
+		if (!ringPop(&readyRing, &index))
+		{
+			unsigned int key = eventPrepareWait(&snapshotReady);
+			if (!ringIsEmpty(&readyRing))
+				eventCancelWait(&snapshotReady);
+			else
+				eventWait(&snapshotReady, key, 1000000);
+			continue;
+		}
+
+		struct timespec start;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		rasterizeFrame(&snapshots[index], framePixels);
+		ringPush(&freeRing, index);
+		if (writeFrame())
+			__atomic_store_n(&framesExported, framesExported + 1, __ATOMIC_RELAXED);
+		else
+			__atomic_add_fetch(&framesDropped, 1, __ATOMIC_RELAXED);
+		__atomic_store_n(&encodeTime, encodeTime + elapsedSince(&start), __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+void startFrameExport(void)
+{
+	for (unsigned int n=0; n<256; n++)
+	{
+		unsigned int c = n;
+		for (unsigned int k=0; k<8; k++)
+			c = (c & 1) ? 0xEDB88320U ^ (c >> 1) : c >> 1;
+		crcTable[n] = c;
+	}
+
+	framePixels = (unsigned char*) checkedMalloc((size_t) rasterWidth() * rasterHeight(), 3, "export framebuffer");
+	snapshots = (FrameSnapshot*) checkedMalloc(exportBuffers, sizeof(FrameSnapshot), "export buffers");
+	for (unsigned int k=0; k<exportBuffers; k++)
+	{
+		allocateSnapshot(&snapshots[k], travelerStore.count);
+		ringPush(&freeRing, k);
+	}
+
+	pthread_t capture, encoder;
+	int errCode = pthread_create(&encoder, NULL, encoderThread, NULL);
+	if (errCode == 0)
+		errCode = pthread_create(&capture, NULL, captureThread, NULL);
+	if (errCode != 0)
+	{
+		printf("could not pthread_create frame export thread. %d\n", errCode);
+		exit(0);
+	}
+}
+
+void printExportSummary(void)
+{
+	unsigned long long exported = __atomic_load_n(&framesExported, __ATOMIC_RELAXED);
+	unsigned long long dropped = __atomic_load_n(&framesDropped, __ATOMIC_RELAXED);
+	unsigned long long snapshotted = __atomic_load_n(&numSnapshots, __ATOMIC_RELAXED);
+	printf("export: %llu frames written as %s (" EXPORT_FILE_FORMAT "...), %llu dropped, %.1f MB, snapshot %.2f ms, rasterize and write %.2f ms per frame\n",
+			exported, EXPORT_FORMAT_NAMES[exportFormat], 0ULL, EXPORT_FORMAT_NAMES[exportFormat], dropped,
+			__atomic_load_n(&bytesExported, __ATOMIC_RELAXED) / 1048576.,
+			snapshotted > 0 ? __atomic_load_n(&snapshotTime, __ATOMIC_RELAXED) * 1e-6 / snapshotted : 0.,
+			exported > 0 ? __atomic_load_n(&encodeTime, __ATOMIC_RELAXED) * 1e-6 / exported : 0.);
+}
@@ -0,0 +1,47 @@
+//
+//  frameExport.h
+//  GL threads
+//
+//  Frame export, to make movies of runs without a display.  Every -export ms a
+//  capture thread takes a snapshot of the simulation (see raster.h) into a free
+//  buffer of a pool of -exportBuffers, and queues it to an encoder thread, which
+//  rasterizes the snapshot, writes it to frame.N.<format> in the current directory
+//  and gives the buffer back.  The simulation never waits for either thread: the
+//  snapshot is read without locks, and when the encoder falls behind and no buffer
+//  is free, the frame is dropped (and counted) instead.
+//
+//  Frames are numbered without gaps, so that tools that read image sequences take
+//  them as they are.  Formats: ppm (binary P6), raw (the bare RGB pixels, top row
+//  first) and png (stored without compression, to need no library).
+//
+//  Nathan Larson 2017-05-02
+
+#ifndef FRAME_EXPORT_H
+#define FRAME_EXPORT_H
+
+#define MAX_EXPORT_BUFFERS			64
+
+typedef enum ExportFormat {
+								EXPORT_PPM = 0,
+								EXPORT_RAW,
+								EXPORT_PNG,
+								//
+								NUM_EXPORT_FORMATS
+} ExportFormat;
+
+extern const char* const EXPORT_FORMAT_NAMES[];
+// time between two frames in ms (0: no export), format, and size of the buffer pool
+extern unsigned int exportPeriod;
+extern unsigned int exportFormat;
+extern unsigned int exportBuffers;
+
+// frames written and dropped so far
+extern unsigned long long framesExported, framesDropped;
+
+// Start the capture and encoder threads
+void startFrameExport(void);
+
+// Print what was exported (headless summary)
+void printExportSummary(void);
+
+#endif // FRAME_EXPORT_H
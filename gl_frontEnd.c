@@ -11,16 +11,6 @@
 
 #include "gl_frontEnd.h"
 
-//---------------------------------------------------------------------------
-//	ink access functions.
-//---------------------------------------------------------------------------
-int acquireRedInk(unsigned int theRed);
-int acquireGreenInk(unsigned int theGreen);
-int acquireBlueInk(unsigned int theBlue);
-int refillRedInk(unsigned int theRed);
-int refillGreenInk(unsigned int theGreen);
-int refillBlueInk(unsigned int theBlue);
-
 //---------------------------------------------------------------------------
 //  Private functions' prototypes
 //---------------------------------------------------------------------------
@@ -32,14 +22,12 @@ void displayTextualInfo(const char* infoStr, int x, int y, int isLarge);
 void myMouse(int b, int s, int x, int y);
 void myGridPaneMouse(int b, int s, int x, int y);
 void myStatePaneMouse(int b, int s, int x, int y);
+void myStatePaneMotion(int x, int y);
 void myKeyboard(unsigned char c, int x, int y);
 void myMenuHandler(int value);
 void mySubmenuHandler(int colorIndex);
 void myTimer(int value);
-
-// Producer sleep time access functions
-void speedupProducers(void);
-void slowdownProducers(void);
+void heatmapColor(unsigned long long value, unsigned long long max, float color[3]);
 
 //---------------------------------------------------------------------------
 //  Interface constants
@@ -80,9 +68,11 @@ const unsigned int H_PADDING = 0;
 const unsigned int WINDOW_WIDTH = 1000;
 const unsigned int WINDOW_HEIGHT = 600;
 
-extern const unsigned int MAX_LEVEL;
-extern const unsigned int MAX_ADD_INK;
-extern const unsigned int MAX_NUM_TRAVELER_THREADS;
+// simulation parameters, configured at startup in main.c
+extern unsigned int MAX_LEVEL;
+
+// number of travelers spawned by the 'n' key
+const unsigned int SPAWN_BATCH = 10;
 
 //---------------------------------------------------------------------------
 //  File-level global variables
@@ -98,8 +88,20 @@ const int	GRID_PANE = 0,
 int	gMainWindow,
 	gSubwindow[2];
 
-// extern variable to reference the list of mutex locks for the traveler info list of structs
-extern pthread_mutex_t* travelerLocks;
+//	dimensions of the grid last drawn, to map mouse clicks to squares
+unsigned int gGridRows = 0, gGridCols = 0;
+//	square picked by clicking in the grid pane (if gHasSelection)
+unsigned int gSelectedRow, gSelectedCol;
+int gHasSelection = 0;
+//	the grid pane shows the squares' blocked time instead of their ink ('h'), scaled
+//	to the longest blocked time of the last frame (in microseconds)
+int gShowHeatmap = 0;
+unsigned long long gHeatmapMax = 0;
+//	history timeline at the bottom of the state pane (if gHasTimeline): dragging on it
+//	scrubs the grid pane through the history, clicking right of it goes back to live
+const unsigned int TIMELINE_LEFT = 10, TIMELINE_RIGHT = 290, TIMELINE_BOTTOM = 6, TIMELINE_TOP = 18;
+int gHasTimeline = 0, gScrubbing = 0, gDraggingTimeline = 0;
+float gScrubPosition = 1.f;
 
 //---------------------------------------------------------------------------
 //	Drawing functions
@@ -107,30 +109,89 @@ extern pthread_mutex_t* travelerLocks;
 
 
 //	This is the function that does the actual grid drawing
-void drawGrid(int**grid, unsigned int numRows, unsigned int numCols)
+void drawGrid(TiledGrid* grid)
 {	
+	const unsigned int numRows = grid->numRows, numCols = grid->numCols;
 	const float DH = (1.f* GRID_PANE_WIDTH) / numCols;
 	const float DV = (1.f*GRID_PANE_HEIGHT) / numRows;
+	gGridRows = numRows;
+	gGridCols = numCols;
 
-	//	Display the grid as a series of quad strips
-	for (unsigned int i=0; i<numRows; i++)
+	//	For the heatmap, find the longest blocked time first
+	if (gShowHeatmap)
 	{
-		glBegin(GL_QUAD_STRIP);
-			for (unsigned int j=0; j<numCols; j++)
+		unsigned long long max = 0;
+		for (size_t t=0; t<(size_t) grid->numTileRows * grid->numTileCols; t++)
+		{
+			GridTile* tile = __atomic_load_n(&grid->tiles[t], __ATOMIC_ACQUIRE);
+			const TileContention* counters = (tile == NULL) ? NULL : tileContention(grid, tile, t);
+			if (counters == NULL)
+				continue;
+			for (unsigned int k=0; k<GRID_TILE_SIZE*GRID_TILE_SIZE; k++)
 			{
-				
-				glColor4f((grid[i][j] & 0x000000FF)/255.f, ((grid[i][j] & 0x0000FF00) >> 8)/255.f,
-						  ((grid[i][j] & 0x00FF0000) >> 16)/255.f, 1.f);
-
-				glVertex2f(j*DH, i*DV);
-				glVertex2f(j*DH, (i+1)*DV);
-				glVertex2f((j+1)*DH, i*DV);
-				glVertex2f((j+1)*DH, (i+1)*DV);
+				unsigned long long blockedTime = __atomic_load_n(&counters->blockedTime[k], __ATOMIC_RELAXED);
+				if (blockedTime > max)
+					max = blockedTime;
 			}
-		glEnd();
+		}
+		gHeatmapMax = max;
+	}
+
+	//	Display each tile that has been touched as a series of quad strips.
+	//	Tiles that were never allocated are all black, like the pane's background.
+	for (unsigned int ti=0; ti<grid->numTileRows; ti++)
+	{
+		for (unsigned int tj=0; tj<grid->numTileCols; tj++)
+		{
+			GridTile* tile = __atomic_load_n(&grid->tiles[(size_t) ti*grid->numTileCols + tj], __ATOMIC_ACQUIRE);
+			if (tile == NULL)
+				continue;
+			//	squares of a tile without counters were never waited for
+			const TileContention* counters = tileContention(grid, tile, (size_t) ti*grid->numTileCols + tj);
+
+			//	clip the last row/column of tiles to the grid
+			unsigned int iStart = ti << GRID_TILE_SHIFT, jStart = tj << GRID_TILE_SHIFT;
+			unsigned int iEnd = iStart + GRID_TILE_SIZE, jEnd = jStart + GRID_TILE_SIZE;
+			if (iEnd > numRows)
+				iEnd = numRows;
+			if (jEnd > numCols)
+				jEnd = numCols;
+
+			for (unsigned int i=iStart; i<iEnd; i++)
+			{
+				const int* rowColor = tile->color + ((i & GRID_TILE_MASK) << GRID_TILE_SHIFT);
+				const unsigned int* rowBlockedTime = (counters == NULL) ? NULL : counters->blockedTime + ((i & GRID_TILE_MASK) << GRID_TILE_SHIFT);
+				glBegin(GL_QUAD_STRIP);
+					for (unsigned int j=jStart; j<jEnd; j++)
+					{
+						if (gShowHeatmap)
+						{
+							float heat[3];
+							heatmapColor(rowBlockedTime == NULL ? 0 : __atomic_load_n(&rowBlockedTime[j & GRID_TILE_MASK], __ATOMIC_RELAXED),
+										 gHeatmapMax, heat);
+							glColor4f(heat[0], heat[1], heat[2], 1.f);
+						}
+						else
+						{
+							int color = rowColor[j & GRID_TILE_MASK];
+							glColor4f((color & 0x000000FF)/255.f, ((color & 0x0000FF00) >> 8)/255.f,
+									  ((color & 0x00FF0000) >> 16)/255.f, 1.f);
+						}
+
+						glVertex2f(j*DH, i*DV);
+						glVertex2f(j*DH, (i+1)*DV);
+						glVertex2f((j+1)*DH, i*DV);
+						glVertex2f((j+1)*DH, (i+1)*DV);
+					}
+				glEnd();
+			}
+		}
 	}
 	
-	//	Then draw a grid of lines on top of the squares
+	//	Then draw a grid of lines on top of the squares (unless the squares are
+	//	so small that the lines would cover the whole pane)
+	if (DH < 3.f || DV < 3.f)
+		return;
 	glColor4f(0.5f, 0.5f, 0.5f, 1.f);
 	glBegin(GL_LINES);
 		//	Horizontal
@@ -148,22 +209,28 @@ void drawGrid(int**grid, unsigned int numRows, unsigned int numCols)
 	glEnd();
 }
 
-void drawGridAndTravelers(int**grid, unsigned int numRows, unsigned int numCols, TravelerInfo* travelList)
+void drawGridAndTravelers(TiledGrid* grid, TravelerStore* travelers)
 {
-	drawGrid(grid, numRows, numCols);
+	drawGrid(grid);
 	
-	const float DH = (1.f* GRID_PANE_WIDTH) / numCols;
-	const float DV = (1.f*GRID_PANE_HEIGHT) / numRows;
+	const float DH = (1.f* GRID_PANE_WIDTH) / grid->numCols;
+	const float DV = (1.f*GRID_PANE_HEIGHT) / grid->numRows;
 
-	//	Draw the travelers
-	for (unsigned int k=0; k< MAX_NUM_TRAVELER_THREADS; k++)
+	//	Draw the live travelers, skipping 64 at a time where none is live.  Only their
+	//	position and attributes are read.
+	for (unsigned int w=0; w<(travelers->count + 63) / 64; w++)
 	{
-		if (travelList[k].isLive)
+		unsigned long long live = __atomic_load_n(&travelers->live[w], __ATOMIC_RELAXED);
+		while (live != 0)
 		{
-			pthread_mutex_lock(&travelerLocks[travelList[k].index]);		// acquire the corresponding traveler info lock
+			unsigned int k = 64*w + __builtin_ctzll(live);
+			live &= live - 1;
+			unsigned int position = __atomic_load_n(&travelers->position[k], __ATOMIC_RELAXED);
+			unsigned char attributes = __atomic_load_n(&travelers->attributes[k], __ATOMIC_RELAXED);
+
 			glPushMatrix();
-			glTranslatef((travelList[k].col + 0.5f)*DH, (travelList[k].row + 0.5f)*DV, 0.f);
-			glRotatef(travelList[k].dir * 90.f, 0.f, 0.f, 1.f);
+			glTranslatef((TRAVELER_COL(position) + 0.5f)*DH, (TRAVELER_ROW(position) + 0.5f)*DV, 0.f);
+			glRotatef(TRAVELER_DIR(attributes) * 90.f, 0.f, 0.f, 1.f);
 			glColor4f(0.f, 0.f, 0.f, 1.f);
 			glBegin(GL_POLYGON);
 				glVertex2f(DH/6.f, -DV/4.f);
@@ -177,9 +244,47 @@ void drawGridAndTravelers(int**grid, unsigned int numRows, unsigned int numCols,
 				glVertex2f(-DH/6.f, -DV/4.f);
 			glEnd();
 			glPopMatrix();
-			pthread_mutex_unlock(&travelerLocks[travelList[k].index]);		// release the corresponding traveler info lock
 		}
 	}
+
+	//	Outline the selected square
+	if (gHasSelection)
+	{
+		glColor4f(1.f, 1.f, 0.f, 1.f);
+		glBegin(GL_LINE_LOOP);
+			glVertex2f(gSelectedCol*DH, gSelectedRow*DV);
+			glVertex2f((gSelectedCol+1)*DH, gSelectedRow*DV);
+			glVertex2f((gSelectedCol+1)*DH, (gSelectedRow+1)*DV);
+			glVertex2f(gSelectedCol*DH, (gSelectedRow+1)*DV);
+		glEnd();
+	}
+
+	//	Scale of the heatmap
+	if (gShowHeatmap)
+	{
+		char infoStr[64];
+		sprintf(infoStr, "Blocked time: max %.1f ms", gHeatmapMax * 1e-3);
+		displayTextualInfo(infoStr, 10, GRID_PANE_HEIGHT - 20, 0);
+	}
+}
+
+/*
+ * Heatmap color of a square blocked for value microseconds, when the longest is max:
+ * from black through red and yellow to white.  Low values are stretched, so that
+ * squares with a little contention still show next to the hottest ones.
+ */
+void heatmapColor(unsigned long long value, unsigned long long max, float color[3])
+{
+	if (value == 0 || max == 0)
+	{
+		color[0] = color[1] = color[2] = 0.f;
+		return;
+	}
+	float t = 1.f - (float) value / max;
+	t = 1.f - t*t*t*t;
+	color[0] = (t < 1.f/3) ? 3*t : 1.f;
+	color[1] = (t < 1.f/3) ? 0.f : (t < 2.f/3) ? 3*t - 1.f : 1.f;
+	color[2] = (t < 2.f/3) ? 0.f : 3*t - 2.f;
 }
 
 
@@ -275,7 +380,7 @@ void displayTextualInfo(const char* infoStr, int xPos, int yPos, int isLarge)
 
 
 void drawState(unsigned int numLiveThreads, unsigned int redLevel, unsigned int greenLevel, 
-			   unsigned int blueLevel, unsigned int producerSleepTime)
+			   unsigned int blueLevel, unsigned int producerSleepTime, const ProducerControl* control)
 {
 	//	I compute once the dimensions for all the rendering of my state info
 	unsigned int LEVEL_WIDTH = STATE_PANE_WIDTH / 4;
@@ -336,8 +441,108 @@ void drawState(unsigned int numLiveThreads, unsigned int redLevel, unsigned int
 
 	// display info about the producer sleep time
 	// I added these lines to help visualize the users input modifying the producer sleep time
-	sprintf(infoStr, "Producer Sleep Time: %d mu", producerSleepTime);
+	if (control == NULL || control->targetLevel == 0)
+	{
+		sprintf(infoStr, "Producer Sleep Time: %d mu", producerSleepTime);
+		displayTextualInfo(infoStr, RED_LEFT, TOP_LEVEL_TXT_Y - 50, 1);
+		return;
+	}
+
+	//	under rate control: the target, then each color's refill period and consumption
+	sprintf(infoStr, "Producer Target Level: %d", control->targetLevel);
 	displayTextualInfo(infoStr, RED_LEFT, TOP_LEVEL_TXT_Y - 50, 1);
+	const unsigned int tankLeft[NUM_PRODUCER_TYPES] = {RED_LEFT, GREEN_LEFT, BLUE_LEFT};
+	for (unsigned int c=0; c<NUM_PRODUCER_TYPES; c++)
+	{
+		sprintf(infoStr, "%.1f ms, %u/s", control->sleepTime[c] / 1000., control->consumption[c]);
+		displayTextualInfo(infoStr, tankLeft[c], MAX_LEVEL_TXT_Y + SMALL_FONT_HEIGHT + 4, 0);
+	}
+}
+
+/*
+ * Draw a table of numRows x numCols strings (row by row) in small type, between the
+ * producer sleep time and the tanks.  The first column holds the row names, and is
+ * narrower than the others.
+ */
+void drawStateTable(const char* const* cells, unsigned int numRows, unsigned int numCols)
+{
+	const unsigned int LEFT = 10;
+	const unsigned int LABEL_WIDTH = 65;
+	const unsigned int ROW_HEIGHT = SMALL_FONT_HEIGHT + 4;
+	const unsigned int TOP_TXT_Y = 4*STATE_PANE_HEIGHT / 5 - 80;
+	unsigned int columnWidth = (numCols > 1) ? (STATE_PANE_WIDTH - 2*LEFT - LABEL_WIDTH) / (numCols - 1) : 0;
+
+	for (unsigned int r=0; r<numRows; r++)
+	{
+		for (unsigned int c=0; c<numCols; c++)
+		{
+			unsigned int x = (c == 0) ? LEFT : LEFT + LABEL_WIDTH + (c - 1) * columnWidth;
+			displayTextualInfo(cells[r*numCols + c], x, TOP_TXT_Y - r*ROW_HEIGHT, 0);
+		}
+	}
+}
+
+/*
+ * Draw a few lines of small type at the top of the state pane, above the number of
+ * traveler threads (used to describe the selected square)
+ */
+void drawSelectionInfo(const char* const* lines, unsigned int numLines)
+{
+	const unsigned int LEFT = 10;
+	const unsigned int ROW_HEIGHT = SMALL_FONT_HEIGHT + 4;
+	const unsigned int TOP_TXT_Y = STATE_PANE_HEIGHT - 2*ROW_HEIGHT;
+
+	for (unsigned int k=0; k<numLines; k++)
+		displayTextualInfo(lines[k], LEFT, TOP_TXT_Y - k*ROW_HEIGHT, 0);
+}
+
+int selectedSquare(unsigned int* row, unsigned int* col)
+{
+	if (!gHasSelection)
+		return 0;
+	*row = gSelectedRow;
+	*col = gSelectedCol;
+	return 1;
+}
+
+/*
+ * Draw the history timeline at the bottom of the state pane, with the point shown
+ * in the grid pane (position from 0 to 1) unless it is live, and a label on the right
+ */
+void drawTimeline(float position, int isLive, const char* label)
+{
+	gHasTimeline = 1;
+	const float x = TIMELINE_LEFT + position * (TIMELINE_RIGHT - TIMELINE_LEFT);
+
+	glColor4f(0.2f, 0.3f, 0.6f, 1.f);
+	glBegin(GL_POLYGON);
+		glVertex2f(TIMELINE_LEFT, TIMELINE_BOTTOM);
+		glVertex2f(x, TIMELINE_BOTTOM);
+		glVertex2f(x, TIMELINE_TOP);
+		glVertex2f(TIMELINE_LEFT, TIMELINE_TOP);
+	glEnd();
+	glColor4f(0.5f, 0.5f, 0.5f, 1.f);
+	glBegin(GL_LINE_LOOP);
+		glVertex2f(TIMELINE_LEFT, TIMELINE_BOTTOM);
+		glVertex2f(TIMELINE_RIGHT, TIMELINE_BOTTOM);
+		glVertex2f(TIMELINE_RIGHT, TIMELINE_TOP);
+		glVertex2f(TIMELINE_LEFT, TIMELINE_TOP);
+	glEnd();
+	if (!isLive)
+	{
+		glColor4f(1.f, 1.f, 0.f, 1.f);
+		glBegin(GL_LINES);
+			glVertex2f(x, TIMELINE_BOTTOM - 4);
+			glVertex2f(x, TIMELINE_TOP + 4);
+		glEnd();
+	}
+	displayTextualInfo(label, TIMELINE_RIGHT + 8, TIMELINE_BOTTOM + 1, 0);
+}
+
+int scrubPosition(float* position)
+{
+	*position = gScrubPosition;
+	return gScrubbing;
 }
 
 
@@ -389,9 +594,21 @@ void myGridPaneMouse(int button, int state, int x, int y)
 	switch (button)
 	{
 		case GLUT_LEFT_BUTTON:
-			if (state == GLUT_DOWN)
+			if (state == GLUT_DOWN && gGridRows > 0 && x >= 0 && y >= 0 &&
+				x < (int) GRID_PANE_WIDTH && y < (int) GRID_PANE_HEIGHT)
 			{
-				//	do something
+				//	select the square under the mouse (the pane's y axis points up,
+				//	glut's down), or deselect it if it already was
+				unsigned int row = (unsigned int) ((GRID_PANE_HEIGHT - 1 - y) * (unsigned long long) gGridRows / GRID_PANE_HEIGHT);
+				unsigned int col = (unsigned int) (x * (unsigned long long) gGridCols / GRID_PANE_WIDTH);
+				if (gHasSelection && row == gSelectedRow && col == gSelectedCol)
+					gHasSelection = 0;
+				else
+				{
+					gSelectedRow = row;
+					gSelectedCol = col;
+					gHasSelection = 1;
+				}
 			}
 			else if (state == GLUT_UP)
 			{
@@ -410,16 +627,34 @@ void myGridPaneMouse(int button, int state, int x, int y)
 //	This function is called when a mouse event occurs in the state pane
 void myStatePaneMouse(int button, int state, int x, int y)
 {
+	//	the pane's y axis points up, glut's down
+	const int paneY = (int) STATE_PANE_HEIGHT - 1 - y;
+	const int onTimeline = gHasTimeline && paneY <= (int) TIMELINE_TOP + 4 && x >= (int) TIMELINE_LEFT - 4;
+
 	switch (button)
 	{
 		case GLUT_LEFT_BUTTON:
-			if (state == GLUT_DOWN)
+			if (state == GLUT_DOWN && onTimeline && x > (int) TIMELINE_RIGHT)
+			{
+				//	back to the live grid
+				gScrubbing = 0;
+				gScrubPosition = 1.f;
+			}
+			else if (state == GLUT_DOWN && onTimeline)
 			{
-				//	do something
+				//	start scrubbing
+				gDraggingTimeline = 1;
+				gScrubbing = 1;
+				myStatePaneMotion(x, y);
+			}
+			else if (state == GLUT_DOWN)
+			{
+				//	clear the selection
+				gHasSelection = 0;
 			}
 			else if (state == GLUT_UP)
 			{
-				//	exit(0);
+				gDraggingTimeline = 0;
 			}
 			break;
 			
@@ -431,12 +666,28 @@ void myStatePaneMouse(int button, int state, int x, int y)
 	glutPostRedisplay();
 }
 
+//	This function is called when the mouse moves in the state pane with a button down
+void myStatePaneMotion(int x, int y)
+{
+	(void) y;
+	if (!gDraggingTimeline)
+		return;
+	float position = (float) (x - (int) TIMELINE_LEFT) / (TIMELINE_RIGHT - TIMELINE_LEFT);
+	gScrubPosition = position < 0.f ? 0.f : position > 1.f ? 1.f : position;
+
+	glutSetWindow(gMainWindow);
+	glutPostRedisplay();
+}
+
 
 //	This callback function is called when a keyboard event occurs
 //
 void myKeyboard(unsigned char c, int x, int y)
 {
-	int ok = 0;
+	//	the keys only post commands: the simulation applies them on its own thread,
+	//	so the GLUT thread never waits for a simulation lock
+	static int paused = 0;
+	int ok = 1;
 	
 	switch (c)
 	{
@@ -447,34 +698,53 @@ void myKeyboard(unsigned char c, int x, int y)
 
 		//	Test red ink up/down
 		case 'r':
-			ok = refillRedInk(MAX_ADD_INK);
+			ok = postCommand(CMD_REFILL, RED_INK);
 			break;
 
 		//	Test green ink up/down
 		case 'g':
-			ok = refillGreenInk(MAX_ADD_INK);
+			ok = postCommand(CMD_REFILL, GREEN_INK);
 			break;
 
 		//	Test blue ink up/down
 		case 'b':
-			ok = refillBlueInk(MAX_ADD_INK);
+			ok = postCommand(CMD_REFILL, BLUE_INK);
 			break;
 
 		case ',':
-			slowdownProducers();
+			ok = postCommand(CMD_SLOWDOWN, 0);
 			break;
 
 		case '.':
-			speedupProducers();
+			ok = postCommand(CMD_SPEEDUP, 0);
+			break;
+
+		//	pause/resume the travelers
+		case 'p':
+			ok = postCommand(paused ? CMD_RESUME : CMD_PAUSE, 0);
+			if (ok)
+				paused = !paused;
+			break;
+
+		case 'n':
+			ok = postCommand(CMD_SPAWN, SPAWN_BATCH);
+			break;
+
+		case 'c':
+			ok = postCommand(CMD_CHECKPOINT, 0);
+			break;
+
+		//	switch the grid pane between the ink and the contention heatmap
+		case 'h':
+			gShowHeatmap = !gShowHeatmap;
 			break;
 
 		default:
-			ok = 1;
 			break;
 	}
 	if (!ok)
 	{
-		//	do something?
+		printf("The simulation is busy: command dropped\n");
 	}
 	
 	glutSetWindow(gMainWindow);
@@ -562,6 +832,7 @@ void initializeFrontEnd(int argc, char** argv, void (*gridDisplayCB)(void),
 	glOrtho(0.0f, STATE_PANE_WIDTH, 0.0f, STATE_PANE_HEIGHT, -1, 1);
 	glClearColor(0.f, 0.f, 0.f, 1.f);
 	glutKeyboardFunc(myKeyboard);
-	glutMouseFunc(myGridPaneMouse);
+	glutMouseFunc(myStatePaneMouse);
+	glutMotionFunc(myStatePaneMotion);
 	glutDisplayFunc(stateDisplayCB);
 }
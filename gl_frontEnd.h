@@ -57,7 +57,8 @@ typedef enum TravelerType {
 								NUM_TRAV_TYPES
 } TravelerType;
 
-//	Traveler info data type
+//	Traveler info data type: the unpacked state of one traveler, private to the thread
+//	moving it, which publishes it to the traveler store (see below)
 typedef struct TravelerInfo {
 								TravelerType type;
 								//	location of the traveler
@@ -68,11 +69,33 @@ typedef struct TravelerInfo {
 								// initialized to 1, set to 0 if terminates
 								unsigned char isLive;
 
-								pthread_t threadID;
-
 								unsigned int index;
 } TravelerInfo;
 
+//	Traveler store: the shared state of all the travelers, as a structure of arrays, so
+//	that a loop over the travelers (drawing, watchdog) only streams the fields it needs.
+//	Each field of a traveler is written with a single atomic store, so it can be read
+//	without locks.
+//	Grid dimensions are at most 65536, so a position packs its row and column in 16 bits each.
+#define TRAVELER_POSITION(row, col)			(((unsigned int) (row) << 16) | (unsigned int) (col))
+#define TRAVELER_ROW(position)				((position) >> 16)
+#define TRAVELER_COL(position)				((position) & 0xFFFF)
+//	The type and direction fit in 2 bits each
+#define TRAVELER_ATTRIBUTES(type, dir)		((unsigned char) (((unsigned int) (type) << 2) | (unsigned int) (dir)))
+#define TRAVELER_TYPE(attributes)			((TravelerType) ((attributes) >> 2))
+#define TRAVELER_DIR(attributes)			((TravelDirection) ((attributes) & 3))
+
+typedef struct TravelerStore {
+								unsigned int count;
+								//	TRAVELER_POSITION of each traveler
+								unsigned int* position;
+								//	TRAVELER_ATTRIBUTES of each traveler
+								unsigned char* attributes;
+								//	bit k % 64 of word k / 64 is set while traveler k is live
+								//	(updated with atomic fetch-or/fetch-and)
+								unsigned long long* live;
+} TravelerStore;
+
 //
 typedef enum ProducerType {
 								RED_INK = 0,
@@ -82,22 +105,145 @@ typedef enum ProducerType {
 								NUM_PRODUCER_TYPES
 } ProducerType;
 
-// Producer info data type
+// Producer info data type.  Producers don't have a thread of their own: they are
+// woken by their timer, from the production scheduler thread, only while their
+// tank is being topped up.
 typedef struct ProducerInfo {
 								ProducerType type;
 
-								pthread_t threadID;
+								// timerfd that paces this producer's refills
+								int timerFd;
+								// set while the timer is running
+								unsigned char isArmed;
+								// rank of this producer among the producers of its color
+								unsigned int rank;
 
 } ProducerInfo;
 
+// State of the producer rate controller, shown with the tanks.  With a target level,
+// each color's production rate is adjusted to hold its tank at that level.
+typedef struct ProducerControl {
+								// tank level to hold (0: manual control)
+								unsigned int targetLevel;
+								// time between two refills of one producer, in microseconds
+								unsigned int sleepTime[NUM_PRODUCER_TYPES];
+								// measured consumption, in ink per second
+								unsigned int consumption[NUM_PRODUCER_TYPES];
+} ProducerControl;
+
+// Commands from the user interface.  The front end only posts them (see postCommand),
+// and never touches the simulation itself: they are applied by the simulation's
+// control thread.
+typedef enum CommandType {
+								CMD_REFILL = 0,		// arg: the ProducerType of the tank
+								CMD_SPEEDUP,		// speed the producers up
+								CMD_SLOWDOWN,		// slow the producers down
+								CMD_PAUSE,
+								CMD_RESUME,
+								CMD_SPAWN,			// arg: number of travelers
+								CMD_CHECKPOINT,		// write the state of the simulation to a file
+								//
+								NUM_COMMAND_TYPES
+} CommandType;
+
+typedef struct SimCommand {
+								CommandType type;
+								unsigned int arg;
+} SimCommand;
+
+//	The grid is stored as square tiles of GRID_TILE_SIZE x GRID_TILE_SIZE squares.
+//	A tile (with the occupancy bits of its squares) is only allocated the first time
+//	a traveler touches one of its squares, so an untouched tile reads as black.
+#define GRID_TILE_SHIFT		6
+#define GRID_TILE_SIZE		(1 << GRID_TILE_SHIFT)
+#define GRID_TILE_MASK		(GRID_TILE_SIZE - 1)
+
+typedef struct GridTile {
+								//	ARGB colors of the squares, row-major within the tile
+								int color[GRID_TILE_SIZE * GRID_TILE_SIZE];
+								//	occupancy bitmap: bit j of word i is set while a traveler holds
+								//	square (i, j) of the tile.  Claimed with an atomic fetch-or,
+								//	released with an atomic fetch-and.
+								unsigned long long occupied[GRID_TILE_SIZE];
+								//	index + 1 of the traveler holding each square (0 if none),
+								//	row-major like the colors.  Only the holder of a square
+								//	writes it: set after claiming the square, cleared before
+								//	releasing it.
+								unsigned int occupant[GRID_TILE_SIZE * GRID_TILE_SIZE];
+								//	set once the tile's contention counters (TiledGrid.contention)
+								//	have been written: the counters of the other tiles are never
+								//	read, so they take no memory
+								unsigned int hasContention;
+								//	set by deposits since the history last read the tile's
+								//	colors (see history.h)
+								unsigned int changed;
+} GridTile;
+
+//	Time travelers spent blocked waiting for each square of a tile, in microseconds
+//	(saturating at UINT_MAX), row-major like the colors (see contention.h).  Kept apart
+//	from the tiles, since only the squares travelers were blocked on need them.
+typedef struct TileContention {
+								unsigned int blockedTime[GRID_TILE_SIZE * GRID_TILE_SIZE];
+} TileContention;
+
+//	Tiled grid data type
+typedef struct TiledGrid {
+								unsigned int numRows;
+								unsigned int numCols;
+								//	dimensions of the grid in tiles (rounded up)
+								unsigned int numTileRows;
+								unsigned int numTileCols;
+								//	numTileRows x numTileCols tile pointers, NULL until touched.
+								//	Published with an atomic compare-and-swap, so read them
+								//	with an acquire load.
+								GridTile** tiles;
+								//	numTileRows x numTileCols contention counters, only valid
+								//	for the tiles with hasContention set (NULL if not kept)
+								TileContention* contention;
+} TiledGrid;
+
+//	Index of the traveler standing on square (row, col), or -1 if the square is free.
+//	Lock-free and O(1), and doesn't allocate the tile: a tile that was never touched has
+//	no traveler on it.  The answer may be stale by the time it is used.
+static inline int squareOccupant(const TiledGrid* grid, unsigned int row, unsigned int col)
+{
+	GridTile* tile = __atomic_load_n(&grid->tiles[(size_t) (row >> GRID_TILE_SHIFT) * grid->numTileCols + (col >> GRID_TILE_SHIFT)],
+									 __ATOMIC_ACQUIRE);
+	if (tile == NULL)
+		return -1;
+	unsigned int occupant = __atomic_load_n(&tile->occupant[((row & GRID_TILE_MASK) << GRID_TILE_SHIFT) | (col & GRID_TILE_MASK)],
+											__ATOMIC_RELAXED);
+	return (int) occupant - 1;
+}
+
+//	Contention counters of tile t, or NULL if no traveler was ever blocked on one of its
+//	squares
+static inline const TileContention* tileContention(const TiledGrid* grid, const GridTile* tile, size_t t)
+{
+	if (grid->contention == NULL || __atomic_load_n(&tile->hasContention, __ATOMIC_ACQUIRE) == 0)
+		return NULL;
+	return &grid->contention[t];
+}
 
 //-----------------------------------------------------------------------------
 //	Function prototypes
 //-----------------------------------------------------------------------------
 
-void drawGrid(int**grid, unsigned int numRows, unsigned int numCols);
-void drawGridAndTravelers(int**grid, unsigned int numRows, unsigned int numCols, TravelerInfo* travelList);
-void drawState(unsigned int numLiveThreads, unsigned int redLevel, unsigned int greenLevel, unsigned int blueLevel, unsigned int producerSleepTime);
+void drawGrid(TiledGrid* grid);
+void drawGridAndTravelers(TiledGrid* grid, TravelerStore* travelers);
+void drawState(unsigned int numLiveThreads, unsigned int redLevel, unsigned int greenLevel, unsigned int blueLevel, unsigned int producerSleepTime,
+			   const ProducerControl* control);
+void drawStateTable(const char* const* cells, unsigned int numRows, unsigned int numCols);
+void drawSelectionInfo(const char* const* lines, unsigned int numLines);
+// Square picked by clicking in the grid pane.  Returns 0 if no square is selected.
+int selectedSquare(unsigned int* row, unsigned int* col);
+void drawTimeline(float position, int isLive, const char* label);
+// Point of the history picked by dragging on the timeline of the state pane (0: first
+// frame, 1: last).  Returns 0 while the grid pane is live.
+int scrubPosition(float* position);
+// Post a command to the simulation, without waiting.  Returns 0 if it was dropped
+// (the command queue is full).
+int postCommand(CommandType type, unsigned int arg);
 void initializeFrontEnd(int argc, char** argv, void (*gridCB)(void), void (*stateCB)(void));
 
 #endif // GL_FRONT_END_H
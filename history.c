@@ -0,0 +1,580 @@
+//
+//  history.c
+//  GL threads
+//
+//  History of the grid (see history.h)
+//
+//  Nathan Larson 2017-05-02
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "simulation.h"
+#include "arena.h"
+#include "history.h"
+
+
+//-----------------------------------------------------------------------------
+//	Data types and constants
+//-----------------------------------------------------------------------------
+
+#define HISTORY_TILE_CELLS			(GRID_TILE_SIZE * GRID_TILE_SIZE)
+// deltas smaller than this never call for a keyframe: they are quick to apply anyway
+#define HISTORY_MIN_DELTA_BYTES		(64UL << 10)
+#define HISTORY_FILE_TEMPLATE		"/tmp/glthreads.history.XXXXXX"
+// number of frames rebuilt to time the rebuilds, in the headless summary
+#define HISTORY_TIMED_REBUILDS		8
+
+typedef struct HistoryBuffer {
+								unsigned char* data;
+								size_t size;
+								size_t capacity;
+} HistoryBuffer;
+
+//	A keyframe and the deltas that follow it.  Once the group is moved to the
+//	history file, its buffer's data is NULL and its records are at fileOffset.
+typedef struct HistoryGroup {
+								unsigned int firstFrame;
+								HistoryBuffer buffer;
+								off_t fileOffset;
+} HistoryGroup;
+
+typedef struct HistoryFrame {
+								// in nanoseconds since the history started
+								unsigned long long time;
+								// start of the frame's record in its group's buffer
+								size_t offset;
+} HistoryFrame;
+
+
+//-----------------------------------------------------------------------------
+//	Global variables
+//-----------------------------------------------------------------------------
+
+unsigned int historyBudget = 64;
+unsigned int historyPeriod = 100;
+
+//	The recorded frames, shared by the history thread and the reader of the history
+static pthread_mutex_t historyLock = PTHREAD_MUTEX_INITIALIZER;
+static HistoryGroup* groups = NULL;
+static unsigned int numGroups = 0, groupCapacity = 0;
+static HistoryFrame* frames = NULL;
+static unsigned int numFrames = 0, frameCapacity = 0;
+// groups before oldestInMemory are in the file
+static unsigned int oldestInMemory = 0;
+static size_t memoryBytes = 0, fileBytes = 0;
+// size the frames would take uncompressed (all the inked tiles' colors)
+static unsigned long long fullFrameBytes = 0;
+
+//	History thread only: the colors of the previous frame, for the tiles that
+//	ever had ink (shadowPresent)
+static int* shadowColors;
+static unsigned char* shadowPresent;
+static size_t numShadowTiles = 0;
+static HistoryBuffer record = {NULL, 0, 0};
+// size of the last keyframe, and of the deltas since
+static size_t keyframeBytes = 0, deltaBytes = 0;
+static unsigned int changedCells[HISTORY_TILE_CELLS];
+static int historyFd = -1;
+static int spillFailed = 0;
+
+//	historyFrame's caller only: the rebuilt grid, and where the rebuild stands
+static TiledGrid replay;
+static GridTile* replayStorage = NULL;
+static HistoryBuffer readBack = {NULL, 0, 0};
+static unsigned int readBackGroup = UINT_MAX;
+static unsigned int replayGroup = UINT_MAX, replayFrame = 0;
+
+
+//-----------------------------------------------------------------------------
+//	Encoding: unsigned values are written 7 bits at a time, low bits first, with
+//	the high bit of each byte set if more bytes follow
+//-----------------------------------------------------------------------------
+
+static void reserveBuffer(HistoryBuffer* buffer, size_t bytes)
+{
+	if (buffer->size + bytes <= buffer->capacity)
+		return;
+	size_t capacity = buffer->capacity > 0 ? buffer->capacity : 4096;
+	while (capacity < buffer->size + bytes)
+		capacity *= 2;
+	unsigned char* data = (unsigned char*) realloc(buffer->data, capacity);
+	if (data == NULL)
+	{
+		fprintf(stderr, "Could not allocate the history (%zu bytes)\n", capacity);
+		exit(EXIT_FAILURE);
+	}
+	buffer->data = data;
+	buffer->capacity = capacity;
+}
+
+static inline void putValue(HistoryBuffer* buffer, unsigned long long value)
+{
+	reserveBuffer(buffer, 10);
+	while (value >= 0x80)
+	{
+		buffer->data[buffer->size++] = (unsigned char) (value | 0x80);
+		value >>= 7;
+	}
+	buffer->data[buffer->size++] = (unsigned char) value;
+}
+
+static inline const unsigned char* getValue(const unsigned char* p, unsigned long long* value)
+{
+	unsigned long long v = 0;
+	unsigned int shift = 0;
+	while (*p & 0x80)
+	{
+		v |= (unsigned long long) (*p++ & 0x7F) << shift;
+		shift += 7;
+	}
+	*value = v | ((unsigned long long) *p++ << shift);
+	return p;
+}
+
+
+//-----------------------------------------------------------------------------
+//	Recording
+//-----------------------------------------------------------------------------
+
+/*
+ * Diff the changed tiles against the previous frame, and encode the frame: a keyframe
+ * lists the runs of equal colors of every inked tile, a delta lists the squares that
+ * changed.  In both, a tile starts with its index + 1 minus the previous tile's (so
+ * 0 ends the frame), and colors are stored without their alpha.
+ */
+static void encodeFrame(int isKeyframe)
+{
+	size_t numTiles = (size_t) grid.numTileRows * grid.numTileCols;
+	size_t previousTile = 0;
+	record.size = 0;
+
+	for (size_t t=0; t<numTiles; t++)
+	{
+		GridTile* tile = __atomic_load_n(&grid.tiles[t], __ATOMIC_ACQUIRE);
+		if (tile == NULL || __atomic_load_n(&tile->changed, __ATOMIC_RELAXED) == 0)
+			continue;
+		// clear the mark before reading the colors: a deposit this frame misses marks
+		// the tile again (see depositInk())
+		__atomic_store_n(&tile->changed, 0, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+		int* shadow = &shadowColors[t * HISTORY_TILE_CELLS];
+		if (!shadowPresent[t])
+		{
+			for (unsigned int k=0; k<HISTORY_TILE_CELLS; k++)
+				shadow[k] = 0xFF000000;
+			shadowPresent[t] = 1;
+			numShadowTiles++;
+		}
+		unsigned int numChanged = 0;
+		for (unsigned int k=0; k<HISTORY_TILE_CELLS; k++)
+		{
+			int color = __atomic_load_n(&tile->color[k], __ATOMIC_RELAXED);
+			if (color != shadow[k])
+			{
+				shadow[k] = color;
+				changedCells[numChanged++] = k;
+			}
+		}
+		if (isKeyframe || numChanged == 0)
+			continue;
+
+		putValue(&record, t + 1 - previousTile);
+		previousTile = t + 1;
+		putValue(&record, numChanged);
+		unsigned int previousCell = 0;
+		for (unsigned int j=0; j<numChanged; j++)
+		{
+			putValue(&record, changedCells[j] + 1 - previousCell);
+			previousCell = changedCells[j] + 1;
+			putValue(&record, (unsigned int) shadow[changedCells[j]] & 0xFFFFFF);
+		}
+	}
+
+	if (isKeyframe)
+	{
+		for (size_t t=0; t<numTiles; t++)
+		{
+			if (!shadowPresent[t])
+				continue;
+			putValue(&record, t + 1 - previousTile);
+			previousTile = t + 1;
+			const int* shadow = &shadowColors[t * HISTORY_TILE_CELLS];
+			for (unsigned int k=0; k<HISTORY_TILE_CELLS; )
+			{
+				unsigned int run = 1;
+				while (k + run < HISTORY_TILE_CELLS && shadow[k + run] == shadow[k])
+					run++;
+				putValue(&record, run);
+				putValue(&record, (unsigned int) shadow[k] & 0xFFFFFF);
+				k += run;
+			}
+		}
+	}
+	putValue(&record, 0);
+}
+
+/*
+ * Append the encoded frame to the history
+ */
+static void appendFrame(int isKeyframe, unsigned long long time)
+{
+	pthread_mutex_lock(&historyLock);
+	if (isKeyframe)
+	{
+		if (numGroups == groupCapacity)
+		{
+			groupCapacity = groupCapacity > 0 ? 2 * groupCapacity : 64;
+			groups = (HistoryGroup*) realloc(groups, groupCapacity * sizeof(HistoryGroup));
+			if (groups == NULL)
+			{
+				fprintf(stderr, "Could not allocate the history's groups\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+		// the group before is complete: give back its spare capacity
+		if (numGroups > 0 && groups[numGroups - 1].buffer.data != NULL)
+		{
+			HistoryBuffer* sealed = &groups[numGroups - 1].buffer;
+			unsigned char* data = (unsigned char*) realloc(sealed->data, sealed->size);
+			if (data != NULL)
+			{
+				memoryBytes -= sealed->capacity - sealed->size;
+				sealed->data = data;
+				sealed->capacity = sealed->size;
+			}
+		}
+		memset(&groups[numGroups], 0, sizeof(HistoryGroup));
+		groups[numGroups].firstFrame = numFrames;
+		numGroups++;
+	}
+	if (numFrames == frameCapacity)
+	{
+		frameCapacity = frameCapacity > 0 ? 2 * frameCapacity : 1024;
+		frames = (HistoryFrame*) realloc(frames, frameCapacity * sizeof(HistoryFrame));
+		if (frames == NULL)
+		{
+			fprintf(stderr, "Could not allocate the history's frames\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	HistoryGroup* group = &groups[numGroups - 1];
+	frames[numFrames].time = time;
+	frames[numFrames].offset = group->buffer.size;
+	memoryBytes -= group->buffer.capacity;
+	reserveBuffer(&group->buffer, record.size);
+	memcpy(group->buffer.data + group->buffer.size, record.data, record.size);
+	group->buffer.size += record.size;
+	memoryBytes += group->buffer.capacity;
+
+	numFrames++;
+	fullFrameBytes += (unsigned long long) numShadowTiles * HISTORY_TILE_CELLS * sizeof(int);
+	pthread_mutex_unlock(&historyLock);
+}
+
+/*
+ * Move the oldest complete groups to the history file until the history fits its
+ * budget again.  A group's records don't change once it is complete, so they are
+ * written without holding the lock.
+ */
+static void spillHistory(void)
+{
+	size_t budget = (size_t) historyBudget << 20;
+	while (!spillFailed)
+	{
+		pthread_mutex_lock(&historyLock);
+		if (memoryBytes <= budget || oldestInMemory + 1 >= numGroups)
+		{
+			pthread_mutex_unlock(&historyLock);
+			return;
+		}
+		unsigned int g = oldestInMemory;
+		unsigned char* data = groups[g].buffer.data;
+		size_t size = groups[g].buffer.size;
+		off_t offset = (off_t) fileBytes;
+		pthread_mutex_unlock(&historyLock);
+
+		if (historyFd < 0)
+		{
+			char path[] = HISTORY_FILE_TEMPLATE;
+			historyFd = mkstemp(path);
+			if (historyFd >= 0)
+				unlink(path);
+		}
+		size_t written = 0;
+		while (historyFd >= 0 && written < size)
+		{
+			ssize_t n = pwrite(historyFd, data + written, size - written, offset + (off_t) written);
+			if (n <= 0)
+				break;
+			written += (size_t) n;
+		}
+		if (written < size)
+		{
+			perror("history file");
+			fprintf(stderr, "The history stays in memory, over its budget\n");
+			spillFailed = 1;
+			return;
+		}
+
+		pthread_mutex_lock(&historyLock);
+		groups[g].fileOffset = offset;
+		groups[g].buffer.data = NULL;
+		memoryBytes -= groups[g].buffer.capacity;
+		groups[g].buffer.capacity = 0;
+		fileBytes += size;
+		oldestInMemory++;
+		pthread_mutex_unlock(&historyLock);
+		free(data);
+	}
+}
+
+static void* historyThread(void* arg)
+{
+	(void) arg;
+	struct timespec next, now;
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	unsigned long long start = next.tv_sec * 1000000000ULL + next.tv_nsec;
+	for (unsigned int sinceKeyframe=0; ; sinceKeyframe++)
+	{
+		// a keyframe once the deltas since the last one add up to as much: rebuilding a
+		// frame never decodes more than about twice a keyframe
+		int isKeyframe = (keyframeBytes == 0 || sinceKeyframe == HISTORY_KEYFRAME_INTERVAL ||
+						  (deltaBytes >= keyframeBytes && deltaBytes >= HISTORY_MIN_DELTA_BYTES));
+		if (isKeyframe)
+			sinceKeyframe = 0;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		encodeFrame(isKeyframe);
+		if (isKeyframe)
+		{
+			keyframeBytes = record.size;
+			deltaBytes = 0;
+		}
+		else
+			deltaBytes += record.size;
+		appendFrame(isKeyframe, now.tv_sec * 1000000000ULL + now.tv_nsec - start);
+		spillHistory();
+
+		// next period, or right away if this frame took longer than a period
+		next.tv_nsec += (long) historyPeriod * 1000000L;
+		next.tv_sec += next.tv_nsec / 1000000000L;
+		next.tv_nsec %= 1000000000L;
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+	}
+	return NULL;
+}
+
+void startHistory(void)
+{
+	size_t numTiles = (size_t) grid.numTileRows * grid.numTileCols;
+	shadowColors = (int*) arenaAllocLazy(numTiles * HISTORY_TILE_CELLS, sizeof(int), "history colors");
+	shadowPresent = (unsigned char*) arenaAlloc(numTiles, 1, "history tiles");
+
+	pthread_t recorder;
+	int errCode = pthread_create(&recorder, NULL, historyThread, NULL);
+	if (errCode != 0)
+	{
+		printf("could not pthread_create history thread. %d\n", errCode);
+		exit(0);
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+//	Rebuilding frames
+//-----------------------------------------------------------------------------
+
+/*
+ * Return replay tile t, black if it wasn't part of the frame so far
+ */
+static GridTile* replayTile(size_t t)
+{
+	if (replay.tiles[t] == NULL)
+	{
+		replay.tiles[t] = &replayStorage[t];
+		for (unsigned int k=0; k<HISTORY_TILE_CELLS; k++)
+			replayStorage[t].color[k] = 0xFF000000;
+	}
+	return replay.tiles[t];
+}
+
+static void applyKeyframe(const unsigned char* p)
+{
+	memset(replay.tiles, 0, (size_t) replay.numTileRows * replay.numTileCols * sizeof(GridTile*));
+	unsigned long long gap, run, color;
+	size_t t = 0;
+	while ((p = getValue(p, &gap)), gap > 0)
+	{
+		t += gap;
+		GridTile* tile = &replayStorage[t - 1];
+		replay.tiles[t - 1] = tile;
+		for (unsigned int k=0; k<HISTORY_TILE_CELLS; )
+		{
+			p = getValue(getValue(p, &run), &color);
+			for (unsigned int end=k+(unsigned int)run; k<end; k++)
+				tile->color[k] = (int) (0xFF000000U | (unsigned int) color);
+		}
+	}
+}
+
+static void applyDelta(const unsigned char* p)
+{
+	unsigned long long gap, numChanged, cellGap, color;
+	size_t t = 0;
+	while ((p = getValue(p, &gap)), gap > 0)
+	{
+		t += gap;
+		GridTile* tile = replayTile(t - 1);
+		p = getValue(p, &numChanged);
+		unsigned int k = 0;
+		for (unsigned long long j=0; j<numChanged; j++)
+		{
+			p = getValue(getValue(p, &cellGap), &color);
+			k += (unsigned int) cellGap;
+			tile->color[k - 1] = (int) (0xFF000000U | (unsigned int) color);
+		}
+	}
+}
+
+unsigned int historyLength(double* duration)
+{
+	pthread_mutex_lock(&historyLock);
+	unsigned int length = numFrames;
+	*duration = length > 0 ? frames[length - 1].time * 1e-9 : 0.;
+	pthread_mutex_unlock(&historyLock);
+	return length;
+}
+
+TiledGrid* historyFrame(unsigned int frame, double* frameTime, double* rebuildTime)
+{
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	// the replay grid's tiles take memory only once a frame has ink on them
+	if (replayStorage == NULL)
+	{
+		replay = grid;
+		size_t numTiles = (size_t) grid.numTileRows * grid.numTileCols;
+		void* storage = mmap(NULL, numTiles * sizeof(GridTile), PROT_READ | PROT_WRITE,
+							 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		replay.tiles = (GridTile**) calloc(numTiles, sizeof(GridTile*));
+		if (storage == MAP_FAILED || replay.tiles == NULL)
+		{
+			fprintf(stderr, "Could not allocate the history's replay grid\n");
+			exit(EXIT_FAILURE);
+		}
+		replayStorage = (GridTile*) storage;
+	}
+
+	pthread_mutex_lock(&historyLock);
+	if (frame >= numFrames)
+	{
+		pthread_mutex_unlock(&historyLock);
+		return NULL;
+	}
+	// last group that starts at or before the frame
+	unsigned int g = 0, after = numGroups;
+	while (after - g > 1)
+	{
+		unsigned int middle = (g + after) / 2;
+		if (groups[middle].firstFrame <= frame)
+			g = middle;
+		else
+			after = middle;
+	}
+	HistoryGroup* group = &groups[g];
+	const unsigned char* data = group->buffer.data;
+	if (data == NULL)
+	{
+		// read the group back from the file (groups there are complete: keep it)
+		if (readBackGroup != g)
+		{
+			size_t size = group->buffer.size, done = 0;
+			readBack.size = 0;
+			reserveBuffer(&readBack, size);
+			while (done < size)
+			{
+				ssize_t n = pread(historyFd, readBack.data + done, size - done, group->fileOffset + (off_t) done);
+				if (n <= 0)
+					break;
+				done += (size_t) n;
+			}
+			if (done < size)
+			{
+				pthread_mutex_unlock(&historyLock);
+				readBackGroup = UINT_MAX;
+				return NULL;
+			}
+			readBackGroup = g;
+		}
+		data = readBack.data;
+	}
+
+	// move forward from the frame rebuilt last if it's in the same group, or start
+	// over from the group's keyframe
+	unsigned int from = group->firstFrame + 1;
+	if (replayGroup == g && replayFrame <= frame)
+		from = replayFrame + 1;
+	else
+		applyKeyframe(data + frames[group->firstFrame].offset);
+	for (unsigned int j=from; j<=frame; j++)
+		applyDelta(data + frames[j].offset);
+	replayGroup = g;
+	replayFrame = frame;
+	*frameTime = frames[frame].time * 1e-9;
+	pthread_mutex_unlock(&historyLock);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	*rebuildTime = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+	return &replay;
+}
+
+void printHistorySummary(void)
+{
+	pthread_mutex_lock(&historyLock);
+	unsigned int length = numFrames, keyframes = numGroups;
+	double duration = length > 0 ? frames[length - 1].time * 1e-9 : 0.;
+	size_t inMemory = memoryBytes, inFile = fileBytes;
+	size_t stored = fileBytes;
+	for (unsigned int g=oldestInMemory; g<numGroups; g++)
+		stored += groups[g].buffer.size;
+	unsigned long long full = fullFrameBytes;
+	pthread_mutex_unlock(&historyLock);
+
+	printf("history: %u frames (%u keyframes) over %.1f s, %.2f MB for %.1f MB of full frames (%.0fx), %.2f MB in memory, %.2f MB in file\n",
+			length, keyframes, duration, stored / 1048576., full / 1048576., stored > 0 ? (double) full / stored : 0.,
+			inMemory / 1048576., inFile / 1048576.);
+	if (length == 0)
+		return;
+
+	// the last frame of a group is the slowest to rebuild: time a few of them, each
+	// from scratch
+	double total = 0., longest = 0., frameTime, rebuildTime;
+	unsigned int numTimed = 0;
+	for (unsigned int j=0; j<HISTORY_TIMED_REBUILDS; j++)
+	{
+		unsigned int g = (unsigned int) ((unsigned long long) keyframes * j / HISTORY_TIMED_REBUILDS);
+		pthread_mutex_lock(&historyLock);
+		unsigned int frame = (g + 1 < numGroups) ? groups[g + 1].firstFrame - 1 : length - 1;
+		pthread_mutex_unlock(&historyLock);
+		replayGroup = UINT_MAX;
+		if (historyFrame(frame, &frameTime, &rebuildTime) == NULL)
+			continue;
+		total += rebuildTime;
+		if (rebuildTime > longest)
+			longest = rebuildTime;
+		numTimed++;
+	}
+	if (numTimed > 0)
+		printf("history rebuilds: %.2f ms on average, %.2f ms at most (%u frames, the last of their keyframe's group)\n",
+				total * 1e3 / numTimed, longest * 1e3, numTimed);
+}
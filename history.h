@@ -0,0 +1,53 @@
+//
+//  history.h
+//  GL threads
+//
+//  History of the grid, to rewind and scrub the grid pane through the run.  A
+//  background thread takes a frame of the grid's colors every -historyPeriod ms: a
+//  full keyframe, or a delta that only lists the squares whose color changed.  A
+//  keyframe is taken once the deltas since the last one add up to its size (or after
+//  HISTORY_KEYFRAME_INTERVAL frames).  Travelers don't record anything: a
+//  deposit only marks its tile as changed (GridTile.changed), and the history thread
+//  diffs the changed tiles against a copy of the colors of the previous frame.
+//
+//  Frames are compressed as they are taken (runs of equal colors in keyframes,
+//  variable-length gaps between the changed squares of deltas), and a keyframe and
+//  its deltas are kept together as a group.  When the groups take more than
+//  -history MB, the oldest ones are moved to a temporary file, and read back
+//  when a frame is asked for.  Any frame is rebuilt from its group's keyframe and
+//  deltas: no more than about twice a keyframe to decode.
+//
+//  Nathan Larson 2017-05-02
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include "gl_frontEnd.h"
+
+#define HISTORY_KEYFRAME_INTERVAL	50
+// arena taken by the copy of the colors of the previous frame, per tile of the grid
+#define HISTORY_BYTES_PER_TILE		(GRID_TILE_SIZE * GRID_TILE_SIZE * sizeof(int) + 1)
+
+// memory budget of the history in MB (0: no history), and time between two frames in ms
+extern unsigned int historyBudget;
+extern unsigned int historyPeriod;
+
+// Start the thread that records the history
+void startHistory(void);
+
+// Number of frames recorded so far, and the time of the last one (seconds since the
+// history started)
+unsigned int historyLength(double* duration);
+
+/*
+ * Rebuild the grid as it was at frame (0 .. historyLength() - 1).  Returns a grid owned
+ * by the history, valid until the next call, or NULL if there is no such frame.  Sets
+ * the time of the frame and the time the rebuild took (in seconds).  Only one thread
+ * at a time may call it (the GLUT thread, or the headless summary).
+ */
+TiledGrid* historyFrame(unsigned int frame, double* frameTime, double* rebuildTime);
+
+// Print the history's size, compression and rebuild time (headless summary)
+void printHistorySummary(void);
+
+#endif // HISTORY_H
@@ -0,0 +1,195 @@
+//
+//  lifecycle.c
+//  GL threads
+//
+//  Traveler lifecycle latency histograms (see lifecycle.h).  Travelers only add to the
+//  histograms when they reach a corner, which is rare enough that the histograms can be
+//  shared, and updated with atomic increments.
+//
+//  Nathan Larson 2017-05-02
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "simulation.h"
+#include "lifecycle.h"
+#include "arena.h"
+
+
+//-----------------------------------------------------------------------------
+//	Data types
+//-----------------------------------------------------------------------------
+
+// Values below 2^SUB_BUCKET_BITS get a bucket each; above, each power of 2 is split in
+// 2^SUB_BUCKET_BITS buckets.  That covers the whole range of 64-bit values.
+#define SUB_BUCKET_BITS		3
+#define SUB_BUCKETS			(1 << SUB_BUCKET_BITS)
+#define HISTOGRAM_BUCKETS	((64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS)
+
+typedef struct LatencyHistogram {
+								unsigned long long count;
+								unsigned long long bucket[HISTOGRAM_BUCKETS];
+} LatencyHistogram;
+
+
+//-----------------------------------------------------------------------------
+//	Global variables
+//-----------------------------------------------------------------------------
+
+TravelerLife* travelerLife;
+__thread TravelerLife* currentLife = NULL;
+
+static LatencyHistogram lifeHistogram[NUM_TRAV_TYPES][NUM_LIFE_METRICS];
+
+static const char* const LIFE_METRIC_NAMES[NUM_LIFE_METRICS] = {"lifetime", "moving", "ink wait", "blocked"};
+static const char* const TRAVELER_COLOR_NAMES[NUM_TRAV_TYPES] = {"red", "green", "blue"};
+
+
+//-----------------------------------------------------------------------------
+//	Histograms
+//-----------------------------------------------------------------------------
+
+static unsigned int bucketOf(unsigned long long value)
+{
+	if (value < SUB_BUCKETS)
+		return (unsigned int) value;
+	unsigned int exponent = 63 - (unsigned int) __builtin_clzll(value);
+	return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + (unsigned int) ((value >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1));
+}
+
+/*
+ * Highest value that falls in a bucket
+ */
+static unsigned long long bucketTop(unsigned int bucket)
+{
+	if (bucket < SUB_BUCKETS)
+		return bucket;
+	unsigned int exponent = bucket / SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+	unsigned long long bottom = (unsigned long long) (SUB_BUCKETS + bucket % SUB_BUCKETS) << (exponent - SUB_BUCKET_BITS);
+	return bottom + (1ULL << (exponent - SUB_BUCKET_BITS)) - 1;
+}
+
+static void recordLatency(LatencyHistogram* histogram, unsigned long long value)
+{
+	__atomic_add_fetch(&histogram->bucket[bucketOf(value)], 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&histogram->count, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Value below which a fraction of the recorded values fall (0 if there are none)
+ */
+static unsigned long long latencyPercentile(LatencyHistogram* histogram, double fraction)
+{
+	unsigned long long count = __atomic_load_n(&histogram->count, __ATOMIC_RELAXED);
+	if (count == 0)
+		return 0;
+	unsigned long long rank = (unsigned long long) (fraction * count + 0.999999);
+	unsigned long long seen = 0;
+	for (unsigned int b=0; b<HISTOGRAM_BUCKETS; b++)
+	{
+		seen += __atomic_load_n(&histogram->bucket[b], __ATOMIC_RELAXED);
+		if (seen >= rank)
+			return bucketTop(b);
+	}
+	return bucketTop(HISTOGRAM_BUCKETS - 1);
+}
+
+/*
+ * Write a duration (in nanoseconds) with at most 3 significant digits and a unit
+ */
+static void formatDuration(char* str, size_t size, unsigned long long ns)
+{
+	static const char* const UNITS[] = {"ns", "us", "ms", "s"};
+	double value = (double) ns;
+	unsigned int unit = 0;
+	while (unit < 3 && value >= 1000.)
+	{
+		value /= 1000.;
+		unit++;
+	}
+	snprintf(str, size, value < 10. && unit > 0 ? "%.1f%s" : "%.0f%s", value, UNITS[unit]);
+}
+
+/*
+ * p50/p99/p999 of a histogram, as "p50/p99/p999" ("-" if it is empty)
+ */
+static void formatPercentiles(char* str, size_t size, LatencyHistogram* histogram)
+{
+	if (__atomic_load_n(&histogram->count, __ATOMIC_RELAXED) == 0)
+	{
+		snprintf(str, size, "-");
+		return;
+	}
+	char p50[16], p99[16], p999[16];
+	formatDuration(p50, sizeof(p50), latencyPercentile(histogram, 0.5));
+	formatDuration(p99, sizeof(p99), latencyPercentile(histogram, 0.99));
+	formatDuration(p999, sizeof(p999), latencyPercentile(histogram, 0.999));
+	snprintf(str, size, "%s/%s/%s", p50, p99, p999);
+}
+
+void formatLatencyTable(char cells[LATENCY_TABLE_ROWS][LATENCY_TABLE_COLS][LATENCY_CELL_SIZE])
+{
+	snprintf(cells[0][0], LATENCY_CELL_SIZE, "p50/p99/p999");
+	for (unsigned int c=0; c<NUM_TRAV_TYPES; c++)
+		snprintf(cells[0][1 + c], LATENCY_CELL_SIZE, "%s (%llu)", TRAVELER_COLOR_NAMES[c],
+				 __atomic_load_n(&lifeHistogram[c][LIFE_TOTAL].count, __ATOMIC_RELAXED));
+	for (unsigned int m=0; m<NUM_LIFE_METRICS; m++)
+	{
+		snprintf(cells[1 + m][0], LATENCY_CELL_SIZE, "%s", LIFE_METRIC_NAMES[m]);
+		for (unsigned int c=0; c<NUM_TRAV_TYPES; c++)
+			formatPercentiles(cells[1 + m][1 + c], LATENCY_CELL_SIZE, &lifeHistogram[c][m]);
+	}
+}
+
+/*
+ * Print the percentiles of all histograms (registered with atexit)
+ */
+static void printLatencySummary(void)
+{
+	printf("lifecycle latency (p50/p99/p999) of the travelers that reached a corner:\n");
+	for (unsigned int c=0; c<NUM_TRAV_TYPES; c++)
+	{
+		printf("  %-5s %8llu lives", TRAVELER_COLOR_NAMES[c], __atomic_load_n(&lifeHistogram[c][LIFE_TOTAL].count, __ATOMIC_RELAXED));
+		for (unsigned int m=0; m<NUM_LIFE_METRICS; m++)
+		{
+			char percentiles[LATENCY_CELL_SIZE];
+			formatPercentiles(percentiles, sizeof(percentiles), &lifeHistogram[c][m]);
+			printf(", %s %s", LIFE_METRIC_NAMES[m], percentiles);
+		}
+		printf("\n");
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+//	Traveler lives
+//-----------------------------------------------------------------------------
+
+void initializeLifecycle(void)
+{
+	travelerLife = (TravelerLife*) arenaAlloc(MAX_NUM_TRAVELER_THREADS, sizeof(TravelerLife), "traveler lifecycles");
+	atexit(printLatencySummary);
+}
+
+void beginTravelerLife(unsigned int index)
+{
+	TravelerLife* life = &travelerLife[index];
+	memset(life, 0, sizeof(TravelerLife));
+	life->spawnTime = lifecycleClock();
+}
+
+/*
+ * Split the traveler's lifetime, and add it to the histograms of its color
+ */
+void endTravelerLife(unsigned int index, TravelerType type)
+{
+	TravelerLife* life = &travelerLife[index];
+	unsigned long long lifetime = lifecycleClock() - life->spawnTime;
+	unsigned long long waited = life->inkWaitTime + life->blockedTime;
+
+	recordLatency(&lifeHistogram[type][LIFE_TOTAL], lifetime);
+	recordLatency(&lifeHistogram[type][LIFE_MOVING], lifetime > waited ? lifetime - waited : 0);
+	recordLatency(&lifeHistogram[type][LIFE_INK_WAIT], life->inkWaitTime);
+	recordLatency(&lifeHistogram[type][LIFE_BLOCKED], life->blockedTime);
+}
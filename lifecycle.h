@@ -0,0 +1,110 @@
+//
+//  lifecycle.h
+//  GL threads
+//
+//  Latency of the travelers' lifecycles: each traveler records how long it waited for
+//  ink and for squares, and when it reaches a corner, its lifetime is split into time
+//  spent moving, waiting for ink and blocked on squares.  These are added to per-color
+//  log-linear histograms (HDR style: 8 sub-buckets per power of 2, so percentiles
+//  are within 12.5%), shown as p50/p99/p999 in the state pane and printed at exit.
+//
+//  Nathan Larson 2017-05-02
+
+#ifndef LIFECYCLE_H
+#define LIFECYCLE_H
+
+#include <time.h>
+
+#include "gl_frontEnd.h"
+
+// What a traveler has recorded since it spawned, in nanoseconds.  Only written by the
+// thread moving the traveler.
+typedef struct TravelerLife {
+								unsigned long long spawnTime;
+								unsigned long long inkWaitTime;
+								unsigned long long blockedTime;
+								// start of the current shortage of ink, or wait for a square (0: none)
+								unsigned long long inkShortSince;
+								unsigned long long blockedSince;
+} TravelerLife;
+
+typedef enum LifecycleMetric {
+								LIFE_TOTAL = 0,
+								LIFE_MOVING,
+								LIFE_INK_WAIT,
+								LIFE_BLOCKED,
+								//
+								NUM_LIFE_METRICS
+} LifecycleMetric;
+
+// one entry per traveler slot
+extern TravelerLife* travelerLife;
+// life of the traveler the calling thread is moving (NULL for threads that aren't travelers)
+extern __thread TravelerLife* currentLife;
+
+// rows and columns of the table made by formatLatencyTable: a header, then one row per
+// metric, with its name and then p50/p99/p999 for each color
+#define LATENCY_TABLE_ROWS		(1 + NUM_LIFE_METRICS)
+#define LATENCY_TABLE_COLS		(1 + NUM_TRAV_TYPES)
+#define LATENCY_CELL_SIZE		48
+
+/*
+ * Time on a monotonic clock, in nanoseconds
+ */
+static inline unsigned long long lifecycleClock(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (unsigned long long) now.tv_sec * 1000000000ULL + (unsigned long long) now.tv_nsec;
+}
+
+/*
+ * Ink requests of the current traveler: the time between the first refusal and the
+ * next grant is time spent waiting for ink.  The clock is only read when a wait
+ * starts or ends.
+ */
+static inline void noteInkShortage(void)
+{
+	if (currentLife != NULL && currentLife->inkShortSince == 0)
+		currentLife->inkShortSince = lifecycleClock();
+}
+
+static inline void noteInkGranted(void)
+{
+	if (currentLife != NULL && currentLife->inkShortSince != 0)
+	{
+		currentLife->inkWaitTime += lifecycleClock() - currentLife->inkShortSince;
+		currentLife->inkShortSince = 0;
+	}
+}
+
+// Same for a traveler waiting for a square over several attempts.  noteUnblocked returns
+// the length of the wait that ended (0 if the traveler wasn't waiting).
+static inline void noteBlocked(TravelerLife* life)
+{
+	if (life->blockedSince == 0)
+		life->blockedSince = lifecycleClock();
+}
+
+static inline unsigned long long noteUnblocked(TravelerLife* life)
+{
+	if (life->blockedSince == 0)
+		return 0;
+	unsigned long long waited = lifecycleClock() - life->blockedSince;
+	life->blockedTime += waited;
+	life->blockedSince = 0;
+	return waited;
+}
+
+// Allocate the traveler records, and print the histograms at exit
+void initializeLifecycle(void);
+
+// A traveler spawned in slot index, or reached a corner (the engines point currentLife at
+// the slot of the traveler they are about to move)
+void beginTravelerLife(unsigned int index);
+void endTravelerLife(unsigned int index, TravelerType type);
+
+// Fill a LATENCY_TABLE_ROWS x LATENCY_TABLE_COLS table of percentiles (for the state pane)
+void formatLatencyTable(char cells[LATENCY_TABLE_ROWS][LATENCY_TABLE_COLS][LATENCY_CELL_SIZE]);
+
+#endif // LIFECYCLE_H
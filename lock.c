@@ -0,0 +1,271 @@
+//
+//  lock.c
+//  GL threads
+//
+//  Lock implementations selectable at startup (see lock.h)
+//
+//  Nathan Larson 2017-05-02
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include "lock.h"
+
+const char* const LOCK_NAMES[] = {"pthread", "adaptive", "ticket", "mcs", NULL};
+unsigned int lockKind = LOCK_PTHREAD;
+__thread LockStats* threadLockStats = NULL;
+
+// spins before an adaptive lock parks its thread, or a spinning lock starts yielding the CPU
+#define ADAPTIVE_SPINS	100
+#define YIELD_SPINS		1000
+
+// An MCS waiter needs a node until it releases the lock.  Critical sections don't
+// nest deeply, so a few nodes per thread are enough.
+#define MCS_NODES_PER_THREAD	4
+static __thread McsNode mcsNodes[MCS_NODES_PER_THREAD];
+static __thread unsigned int mcsNodesInUse = 0;
+
+
+/*
+ * Tell the CPU we are spinning
+ */
+static inline void cpuRelax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield");
+#endif
+}
+
+/*
+ * One iteration of a spin loop: relax the CPU, and give it up after a while
+ */
+static inline void spinWait(unsigned int* spins)
+{
+	if (++*spins < YIELD_SPINS)
+		cpuRelax();
+	else
+		sched_yield();
+}
+
+static long futex(unsigned int* address, int op, unsigned int value)
+{
+	return syscall(SYS_futex, address, op, value, NULL, NULL, 0);
+}
+
+static long futexTimedWait(unsigned int* address, unsigned int value, const struct timespec* timeout)
+{
+	return syscall(SYS_futex, address, FUTEX_WAIT_PRIVATE, value, timeout, NULL, 0);
+}
+
+/*
+ * Initialize a lock of the configured kind
+ */
+void simLockInit(SimLock* lock)
+{
+	switch (lockKind)
+	{
+		case LOCK_ADAPTIVE:
+			lock->state = 0;
+			break;
+		case LOCK_TICKET:
+			lock->ticket.next = lock->ticket.serving = 0;
+			break;
+		case LOCK_MCS:
+			lock->mcs.tail = lock->mcs.holder = NULL;
+			break;
+		default:
+			pthread_mutex_init(&lock->mutex, NULL);
+			break;
+	}
+}
+
+/*
+ * Time on a monotonic clock, in nanoseconds, for the lock wait statistics
+ */
+static unsigned long long lockClock(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (unsigned long long) now.tv_sec * 1000000000ULL + (unsigned long long) now.tv_nsec;
+}
+
+void simLock(SimLock* lock)
+{
+	unsigned int spins = 0;
+	// set (to the time the wait started) if the lock wasn't free, and the thread keeps statistics
+	unsigned long long waitStart = 0;
+	switch (lockKind)
+	{
+		case LOCK_ADAPTIVE:
+		{
+			// uncontended, then spin while the holder is (hopefully) running
+			unsigned int c = 0;
+			if (__atomic_compare_exchange_n(&lock->state, &c, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+				return;
+			if (threadLockStats != NULL)
+				waitStart = lockClock();
+			unsigned int k;
+			for (k=0; k<ADAPTIVE_SPINS; k++)
+			{
+				cpuRelax();
+				c = 0;
+				if (__atomic_load_n(&lock->state, __ATOMIC_RELAXED) == 0 &&
+					__atomic_compare_exchange_n(&lock->state, &c, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+					break;
+			}
+			if (k < ADAPTIVE_SPINS)
+				break;
+			// then park: mark the lock as having waiters, and sleep until it is released
+			c = __atomic_exchange_n(&lock->state, 2, __ATOMIC_ACQUIRE);
+			while (c != 0)
+			{
+				futex(&lock->state, FUTEX_WAIT_PRIVATE, 2);
+				c = __atomic_exchange_n(&lock->state, 2, __ATOMIC_ACQUIRE);
+			}
+			break;
+		}
+
+		case LOCK_TICKET:
+		{
+			unsigned int ticket = __atomic_fetch_add(&lock->ticket.next, 1, __ATOMIC_RELAXED);
+			if (__atomic_load_n(&lock->ticket.serving, __ATOMIC_ACQUIRE) == ticket)
+				return;
+			if (threadLockStats != NULL)
+				waitStart = lockClock();
+			while (__atomic_load_n(&lock->ticket.serving, __ATOMIC_ACQUIRE) != ticket)
+				spinWait(&spins);
+			break;
+		}
+
+		case LOCK_MCS:
+		{
+			unsigned int n = 0;
+			while (n < MCS_NODES_PER_THREAD && (mcsNodesInUse & (1u << n)))
+				n++;
+			if (n == MCS_NODES_PER_THREAD)
+			{
+				fprintf(stderr, "Too many MCS locks held by one thread\n");
+				abort();
+			}
+			mcsNodesInUse |= 1u << n;
+
+			McsNode* node = &mcsNodes[n];
+			node->next = NULL;
+			node->locked = 1;
+			McsNode* predecessor = __atomic_exchange_n(&lock->mcs.tail, node, __ATOMIC_ACQ_REL);
+			if (predecessor != NULL)
+			{
+				if (threadLockStats != NULL)
+					waitStart = lockClock();
+				__atomic_store_n(&predecessor->next, node, __ATOMIC_RELEASE);
+				while (__atomic_load_n(&node->locked, __ATOMIC_ACQUIRE))
+					spinWait(&spins);
+			}
+			lock->mcs.holder = node;
+			break;
+		}
+
+		default:
+			if (pthread_mutex_trylock(&lock->mutex) == 0)
+				return;
+			if (threadLockStats != NULL)
+				waitStart = lockClock();
+			pthread_mutex_lock(&lock->mutex);
+			break;
+	}
+
+	if (waitStart != 0)
+	{
+		threadLockStats->waits++;
+		threadLockStats->waitTime += lockClock() - waitStart;
+	}
+}
+
+void simUnlock(SimLock* lock)
+{
+	unsigned int spins = 0;
+	switch (lockKind)
+	{
+		case LOCK_ADAPTIVE:
+			// wake up one parked waiter if there may be any
+			if (__atomic_exchange_n(&lock->state, 0, __ATOMIC_RELEASE) == 2)
+				futex(&lock->state, FUTEX_WAKE_PRIVATE, 1);
+			return;
+
+		case LOCK_TICKET:
+			__atomic_store_n(&lock->ticket.serving, lock->ticket.serving + 1, __ATOMIC_RELEASE);
+			return;
+
+		case LOCK_MCS:
+		{
+			McsNode* node = lock->mcs.holder;
+			McsNode* successor = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+			if (successor == NULL)
+			{
+				// no known successor: free the lock, unless one is enqueuing itself right now
+				McsNode* expected = node;
+				if (!__atomic_compare_exchange_n(&lock->mcs.tail, &expected, NULL, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+				{
+					while ((successor = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE)) == NULL)
+						spinWait(&spins);
+				}
+			}
+			if (successor != NULL)
+				__atomic_store_n(&successor->locked, 0, __ATOMIC_RELEASE);
+			mcsNodesInUse &= ~(1u << (unsigned int) (node - mcsNodes));
+			return;
+		}
+
+		default:
+			pthread_mutex_unlock(&lock->mutex);
+			return;
+	}
+}
+
+//------------------------------------------------------------------------
+//	Event counts
+//------------------------------------------------------------------------
+//
+
+/*
+ * Register as a waiter, and return the key to wait with.  The waiter must check its
+ * condition after this, so that either it sees the change, or the notifier sees it.
+ */
+unsigned int eventPrepareWait(EventCount* event)
+{
+	__atomic_add_fetch(&event->waiters, 1, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	return __atomic_load_n(&event->sequence, __ATOMIC_ACQUIRE);
+}
+
+void eventCancelWait(EventCount* event)
+{
+	__atomic_sub_fetch(&event->waiters, 1, __ATOMIC_RELAXED);
+}
+
+void eventWait(EventCount* event, unsigned int key, unsigned int timeout)
+{
+	struct timespec delay;
+	delay.tv_sec = timeout / 1000000;
+	delay.tv_nsec = (timeout % 1000000) * 1000L;
+	// returns right away if there was a notification since the key was taken
+	futexTimedWait(&event->sequence, key, &delay);
+	__atomic_sub_fetch(&event->waiters, 1, __ATOMIC_RELAXED);
+}
+
+void eventNotifyAll(EventCount* event)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&event->waiters, __ATOMIC_RELAXED) == 0)
+		return;
+	__atomic_add_fetch(&event->sequence, 1, __ATOMIC_RELEASE);
+	futex(&event->sequence, FUTEX_WAKE_PRIVATE, INT_MAX);
+}
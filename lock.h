@@ -0,0 +1,87 @@
+//
+//  lock.h
+//  GL threads
+//
+//  Small lock abstraction for the simulation's short critical sections (the ink
+//  tanks and their shards), with the implementation chosen at startup:
+//	- LOCK_PTHREAD: pthread mutex
+//	- LOCK_ADAPTIVE: spins briefly, then parks the thread on a futex
+//	- LOCK_TICKET: FIFO ticket lock, waiters spin on the ticket being served
+//	- LOCK_MCS: MCS queue lock, each waiter spins on its own queue node
+//  The spinning locks yield the CPU after spinning for a while, so that a run with
+//  more threads than cores doesn't livelock behind a preempted holder.
+//
+//  Nathan Larson 2017-05-02
+
+#ifndef LOCK_H
+#define LOCK_H
+
+#include <pthread.h>
+
+typedef enum LockKind {
+								LOCK_PTHREAD = 0,
+								LOCK_ADAPTIVE,
+								LOCK_TICKET,
+								LOCK_MCS,
+								//
+								NUM_LOCK_KINDS
+} LockKind;
+
+extern const char* const LOCK_NAMES[];
+// implementation used by all the locks (set before any lock is initialized)
+extern unsigned int lockKind;
+
+// Lock wait statistics of a thread: the number of times it found a lock taken, and the
+// total time it waited for it (in nanoseconds).  Uncontended acquisitions cost nothing.
+typedef struct LockStats {
+								unsigned long long waits;
+								unsigned long long waitTime;
+} LockStats;
+
+// statistics of the calling thread (NULL: not kept), only written by that thread
+extern __thread LockStats* threadLockStats;
+
+// queue node of an MCS lock waiter (taken from a small per-thread pool)
+typedef struct McsNode {
+								struct McsNode* next;
+								unsigned int locked;
+} __attribute__((aligned(64))) McsNode;
+
+typedef struct SimLock {
+								union {
+									pthread_mutex_t mutex;
+									// adaptive: 0 free, 1 held, 2 held with waiters (possibly) parked
+									unsigned int state;
+									struct {
+										unsigned int next;
+										unsigned int serving;
+									} ticket;
+									struct {
+										McsNode* tail;
+										// node of the current holder, for the unlock
+										McsNode* holder;
+									} mcs;
+								};
+} SimLock;
+
+void simLockInit(SimLock* lock);
+void simLock(SimLock* lock);
+void simUnlock(SimLock* lock);
+
+// Event count: lets threads sleep until a condition they can't express as a lock may
+// have changed (e.g. an ink tank got refilled).  A waiter calls eventPrepareWait, checks
+// its condition, then either eventCancelWait or eventWait with the key it got.  A thread
+// that changed the condition calls eventNotifyAll, which costs a fence and a load when
+// nobody is waiting.
+typedef struct EventCount {
+								unsigned int sequence;
+								unsigned int waiters;
+} EventCount;
+
+unsigned int eventPrepareWait(EventCount* event);
+void eventCancelWait(EventCount* event);
+// sleep until notified after the key was taken, or for at most timeout microseconds
+void eventWait(EventCount* event, unsigned int key, unsigned int timeout);
+void eventNotifyAll(EventCount* event);
+
+#endif // LOCK_H
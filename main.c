@@ -18,36 +18,108 @@
  |		- 'r' --> add red ink												|
  |		- 'g' --> add green ink												|
  |		- 'b' --> add blue ink												|
+ |		- ',' --> slow the ink producers down								|
+ |		- '.' --> speed the ink producers up								|
+ |		- 'p' --> pause/resume the travelers								|
+ |		- 'n' --> bring terminated travelers back							|
+ |		- 'c' --> write a checkpoint of the simulation						|
+ |		- 'h' --> switch between the ink and the heatmap					|
  +-------------------------------------------------------------------------*/
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <string.h>
+#include <errno.h>
 #include <unistd.h>
 #include <time.h>
 #include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
 
 #include "gl_frontEnd.h"
+#include "simulation.h"
+#include "regionEngine.h"
+#include "placement.h"
+#include "wheelEngine.h"
+#include "lock.h"
+#include "sharedState.h"
+#include "metrics.h"
+#include "lifecycle.h"
+#include "contention.h"
+#include "arena.h"
+#include "commandQueue.h"
+#include "history.h"
+#include "frameExport.h"
+
+// lines of the description of the selected square
+#define SELECTION_LINES		3
+#define SELECTION_LINE_SIZE	80
 
 //==================================================================================
 //	Function prototypes
 //==================================================================================
 void displayGridPane(void);
 void displayStatePane(void);
-void initializeApplication(void);
+unsigned int describeSquare(unsigned int row, unsigned int col, char lines[][SELECTION_LINE_SIZE]);
+
+// configuration functions, used to size the simulation at startup
+void parseCommandLine(int argc, char** argv);
+void loadConfigFile(const char* path);
 
 //==================================================================================
 //	Thread Function prototypes & locks
 //==================================================================================
 void* travelerThread(void*);
-void* producerThread(void*);
-
-// function prototype for the moveTraveler function, used to handle traveler movement and coloring
-void moveTraveler(TravelerInfo* info);
-
-// mutex locks for access to red ink tank, green ink tank, and blue ink tank
-pthread_mutex_t redInkLock;
-pthread_mutex_t greenInkLock;
-pthread_mutex_t blueInkLock;
+void* spawnedTravelerThread(void*);
+void* productionSchedulerThread(void*);
+
+// claim the next square of a move (moveTraveler is declared in simulation.h)
+int acquireNextSquare(TravelerInfo* info, unsigned int row, unsigned int col);
+unsigned int freeRunAhead(unsigned int row, unsigned int col, TravelDirection dir, unsigned int maxRun);
+
+// watchdog, which detects travelers that stop making progress
+void* watchdogThread(void*);
+
+// control thread, which applies the commands posted by the front end
+void* controlThread(void*);
+void applyCommands(const SimCommand* commands, unsigned int count);
+void spawnTravelers(unsigned int count);
+int acquireSpawnCounters(void);
+void releaseSpawnCounters(unsigned int k);
+void writeCheckpoint(void);
+
+void runHeadless(void);
+
+// locks for access to red ink tank, green ink tank, and blue ink tank
+SimLock redInkLock;
+SimLock greenInkLock;
+SimLock blueInkLock;
+
+// ink access functions, defined below
+int acquireRedInk(unsigned int theRed);
+int acquireGreenInk(unsigned int theGreen);
+int acquireBlueInk(unsigned int theBlue);
+int refillRedInk(unsigned int theRed);
+int refillGreenInk(unsigned int theGreen);
+int refillBlueInk(unsigned int theBlue);
+unsigned int takeSomeInk(TravelerType type, unsigned int amount);
+
+// optional sharded ink tanks
+void initializeInkShards(void);
+int acquireShardedInk(ProducerType type, unsigned int amount, int* isLow);
+unsigned int refillShardedInk(ProducerType type, unsigned int amount);
+void signalInkDemand(ProducerType type);
+void armProducer(ProducerInfo* producer, unsigned int firstDelay);
+void disarmProducer(ProducerInfo* producer);
+void retimeProducer(ProducerInfo* producer);
+void changeTargetLevel(int direction);
+void adjustProductionRates(const unsigned int* numProducers, double interval);
 
 
 //==================================================================================
@@ -59,34 +131,222 @@ pthread_mutex_t blueInkLock;
 extern const int GRID_PANE, STATE_PANE;
 extern int	gMainWindow, gSubwindow[2];
 
-// Array of locks to control access to each of the travelerInfo structs
-pthread_mutex_t* travelerLocks;
-
 //	The state grid and its dimensions
-int** grid;
-const unsigned int NUM_ROWS = 32, NUM_COLS = 30;
-
-// 2D array of locks to control access to each of the grid squares in the grid
-pthread_mutex_t** gridLocks;
+//	(defaults below, may be overridden from the command line or a config file)
+//	The grid's tiles, and the occupancy bits that make sure at most one traveler
+//	is on each square, are allocated the first time a traveler touches them.
+TiledGrid grid;
+unsigned int NUM_ROWS = 32, NUM_COLS = 30;
 
 // the max number of traveler threads to initialize
-const unsigned int MAX_NUM_TRAVELER_THREADS = 8;
+unsigned int MAX_NUM_TRAVELER_THREADS = 8;
 
-//the number of live threads (that haven't terminated yet)
+//the number of live threads (that haven't terminated yet), updated atomically
 unsigned int numLiveThreads = 0;
 
+// steady-state mode: a traveler that reaches a corner is respawned at a new random
+// position (reusing its TravelerInfo slot and thread), so the population stays constant
+unsigned int steadyState = 0;
+
+// lock-free free list (a Treiber stack) of TravelerInfo slots whose traveler has terminated.
+// The head packs a modification tag in the high 32 bits (to avoid ABA problems) and
+// the index + 1 of the top slot in the low 32 bits (0 means the list is empty).
+unsigned long long freeTravelerHead = 0;
+unsigned int* freeTravelerNext;
+
+// time (in microseconds) a traveler sleeps after each step, to make the display
+// easier to read.  0 runs the travelers unpaced.
+unsigned int travelerSleepTime = 100000;
+
+// How travelers choose their next move:
+//	- MOVE_RANDOM: a random perpendicular direction and a random length (the original random walk)
+//	- MOVE_AWARE: look at the occupancy bits of the squares ahead in both perpendicular
+//	  directions, prefer the direction with the longer free run, and a length within it
+typedef enum MovePolicy {
+								MOVE_RANDOM = 0,
+								MOVE_AWARE,
+								//
+								NUM_MOVE_POLICIES
+} MovePolicy;
+const char* const MOVE_POLICY_NAMES[] = {"random", "aware", NULL};
+unsigned int movePolicy = MOVE_RANDOM;
+
+// how many squares ahead the aware policy looks.  Consecutive squares of a tile row share
+// an occupancy word, and the words of consecutive tile rows are contiguous, so this stays
+// within a few cache lines in any direction.
+const unsigned int MOVE_LOOKAHEAD = 16;
+
+// A traveler never blocks on a square while holding another: it tries the next square's
+// lock, backs off (exponentially, up to 1 ms between tries) and, if the square is still
+// held after backoffLimit microseconds, abandons its move and picks another direction.
+// 0 means twice the step time (plus 1 ms).
+unsigned int backoffLimit = 0;
+
+// what the watchdog can see of each traveler slot
+TravelerWatch* travelerWatch;
+
+// the watchdog wakes up every watchdogPeriod milliseconds (0 disables it), and reports the
+// travelers that haven't moved for STALL_PERIODS periods, and the wait-for cycles among them
+unsigned int watchdogPeriod = 1000;
+const unsigned int STALL_PERIODS = 3;
+unsigned long long watchdogStalls = 0, watchdogCycles = 0;
+
+// How the travelers are run:
+//	- ENGINE_THREADS: one thread per traveler, synchronizing with the others on the grid squares
+//	- ENGINE_REGIONS: the grid is split into regions, each with a worker thread that moves all
+//	  the travelers inside it, and hands them over to its neighbors (see regionEngine.c)
+//	- ENGINE_WHEEL: the travelers' step deadlines are kept in a timing wheel, and a small pool
+//	  of threads steps the ones that are due at each tick (see wheelEngine.c)
+typedef enum SimulationEngine {
+								ENGINE_THREADS = 0,
+								ENGINE_REGIONS,
+								ENGINE_WHEEL,
+								//
+								NUM_ENGINES
+} SimulationEngine;
+const char* const ENGINE_NAMES[] = {"threads", "regions", "wheel", NULL};
+unsigned int engine = ENGINE_THREADS;
+
+// headless mode runs the simulation without the graphic front end, for runDuration
+// seconds (0 means until all travelers have terminated), then prints a summary
+unsigned int headless = 0;
+unsigned int runDuration = 0;
+
+// Per-thread counters, one entry per traveler thread (or per worker of the other engines)
+TravelerCounters* travelerCounters;
+unsigned int numCounterSlots;
+// the counters of the calling thread (NULL for threads that aren't travelers)
+__thread TravelerCounters* threadCounters = NULL;
+
+// The threads spawned while the simulation runs (threads engine) can't use the counters
+// of the slot they pop, as the thread that started on that slot may still be running
+// (in steady-state mode, on another slot).  They take one of numSpawnCounterSlots slots
+// of their own instead, after the MAX_NUM_TRAVELER_THREADS slots of the first threads,
+// and give it back when they end.
+#define SPAWN_COUNTER_SLOTS		256
+unsigned int numSpawnCounterSlots = 0;
+// spawn counter slots given back, and the number of slots ever handed out
+unsigned int freeSpawnCounters[SPAWN_COUNTER_SLOTS];
+unsigned int numFreeSpawnCounters = 0, numUsedSpawnCounters = 0;
+pthread_mutex_t spawnCounterLock = PTHREAD_MUTEX_INITIALIZER;
+// traveler slot each spawned thread starts on, by spawn counter slot
+unsigned int spawnedTraveler[SPAWN_COUNTER_SLOTS];
+
 //	the ink levels
-const unsigned int MAX_LEVEL = 50;
-const unsigned int MAX_ADD_INK = 10;
-const unsigned int TOTAL_INK_PRODUCER_THREADS = 6;		// MUST BE MULTIPLE OF 3 OR PROGRAM WILL NOT RUN
+unsigned int MAX_LEVEL = 50;
+unsigned int MAX_ADD_INK = 10;
+unsigned int TOTAL_INK_PRODUCER_THREADS = 6;		// distributed round-robin over the ink colors
 unsigned int redLevel = 20, greenLevel = 10, blueLevel = 40;
 
+// ink mode (see InkMode), and the number of squares' worth of ink taken at a time in stream mode
+const char* const INK_MODE_NAMES[] = {"reserve", "stream", NULL};
+unsigned int inkMode = INK_RESERVE;
+unsigned int inkChunk = 4;
+// per color: notified whenever ink is added to the tank, for the travelers waiting on it
+EventCount inkRefilled[NUM_PRODUCER_TYPES];
+// longest wait on inkRefilled before a traveler checks the tank again (in microseconds)
+#define INK_WAIT_TIMEOUT	100000
+
 //	ink producer sleep time (in microseconds)
 const unsigned int MIN_SLEEP_TIME = 1000;
 unsigned int producerSleepTime = 100000;
 
-// Array of TravelerInfo structs to store traveler thread information
-TravelerInfo *travelList;
+// the ink tanks, indexed by color, so that a single production scheduler can handle all colors
+unsigned int* const inkLevel[NUM_PRODUCER_TYPES] = {&redLevel, &greenLevel, &blueLevel};
+SimLock* const inkLock[NUM_PRODUCER_TYPES] = {&redInkLock, &greenInkLock, &blueInkLock};
+int (* const acquireInk[NUM_PRODUCER_TYPES])(unsigned int) = {acquireRedInk, acquireGreenInk, acquireBlueInk};
+int (* const refillInk[NUM_PRODUCER_TYPES])(unsigned int) = {refillRedInk, refillGreenInk, refillBlueInk};
+
+// A color's producers only run while its tank is being topped up.  Production starts
+// when the level falls below the low-water mark (a percentage of MAX_LEVEL) and stops
+// when the tank is full, so that nothing wakes up while the tanks are full.
+unsigned int lowWaterPercent = 100;
+unsigned int inkLowWater;
+
+// per color: 1 while production has been requested or is running.  Travelers only
+// signal the scheduler (through demandEventFd) when this goes from 0 to 1.
+unsigned int inkDemand[NUM_PRODUCER_TYPES];
+int demandEventFd;
+// set when producerSleepTime changes, so that the scheduler re-arms running timers
+unsigned int productionRateChanged = 0;
+
+// Producer rate control.  With inkTarget > 0, the production scheduler measures each
+// color's consumption (the ink it produced, minus the change in level) every
+// CONTROL_PERIOD, and sets the color's refill period to match it, plus what brings the
+// tank back to the target level within CONTROL_HORIZON.  Travelers refused ink while
+// the tank is below the target speed production up by half at least, so that they
+// don't starve, while a tank held below its capacity rarely overflows.  Otherwise all colors are refilled
+// every producerSleepTime, set with the ',' and '.' keys.
+unsigned int inkTarget = 0;				// percent of MAX_LEVEL (0: manual control)
+ProducerControl producerControl;
+#define CONTROL_PERIOD			100000		// in microseconds
+#define CONTROL_HORIZON			0.5			// in seconds
+#define MAX_CONTROL_SLEEP_TIME	10000000	// in microseconds
+// per color: ink added by the producers so far, the values of the previous control
+// period, and the smoothed consumption (all only used by the scheduler thread)
+unsigned long long inkProduced[NUM_PRODUCER_TYPES];
+unsigned long long controlProduced[NUM_PRODUCER_TYPES], controlRefused[NUM_PRODUCER_TYPES];
+unsigned int controlLevel[NUM_PRODUCER_TYPES];
+double inkConsumption[NUM_PRODUCER_TYPES];
+
+// Optional sharded ink tanks.  With inkShards > 1, each color's capacity is split over
+// that many shards, each with its own lock and cache line.  A traveler takes ink from
+// the shard of the core it runs on, and only goes to the other shards (stealing what it
+// is missing) when its own shard can't cover the request.  Producers refill the emptiest
+// shards first.  redLevel/greenLevel/blueLevel are not used then: the level of a color
+// is the sum of its shards, computed only when it is displayed.
+typedef struct InkShard {
+								SimLock lock;
+								unsigned int level;
+								unsigned int capacity;
+} __attribute__((aligned(64))) InkShard;
+
+#define MAX_INK_SHARDS	1024
+unsigned int numInkShards = 0;
+InkShard* inkShards[NUM_PRODUCER_TYPES];
+
+// production counters, only written by the scheduler thread
+unsigned long long producerWakeups = 0;
+unsigned long long inkRefills = 0;
+// ink of the refills that didn't fit in the tank, and of sharded ink given back to a
+// tank that had been refilled meanwhile (added to atomically)
+unsigned long long inkOverflow = 0;
+// waits of the scheduler thread for the ink tank locks
+LockStats producerLockStats;
+
+// Commands posted by the front end (see postCommand), applied in batches by the control
+// thread, which sleeps on commandPosted while the queue is empty
+#define COMMAND_QUEUE_SIZE	256
+#define COMMAND_BATCH		64
+CommandQueue commandQueue;
+EventCount commandPosted;
+// set while the travelers are paused: they wait on simResumed at their next step
+unsigned int simPaused = 0;
+EventCount simResumed;
+// number of checkpoints written so far (only used by the control thread)
+unsigned int numCheckpoints = 0;
+
+// time spent drawing the grid pane (in nanoseconds), written by the GLUT thread
+unsigned long long framesRendered = 0, renderTime = 0, lastFrameTime = 0;
+// frame of the history shown while scrubbing: its time, and the time its rebuild took
+// (in seconds, GLUT thread only)
+double scrubFrameTime = 0., scrubRebuildTime = 0.;
+
+// Shared state of all the travelers (see gl_frontEnd.h)
+TravelerStore travelerStore;
+
+// Private grid (without -shared): tile t is built in place at tileStorage[t], by the
+// first thread that touches it, and its state goes through the same values as a tile of
+// the shared segment (SHARED_TILE_EMPTY, then BUILDING, then READY)
+GridTile* tileStorage;
+unsigned int* tileState;
+
+// Size of the arena (see arena.h), reserved before anything is allocated: what the grid
+// needs, plus upper bounds on what each traveler slot and each engine thread take in all
+// the modules.  Only the pages that are used take memory.
+#define ARENA_BYTES_PER_TRAVELER	256
+#define ARENA_BYTES_PER_THREAD		1024
+#define ARENA_SLACK					(16UL << 20)
 
 // Array of producerInfo structs to store the producer thread information
 ProducerInfo *producerList;
@@ -99,15 +359,38 @@ void displayGridPane(void)
 	glMatrixMode(GL_MODELVIEW);
 	glLoadIdentity();
 
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
 	//---------------------------------------------------------
 	//	This is the call that makes OpenGL render the grid.
 	//
 	//	You *must* synchronize this call.
 	//---------------------------------------------------------
-	drawGridAndTravelers(grid, NUM_ROWS, NUM_COLS, travelList);
+	// while scrubbing through the history, the grid as it was then (without travelers)
+	TiledGrid* pastGrid = NULL;
+	float position;
+	if (historyBudget > 0 && scrubPosition(&position))
+	{
+		double duration;
+		unsigned int length = historyLength(&duration);
+		if (length > 0)
+			pastGrid = historyFrame((unsigned int) (position * (length - 1) + 0.5f), &scrubFrameTime, &scrubRebuildTime);
+	}
+	if (pastGrid != NULL)
+		drawGrid(pastGrid);
+	else
+		drawGridAndTravelers(&grid, &travelerStore);
 	
 	//	This is OpenGL/glut magic.
 	glutSwapBuffers();
+
+	// frame statistics, for the metrics
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	unsigned long long frameTime = (end.tv_sec - start.tv_sec) * 1000000000ULL + end.tv_nsec - start.tv_nsec;
+	__atomic_store_n(&lastFrameTime, frameTime, __ATOMIC_RELAXED);
+	__atomic_store_n(&renderTime, renderTime + frameTime, __ATOMIC_RELAXED);
+	__atomic_store_n(&framesRendered, framesRendered + 1, __ATOMIC_RELAXED);
 	
 	glutSetWindow(gMainWindow);
 }
@@ -126,7 +409,43 @@ void displayStatePane(void)
 	//
 	//	You *must* synchronize this call (probably inside the function)
 	//---------------------------------------------------------
-	drawState(numLiveThreads, redLevel, greenLevel, blueLevel, producerSleepTime);
+	drawState(numLiveThreads, inkTankLevel(RED_INK), inkTankLevel(GREEN_INK), inkTankLevel(BLUE_INK), producerSleepTime,
+			  &producerControl);
+
+	// lifecycle latency percentiles of each color
+	char latencyCells[LATENCY_TABLE_ROWS][LATENCY_TABLE_COLS][LATENCY_CELL_SIZE];
+	const char* latencyTable[LATENCY_TABLE_ROWS * LATENCY_TABLE_COLS];
+	formatLatencyTable(latencyCells);
+	for (unsigned int k=0; k<LATENCY_TABLE_ROWS * LATENCY_TABLE_COLS; k++)
+		latencyTable[k] = latencyCells[k / LATENCY_TABLE_COLS][k % LATENCY_TABLE_COLS];
+	drawStateTable(latencyTable, LATENCY_TABLE_ROWS, LATENCY_TABLE_COLS);
+
+	// the square clicked in the grid pane, and the traveler on it
+	unsigned int row, col;
+	if (selectedSquare(&row, &col))
+	{
+		char selectionLines[SELECTION_LINES][SELECTION_LINE_SIZE];
+		const char* selection[SELECTION_LINES];
+		unsigned int numLines = describeSquare(row, col, selectionLines);
+		for (unsigned int k=0; k<numLines; k++)
+			selection[k] = selectionLines[k];
+		drawSelectionInfo(selection, numLines);
+	}
+
+	// the history timeline, with the time of the frame shown if scrubbing
+	if (historyBudget > 0)
+	{
+		double duration;
+		historyLength(&duration);
+		float position;
+		int isScrubbing = scrubPosition(&position);
+		char label[32];
+		if (isScrubbing)
+			snprintf(label, sizeof(label), "%.1f s (%.1f ms)", scrubFrameTime, scrubRebuildTime * 1e3);
+		else
+			snprintf(label, sizeof(label), "live, %.0f s", duration);
+		drawTimeline(isScrubbing ? position : 1.f, !isScrubbing, label);
+	}
 		
 	//	This is OpenGL/glut magic.
 	glutSwapBuffers();
@@ -134,10 +453,42 @@ void displayStatePane(void)
 	glutSetWindow(gMainWindow);
 }
 
+/*
+ * Describe square (row, col) and the traveler standing on it, if any: its color and
+ * heading, its moves so far, and how its life has been spent.  Returns the number of
+ * lines written.
+ */
+unsigned int describeSquare(unsigned int row, unsigned int col, char lines[][SELECTION_LINE_SIZE])
+{
+	static const char* const COLOR_NAMES[NUM_TRAV_TYPES] = {"red", "green", "blue"};
+	static const char* const DIRECTION_NAMES[NUM_TRAVEL_DIRECTIONS] = {"north", "west", "south", "east"};
+
+	int index = squareOccupant(&grid, row, col);
+	if (index < 0)
+	{
+		snprintf(lines[0], SELECTION_LINE_SIZE, "Square (%u, %u): free", row, col);
+		return 1;
+	}
+	snprintf(lines[0], SELECTION_LINE_SIZE, "Square (%u, %u): traveler #%d", row, col, index);
+
+	unsigned char attributes = __atomic_load_n(&travelerStore.attributes[index], __ATOMIC_RELAXED);
+	snprintf(lines[1], SELECTION_LINE_SIZE, "%s, heading %s, %llu moves", COLOR_NAMES[TRAVELER_TYPE(attributes)],
+			 DIRECTION_NAMES[TRAVELER_DIR(attributes)], __atomic_load_n(&travelerWatch[index].progress, __ATOMIC_RELAXED));
+
+	TravelerLife* life = &travelerLife[index];
+	unsigned long long spawnTime = __atomic_load_n(&life->spawnTime, __ATOMIC_RELAXED);
+	unsigned long long now = lifecycleClock();
+	snprintf(lines[2], SELECTION_LINE_SIZE, "alive %.1f s: ink wait %.1f s, blocked %.1f s",
+			 now > spawnTime ? (now - spawnTime) * 1e-9 : 0., __atomic_load_n(&life->inkWaitTime, __ATOMIC_RELAXED) * 1e-9,
+			 __atomic_load_n(&life->blockedTime, __ATOMIC_RELAXED) * 1e-9);
+	return 3;
+}
+
 //------------------------------------------------------------------------
 //	These are the functions that would be called by a traveler thread in
 //	order to acquire red/green/blue ink to trace its trail.
 //	You *must* synchronized access to the ink levels
+//	(single tanks only: takeInk and topUpInk handle the sharded tanks)
 //------------------------------------------------------------------------
 //
 int acquireRedInk(unsigned int theRed)
@@ -223,402 +574,2200 @@ int refillBlueInk(unsigned int theBlue)
 }
 
 /*
- * Speed up production of ink
+ * Change the target level of the rate controller by a tenth of the capacity (at least 1)
+ */
+void changeTargetLevel(int direction)
+{
+	unsigned int step = (MAX_LEVEL >= 10) ? MAX_LEVEL / 10 : 1;
+	unsigned int target = __atomic_load_n(&producerControl.targetLevel, __ATOMIC_RELAXED);
+	if (direction > 0)
+		target = (target + step < MAX_LEVEL) ? target + step : MAX_LEVEL;
+	else
+		target = (target > step) ? target - step : 1;
+	__atomic_store_n(&producerControl.targetLevel, target, __ATOMIC_RELAXED);
+}
+
+/*
+ * Speed up production of ink (under rate control: raise the target level)
  */
 void speedupProducers(void)
 {
+	if (inkTarget > 0)
+	{
+		changeTargetLevel(1);
+		return;
+	}
+
 	//	decrease sleep time by 20%, but don't get too small
 	unsigned int newSleepTime = (8 * producerSleepTime) / 10;
 	
 	if (newSleepTime > MIN_SLEEP_TIME)
 	{
 		producerSleepTime = newSleepTime;
+		__atomic_store_n(&productionRateChanged, 1, __ATOMIC_RELEASE);
+		eventfd_write(demandEventFd, 1);
 	}
 }
 
 /*
- * Slow down production of ink
+ * Slow down production of ink (under rate control: lower the target level)
  */
 void slowdownProducers(void)
 {
+	if (inkTarget > 0)
+	{
+		changeTargetLevel(-1);
+		return;
+	}
+
 	//	increase sleep time by 20%
 	producerSleepTime = (12 * producerSleepTime) / 10;
+	__atomic_store_n(&productionRateChanged, 1, __ATOMIC_RELEASE);
+	eventfd_write(demandEventFd, 1);
 }
 
 /*
- * This function acts as the main function for each of the traveler threads that control 
- * how the traveler acts and calculates various values.
+ * Take ink for a traveler of the given type, under the tank's lock.  If that leaves the
+ * tank below its low-water mark (including when there wasn't enough ink), make sure the
+ * production scheduler knows about it.
  */
-void* travelerThread(void* arg)
+int takeInk(TravelerType type, unsigned int amount)
 {
-	TravelerInfo* info = (TravelerInfo *) arg;
+	int ok, isLow;
+	if (numInkShards > 1)
+	{
+		// no global lock: the shards are locked individually
+		ok = acquireShardedInk((ProducerType) type, amount, &isLow);
+	}
+	else
+	{
+		simLock(inkLock[type]);
+		ok = acquireInk[type](amount);
+		isLow = (*inkLevel[type] < inkLowWater);
+		simUnlock(inkLock[type]);
+	}
 
-	// when the traveler first spawns, acquire the current grid square lock
-	pthread_mutex_lock(&gridLocks[info->row][info->col]);
-	
-	// main while loop, run while the traveler is still alive
-	while(info->isLive)
+	if (isLow)
+		signalInkDemand((ProducerType) type);
+	if (threadCounters != NULL)
 	{
-		// get a random direction perpendicular to current direction
-		if(info->dir == NORTH || info->dir == SOUTH)	// if direction is north or south
-		{
-			int temp = rand() % 2;		// calculate random number out of 2
-			if(temp)
-				info->dir = EAST;		// if 1, face east
-			else
-				info->dir = WEST;		// else face west
-		}
-		else						// else if the direction is east or west
-		{
-			int temp = rand() % 2;		// calculate random number out of 2
-			if(temp)
-				info->dir = NORTH;		// if 1, face north
-			else
-				info->dir = SOUTH;		// else face south
-		}
+		if (ok)
+			threadCounters->inkAcquired[type]++;
+		else
+			threadCounters->inkRefused[type]++;
+	}
+	if (ok)
+		noteInkGranted();
+	else
+		noteInkShortage();
+	return ok;
+}
 
-		// calculate distance from available grid elements
-		int distance = 0;
-		if(info->dir == NORTH)	// if facing north
-		{
-			distance = rand() % (NUM_ROWS - info->row);	// calculate random distance within current row to max row
-			
-		}
-		else if(info->dir == SOUTH)		// else if facing south
-		{
-			distance = rand() % info->row;			// calculate random distance from 0 to current row
-		}
-		else if(info->dir == EAST)		// else if facing east
-		{
-			distance = rand() % (NUM_COLS - info->col);	// calculate random distance within current column to max column
-		}
-		else if(info->dir == WEST)		// else if facing west
-		{
-			distance = rand() % info->col;			// calculate random distance from 0 to current column
-		}
+/*
+ * Take up to amount ink, as much as the tank has.  Returns the amount taken.
+ */
+unsigned int takeSomeInk(TravelerType type, unsigned int amount)
+{
+	unsigned int taken;
+	int isLow;
+	if (numInkShards > 1)
+	{
+		// the whole amount if the shards have it, otherwise a single square's worth
+		if (acquireShardedInk((ProducerType) type, amount, &isLow))
+			taken = amount;
+		else
+			taken = acquireShardedInk((ProducerType) type, 1, &isLow);
+	}
+	else
+	{
+		simLock(inkLock[type]);
+		taken = (*inkLevel[type] < amount ? *inkLevel[type] : amount);
+		*inkLevel[type] -= taken;
+		isLow = (*inkLevel[type] < inkLowWater);
+		simUnlock(inkLock[type]);
+	}
 
-		// check if the resources are available
-		int hasResources = 0;
-		if(info->type == RED_TRAV)					// if type is red
-		{
-			pthread_mutex_lock(&redInkLock);			// acquire red ink lock
-			hasResources = acquireRedInk(distance);		// try to get enough ink to travel distance
-			pthread_mutex_unlock(&redInkLock);			// release red ink lock
-		}
-		else if(info->type == GREEN_TRAV)			// else if the type is green
-		{
-			pthread_mutex_lock(&greenInkLock);			// acquire green ink lock
-			hasResources = acquireGreenInk(distance);	// try to get enough ink to travel distance
-			pthread_mutex_unlock(&greenInkLock);		// release green ink lock
-		}
-		else if(info->type == BLUE_TRAV)			// else if the type is blue
-		{
-			pthread_mutex_lock(&blueInkLock);			// aquire blue ink lock
-			hasResources = acquireBlueInk(distance);	// try to get enough ink to travel distance
-			pthread_mutex_unlock(&blueInkLock);			// release blue ink lock
-		}
+	if (isLow)
+		signalInkDemand((ProducerType) type);
+	if (threadCounters != NULL)
+	{
+		if (taken > 0)
+			threadCounters->inkAcquired[type]++;
+		else
+			threadCounters->inkRefused[type]++;
+	}
+	if (taken > 0)
+		noteInkGranted();
+	else
+		noteInkShortage();
+	return taken;
+}
 
-		// if resources are available, loop through grid and travel distance, leaving trail of color
-		if(hasResources)
+/*
+ * Stream mode: make sure a traveler holds ink for its next square.  If *held is 0, take
+ * up to inkChunk squares' worth (no more than the remaining squares of the move) and add
+ * it to *held.  If the tank is empty, wait for the producers to refill it if wait is set
+ * (counting the wait); otherwise return 0, and the caller tries again later.
+ */
+int streamInk(TravelerType type, unsigned int* held, unsigned int remaining, int wait)
+{
+	if (*held > 0)
+		return 1;
+
+	unsigned int amount = (remaining < inkChunk ? remaining : inkChunk);
+	*held = takeSomeInk(type, amount);
+	if (*held > 0)
+		return 1;
+	if (!wait)
+		return 0;
+	if (threadCounters != NULL)
+		threadCounters->inkWaits++;
+
+	while (1)
+	{
+		// register as a waiter before looking at the tank again, so that a refill
+		// made after this look is sure to wake us up
+		unsigned int key = eventPrepareWait(&inkRefilled[type]);
+		*held = takeSomeInk(type, amount);
+		if (*held > 0)
 		{
-			for(int i = 0; i < distance; i++)	// for loop, looping for each square in the distance
-			{
-				moveTraveler(info);		// call function to move the traveler
-				
-				usleep(100000);			// sleep for some amount of time (to make display easier to read)
-
-				if(!info->isLive)	// if the traveler is not live (reached corner space)
-				{
-					break;		// then break from the main while loop
-				}
-			}
+			eventCancelWait(&inkRefilled[type]);
+			return 1;
 		}
+		eventWait(&inkRefilled[type], key, INK_WAIT_TIMEOUT);
 	}
-	numLiveThreads -= 1;	// after breaking from loop, decrement the number of live threads,
-	return NULL;			// since this thread will be terminating.
 }
 
 /*
- * This function is used by the traveler threads to execute the movement of the traveler by:
- * 		1.) alter the color of the current grid square based off of the traveler type
- *		2.) Based off the orientation, attempt to acquire the next grid square lock before releasing the current/previous
- *		3.) if the traveler is located at one of the corner squares, set isLive to false (0)
+ * Current level of an ink tank (the sum of its shards, if it is sharded)
  */
-void moveTraveler(TravelerInfo* info)
+unsigned int inkTankLevel(ProducerType type)
 {
-	// amount to increment color by, 64 seemed to be the best choice for visual pleasure
-	unsigned char newColor = 64;
+	if (numInkShards <= 1)
+		return __atomic_load_n(inkLevel[type], __ATOMIC_RELAXED);
 
-	unsigned int red = ((grid[info->row][info->col]) & 0xFF); 			 // Extract the RR byte
-    unsigned int green = ((grid[info->row][info->col] >> 8) & 0xFF);  	 // Extract the GG byte
-  	unsigned int blue = ((grid[info->row][info->col] >> 16) & 0xFF);     // Extract the BB byte
-  	
-	if(info->type == RED_TRAV)			// if the traveler type is red
-	{
-		red += newColor;				// increment the red color value
-		if(red > 255)					// if the new red value is greater than 255
-			red = 255;					// set the red value to 255 (max)
-	}
-	else if(info->type == GREEN_TRAV)	// if the traveler type is green
+	unsigned int level = 0;
+	for (unsigned int s=0; s<numInkShards; s++)
+		level += __atomic_load_n(&inkShards[type][s].level, __ATOMIC_RELAXED);
+	return level;
+}
+
+/*
+ * Add up to amount ink to a tank, without overfilling it, and set *added (unless added
+ * is NULL) to the amount that fit.  Returns 1 if the tank is full afterwards.
+ */
+int topUpInk(ProducerType type, unsigned int amount, unsigned int* added)
+{
+	unsigned int fit;
+	int isFull;
+	if (numInkShards > 1)
 	{
-		green += newColor;				// increment the green color value
-		if(green > 255)					// if the new green value is greater than 255
-			green = 255;				// set the green value to 255 (max)
+		fit = refillShardedInk(type, amount);
+		isFull = (inkTankLevel(type) >= MAX_LEVEL);
 	}
-	else if(info->type == BLUE_TRAV)	// else if the traveler type is blue
+	else
 	{
-		blue += newColor;				// increment the blue color value
-		if(blue > 255)					// if the new blue value is greater than 255
-			blue = 255;					// set the blue value to 255 (max)
+		simLock(inkLock[type]);
+		unsigned int room = (*inkLevel[type] >= MAX_LEVEL ? 0 : MAX_LEVEL - *inkLevel[type]);
+		fit = (room < amount ? room : amount);
+		if (fit > 0)
+			refillInk[type](fit);
+		isFull = (*inkLevel[type] >= MAX_LEVEL);
+		simUnlock(inkLock[type]);
 	}
+	eventNotifyAll(&inkRefilled[type]);
+	if (added != NULL)
+		*added = fit;
+	return isFull;
+}
 
-	// take the new calculated values and set them to the current grid value
-	grid[info->row][info->col] = 0xFF000000 | (blue << 16) | (green << 8) | red;
-	
+//------------------------------------------------------------------------
+//	Sharded ink tanks
+//------------------------------------------------------------------------
+//
 
-	if(info->dir == NORTH)			// if the current orientation is north
+/*
+ * Split each tank's capacity and current level over its shards
+ */
+void initializeInkShards(void)
+{
+	for (unsigned int c=0; c<NUM_PRODUCER_TYPES; c++)
 	{
-		pthread_mutex_lock(&gridLocks[info->row + 1][info->col]);	// try to acquire the next grid square lock
-		pthread_mutex_unlock(&gridLocks[info->row][info->col]);		// release the current/previous grid square lock
-		pthread_mutex_lock(&travelerLocks[info->index]);		// try to acquire the traveler info lock for the corresponding traveler
-		info->row += 1;												// increment row by 1
-		pthread_mutex_unlock(&travelerLocks[info->index]);			// release the traveler info lock
+		inkShards[c] = (InkShard*) arenaAlloc(numInkShards, sizeof(InkShard), "ink shards");
+		for (unsigned int s=0; s<numInkShards; s++)
+		{
+			simLockInit(&inkShards[c][s].lock);
+			inkShards[c][s].capacity = MAX_LEVEL / numInkShards + (s < MAX_LEVEL % numInkShards ? 1 : 0);
+			inkShards[c][s].level = *inkLevel[c] / numInkShards + (s < *inkLevel[c] % numInkShards ? 1 : 0);
+		}
 	}
-	else if(info->dir == SOUTH)		// if the current orientation is south
+}
+
+/*
+ * Put back up to amount ink in a shard, without overfilling it.  Returns what didn't fit.
+ */
+unsigned int giveBackShardInk(InkShard* shard, unsigned int amount)
+{
+	if (amount == 0)
+		return 0;
+	simLock(&shard->lock);
+	unsigned int room = (shard->level >= shard->capacity ? 0 : shard->capacity - shard->level);
+	unsigned int fit = (room < amount ? room : amount);
+	shard->level += fit;
+	simUnlock(&shard->lock);
+	return amount - fit;
+}
+
+/*
+ * Take amount ink of one color, all or nothing.  The local shard (that of the current core)
+ * is tried first.  If it can't cover the request, the rest is stolen from the other shards;
+ * if they can't cover it either, what was gathered is put back where it came from.
+ * *isLow is set if the local shard is below its share of the low-water mark.
+ */
+int acquireShardedInk(ProducerType type, unsigned int amount, int* isLow)
+{
+	int cpu = sched_getcpu();
+	unsigned int local = (cpu < 0 ? 0 : (unsigned int) cpu) % numInkShards;
+	InkShard* shards = inkShards[type];
+
+	// fast path: the local shard has enough ink
+	simLock(&shards[local].lock);
+	unsigned int taken = (shards[local].level < amount ? shards[local].level : amount);
+	shards[local].level -= taken;
+	*isLow = ((unsigned long long) shards[local].level * 100 < (unsigned long long) shards[local].capacity * lowWaterPercent);
+	simUnlock(&shards[local].lock);
+	if (taken == amount)
+		return 1;
+
+	// rebalancing path: steal the rest from the other shards, one lock at a time
+	*isLow = 1;
+	unsigned int stolen[MAX_INK_SHARDS];
+	unsigned int gathered = taken;
+	unsigned int s = local;
+	for (unsigned int k=1; k<numInkShards && gathered < amount; k++)
 	{
-		pthread_mutex_lock(&gridLocks[info->row - 1][info->col]);	// try to acquire the next grid square lock
-		pthread_mutex_unlock(&gridLocks[info->row][info->col]);		// release the current/previous grid square lock
-		pthread_mutex_lock(&travelerLocks[info->index]);		// try to acquire the traveler info lock for the corresponding traveler
-		info->row -= 1;												// increment row by 1
-		pthread_mutex_unlock(&travelerLocks[info->index]);			// release the traveler info lock
+		s = (local + k) % numInkShards;
+		simLock(&shards[s].lock);
+		unsigned int need = amount - gathered;
+		stolen[s] = (shards[s].level < need ? shards[s].level : need);
+		shards[s].level -= stolen[s];
+		simUnlock(&shards[s].lock);
+		gathered += stolen[s];
 	}
-	else if(info->dir == EAST)		// if the current orientation is east
+	if (gathered == amount)
 	{
-		pthread_mutex_lock(&gridLocks[info->row][info->col + 1]);	// try to acquire the next grid square lock
-		pthread_mutex_unlock(&gridLocks[info->row][info->col]);		// release the current/previous grid square lock
-		pthread_mutex_lock(&travelerLocks[info->index]);		// try to acquire the traveler info lock for the corresponding traveler
-		info->col += 1;												// increment row by 1
-		pthread_mutex_unlock(&travelerLocks[info->index]);			// release the traveler info lock
+		if (threadCounters != NULL)
+			threadCounters->inkSteals++;
+		return 1;
 	}
-	else if(info->dir == WEST)		// if the current orientation is west
+
+	// not enough ink in the whole tank: give everything back.  Producers may have refilled
+	// the shards meanwhile, so what no longer fits goes to the shards with room, and what
+	// fits nowhere is counted as overflow.
+	unsigned int surplus = giveBackShardInk(&shards[local], taken);
+	for (unsigned int k=1; k<numInkShards; k++)
 	{
-		pthread_mutex_lock(&gridLocks[info->row][info->col - 1]);	// try to acquire the next grid square lock
-		pthread_mutex_unlock(&gridLocks[info->row][info->col]);		// release the current/previous grid square lock
-		pthread_mutex_lock(&travelerLocks[info->index]);		// try to acquire the traveler info lock for the corresponding traveler
-		info->col -= 1;												// increment row by 1
-		pthread_mutex_unlock(&travelerLocks[info->index]);			// release the traveler info lock
+		s = (local + k) % numInkShards;
+		surplus += giveBackShardInk(&shards[s], stolen[s]);
 	}
-
-	// if statement to check if the traveler is in one of the corner squares of the grid
-	if(((info->row == 0) && ((info->col == 0) || (info->col == (NUM_COLS-1)))) ||
-		((info->row == (NUM_ROWS-1) && ((info->col == 0) || (info->col == (NUM_COLS-1))))))
+	if (surplus > 0)
 	{
-		info->isLive = 0;		// if it is, then set isLive value to 0 (false)
+		surplus -= refillShardedInk(type, surplus);
+		__atomic_add_fetch(&inkOverflow, surplus, __ATOMIC_RELAXED);
 	}
+	return 0;
 }
 
 /*
- * This function acts as the main function for each of the producer threads, handling the lock acquiring, releasing,
- * and refilling of the ink tanks between sleep cycles.
+ * Add up to amount ink of one color, filling the emptiest shards first.  Returns the
+ * amount actually added (less than requested if the tank got full).
  */
-void* producerThread(void* arg)
+unsigned int refillShardedInk(ProducerType type, unsigned int amount)
 {
-	ProducerInfo* info = (ProducerInfo *) arg;
+	InkShard* shards = inkShards[type];
+	unsigned int added = 0;
 
-	// main while loop, no break since it will keep filling as long as the program is running
-	while(1)
+	for (unsigned int pass=0; pass<numInkShards && added < amount; pass++)
 	{
-		if(info->type == RED_INK)			// if the ink type is red
-		{
-			pthread_mutex_lock(&redInkLock);	// acquire the red ink lock
-			refillRedInk(MAX_ADD_INK);			// attempt to fill MAX_ADD_INK into the ink tank
-			pthread_mutex_unlock(&redInkLock);	// release the red ink lock
-		}
-		else if(info->type == GREEN_INK)	// if the ink type is green
-		{
-			pthread_mutex_lock(&greenInkLock);	// acquire the green ink lock
-			refillGreenInk(MAX_ADD_INK);		// attempt to fill MAX_ADD_INK into the ink tank
-			pthread_mutex_unlock(&greenInkLock);// release the green ink lock
-		}
-		else if(info->type == BLUE_INK)
+		// find the shard with the most room (levels are read without locking, this is only a hint)
+		unsigned int best = 0, bestRoom = 0;
+		for (unsigned int s=0; s<numInkShards; s++)
 		{
-			pthread_mutex_lock(&blueInkLock);	// acquire the blue ink lock
-			refillBlueInk(MAX_ADD_INK);			// attempt to fill MAX_ADD_INK into the ink tank
-			pthread_mutex_unlock(&blueInkLock);	// release the blue ink lock
+			unsigned int level = __atomic_load_n(&shards[s].level, __ATOMIC_RELAXED);
+			unsigned int room = (level >= shards[s].capacity ? 0 : shards[s].capacity - level);
+			if (room > bestRoom)
+			{
+				best = s;
+				bestRoom = room;
+			}
 		}
-		usleep(producerSleepTime);	// sleep for the given value of producerSleepTime, altered by user input
+		if (bestRoom == 0)
+			break;
+
+		simLock(&shards[best].lock);
+		unsigned int room = (shards[best].level >= shards[best].capacity ? 0 : shards[best].capacity - shards[best].level);
+		unsigned int add = (room < amount - added ? room : amount - added);
+		shards[best].level += add;
+		simUnlock(&shards[best].lock);
+		added += add;
+	}
+	return added;
+}
+
+/*
+ * Request production of an ink color.  Only the first request after production stopped
+ * wakes up the scheduler, so this costs a single atomic exchange in the common case.
+ */
+void signalInkDemand(ProducerType type)
+{
+	if (__atomic_load_n(&inkDemand[type], __ATOMIC_RELAXED) == 0 &&
+		__atomic_exchange_n(&inkDemand[type], 1, __ATOMIC_ACQ_REL) == 0)
+	{
+		eventfd_write(demandEventFd, 1);
 	}
-	return NULL;
 }
 
+//------------------------------------------------------------------------
+//	Grid tiles.  A tile is created by the first thread that touches one of
+//	its squares, in its place in the arena (or in the shared segment).
+//	Threads that race to create the same tile wait for the first one to
+//	finish building it.
+//------------------------------------------------------------------------
+//
 
 /*
- * Main function
+ * Return the tile that holds square (row, col), allocating it if needed
  */
-int main(int argc, char** argv)
+GridTile* touchTile(unsigned int row, unsigned int col)
 {
-	// if statement to check and make sure that the number of ink producing threads is a multiple of 3.
-	// this check is performed since for my implementation, the number of threads per color is equal across all colors.
-	// ie. TOTAL_INK_PRODUCER_THREADS = 9 would result in 3 producer threads per color
-	if(TOTAL_INK_PRODUCER_THREADS%3 != 0)
+	GridTile** slot = &grid.tiles[(size_t) (row >> GRID_TILE_SHIFT) * grid.numTileCols + (col >> GRID_TILE_SHIFT)];
+	GridTile* tile = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+	if (tile != NULL)
+		return tile;
+	size_t t = (size_t) (slot - grid.tiles);
+	if (sharedInstance > 0)
+		return touchSharedTile(t);
+
+	// build a black tile with no traveler on it (the rest of the tile already reads as
+	// zeros), or wait for the thread building it
+	tile = &tileStorage[t];
+	unsigned int state = SHARED_TILE_EMPTY;
+	if (__atomic_compare_exchange_n(&tileState[t], &state, SHARED_TILE_BUILDING, 0, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
 	{
-		printf("Total Ink count must be multiple of 3!");
-		exit(0);
+		for (unsigned int k=0; k<GRID_TILE_SIZE*GRID_TILE_SIZE; k++)
+			tile->color[k] = 0xFF000000;
+		__atomic_store_n(&tileState[t], SHARED_TILE_READY, __ATOMIC_RELEASE);
+	}
+	else
+	{
+		while (__atomic_load_n(&tileState[t], __ATOMIC_ACQUIRE) != SHARED_TILE_READY)
+			sched_yield();
 	}
 
-	initializeFrontEnd(argc, argv, displayGridPane, displayStatePane);
-	
-	//	Now we can do application-level
-	initializeApplication();
+	// publish it
+	__atomic_store_n(slot, tile, __ATOMIC_RELEASE);
+	return tile;
+}
 
-	// declare mutex lock for the ink resources
-	pthread_mutex_init(&redInkLock, NULL);
-	pthread_mutex_init(&greenInkLock, NULL);
-	pthread_mutex_init(&blueInkLock, NULL);
+/*
+ * Try to claim square (row, col) for traveler index: atomically set its occupancy bit,
+ * then record the traveler as the square's occupant (see squareOccupant()).
+ * Returns 1 if the square was free (and is now ours), 0 if another traveler holds it.
+ */
+int claimSquare(unsigned int row, unsigned int col, unsigned int index)
+{
+	GridTile* tile = touchTile(row, col);
+	unsigned long long bit = 1ULL << (col & GRID_TILE_MASK);
+	if (__atomic_fetch_or(&tile->occupied[row & GRID_TILE_MASK], bit, __ATOMIC_ACQUIRE) & bit)
+		return 0;
+	__atomic_store_n(&tile->occupant[((row & GRID_TILE_MASK) << GRID_TILE_SHIFT) | (col & GRID_TILE_MASK)], index + 1, __ATOMIC_RELAXED);
+	return 1;
+}
 
-	// declare errCode value to store the return value of pthread_create
-	int errCode;
+/*
+ * Check, without claiming it, whether square (row, col) is free.  Doesn't allocate the
+ * tile: a tile that was never touched has no traveler on it.
+ */
+int isSquareFree(unsigned int row, unsigned int col)
+{
+	GridTile* tile = __atomic_load_n(&grid.tiles[(size_t) (row >> GRID_TILE_SHIFT) * grid.numTileCols + (col >> GRID_TILE_SHIFT)],
+									 __ATOMIC_ACQUIRE);
+	if (tile == NULL)
+		return 1;
+	unsigned long long bits = __atomic_load_n(&tile->occupied[row & GRID_TILE_MASK], __ATOMIC_RELAXED);
+	return ((bits >> (col & GRID_TILE_MASK)) & 1) == 0;
+}
 
-	// for loop to run through the max number of traveler threads and create a thread for each one
-	for(int i = 0; i < MAX_NUM_TRAVELER_THREADS; i++)
+/*
+ * Release a square claimed with claimSquare()
+ */
+void releaseSquare(unsigned int row, unsigned int col)
+{
+	GridTile* tile = touchTile(row, col);
+	unsigned long long bit = 1ULL << (col & GRID_TILE_MASK);
+	__atomic_store_n(&tile->occupant[((row & GRID_TILE_MASK) << GRID_TILE_SHIFT) | (col & GRID_TILE_MASK)], 0, __ATOMIC_RELAXED);
+	__atomic_fetch_and(&tile->occupied[row & GRID_TILE_MASK], ~bit, __ATOMIC_RELEASE);
+}
+
+/*
+ * Add amount to the traveler type's color channel of square (row, col), saturating at
+ * 255, and mark its tile as changed for the history.  The update is a compare-and-swap
+ * loop, so deposits never need a lock (the renderer and other readers always see a
+ * whole color).
+ */
+void depositInk(unsigned int row, unsigned int col, TravelerType type, unsigned int amount)
+{
+	GridTile* tile = touchTile(row, col);
+	int* square = &tile->color[((row & GRID_TILE_MASK) << GRID_TILE_SHIFT) | (col & GRID_TILE_MASK)];
+	// channel of the traveler type: red is the low byte, then green, then blue
+	unsigned int shift = 8 * (unsigned int) type;
+	int oldColor = __atomic_load_n(square, __ATOMIC_RELAXED);
+	int newColor;
+	do
 	{
-		// create a pthread, sending the travelerThread function to run and corresponding travelList struct reference
-		errCode = pthread_create(&travelList[i].threadID, NULL, travelerThread, &travelList[i]);
+		unsigned int channel = ((unsigned int) oldColor >> shift) & 0xFF;
+		channel += amount;
+		if(channel > 255)				// if the new value is greater than 255
+			channel = 255;				// set the value to 255 (max)
+		newColor = (int) (((unsigned int) oldColor & ~(0xFFU << shift)) | (channel << shift) | 0xFF000000);
+	} while (!__atomic_compare_exchange_n(square, &oldColor, newColor, 1, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+
+	// the mark goes after the color, and is only written if the history cleared it
+	if (__atomic_load_n(&tile->changed, __ATOMIC_SEQ_CST) == 0)
+		__atomic_store_n(&tile->changed, 1, __ATOMIC_RELAXED);
+}
 
-		// increment the number of live threads
-		numLiveThreads++;
+//------------------------------------------------------------------------
+//	Traveler slot recycling.  A terminated traveler's slot is pushed on a
+//	lock-free free list; in steady-state mode the same thread pops a slot
+//	right back and respawns a new traveler in it, so that no thread is
+//	ever created after startup.
+//------------------------------------------------------------------------
+//
 
-		// if the errCode is nonzero, then the pthread was not created. print error and exit
-		if(errCode != 0)
-		{
-			printf ("could not pthread_create thread %d. %d\n",
-					 i, errCode);
-			exit(0);
-		}
-	}
+/*
+ * Push the slot of a terminated traveler on the free list
+ */
+void pushFreeTraveler(unsigned int index)
+{
+	unsigned long long head = __atomic_load_n(&freeTravelerHead, __ATOMIC_ACQUIRE);
+	unsigned long long newHead;
+	do
+	{
+		freeTravelerNext[index] = (unsigned int) head;
+		newHead = (((head >> 32) + 1) << 32) | (index + 1);
+	} while (!__atomic_compare_exchange_n(&freeTravelerHead, &head, newHead, 1, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+}
 
-	// foor loop to run through the total number of ink producer threads and create thread for each one
-	for(int i = 0; i < TOTAL_INK_PRODUCER_THREADS; i++)
+/*
+ * Pop a free traveler slot.  Returns its index, or -1 if the list is empty
+ */
+int popFreeTraveler(void)
+{
+	unsigned long long head = __atomic_load_n(&freeTravelerHead, __ATOMIC_ACQUIRE);
+	unsigned long long newHead;
+	do
+	{
+		if ((unsigned int) head == 0)
+			return -1;
+		// the next link may be stale if another thread popped this slot in the meantime,
+		// but then the tag has changed and the compare-and-swap fails
+		unsigned int next = freeTravelerNext[(unsigned int) head - 1];
+		newHead = (((head >> 32) + 1) << 32) | next;
+	} while (!__atomic_compare_exchange_n(&freeTravelerHead, &head, newHead, 1, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+	return (int) ((unsigned int) head - 1);
+}
+
+/*
+ * Claim the traveler's starting square.  If another traveler holds it, pick another
+ * random square instead of waiting for it.  The traveler's life starts here.
+ */
+void claimStartSquare(TravelerInfo* info)
+{
+	while (!claimSquare(info->row, info->col, info->index))
 	{
-		// create a pthread, sending producerThread function to run and corresponding producerList struct reference
-		errCode = pthread_create(&producerList[i].threadID, NULL, producerThread, &producerList[i]);
+		info->row = (rand() % (NUM_ROWS-1)) + 1;
+		info->col = (rand() % (NUM_COLS-1)) + 1;
+	}
+	publishTraveler(info);
+	beginTravelerLife(info->index);
+}
 
-		// I choose to not increment the number of live threads in order to use that variable to represent the number of live travelers
-		//numLiveThreads++;
+/*
+ * Reinitialize a traveler slot with a new random color, position and direction, and
+ * claim its starting square.
+ */
+void respawnTraveler(TravelerInfo* info)
+{
+	info->type = rand() % NUM_TRAV_TYPES;
+	info->row = (rand() % (NUM_ROWS-1)) + 1;
+	info->col = (rand() % (NUM_COLS-1)) + 1;
+	info->dir = rand() % NUM_TRAVEL_DIRECTIONS;
+
+	claimStartSquare(info);
+	info->isLive = 1;
+	publishTravelerLive(info->index, 1);
+}
 
-		// if the errCode is nonzero, then the pthread was not created. print error and exit
-		if(errCode != 0)
+/*
+ * Make counters the calling thread's counters, including for its lock waits
+ */
+void bindThreadCounters(TravelerCounters* counters)
+{
+	threadCounters = counters;
+	threadLockStats = &counters->lockStats;
+}
+
+/*
+ * Add up the counters of all the engine threads (each one is read atomically, but
+ * the threads keep counting meanwhile)
+ */
+void sumTravelerCounters(TravelerCounters* total)
+{
+	memset(total, 0, sizeof(TravelerCounters));
+	for (unsigned int k=0; k<numCounterSlots; k++)
+	{
+		TravelerCounters* counters = &travelerCounters[k];
+		total->moves += __atomic_load_n(&counters->moves, __ATOMIC_RELAXED);
+		total->respawns += __atomic_load_n(&counters->respawns, __ATOMIC_RELAXED);
+		total->inkSteals += __atomic_load_n(&counters->inkSteals, __ATOMIC_RELAXED);
+		total->inkWaits += __atomic_load_n(&counters->inkWaits, __ATOMIC_RELAXED);
+		total->backoffs += __atomic_load_n(&counters->backoffs, __ATOMIC_RELAXED);
+		total->reroutes += __atomic_load_n(&counters->reroutes, __ATOMIC_RELAXED);
+		total->headOns += __atomic_load_n(&counters->headOns, __ATOMIC_RELAXED);
+		total->blockedTime += __atomic_load_n(&counters->blockedTime, __ATOMIC_RELAXED);
+		for (unsigned int c=0; c<NUM_TRAV_TYPES; c++)
 		{
-			printf ("could not pthread_create thread %d. %d\n",
-					 i, errCode);
-			exit(0);
+			total->inkAcquired[c] += __atomic_load_n(&counters->inkAcquired[c], __ATOMIC_RELAXED);
+			total->inkRefused[c] += __atomic_load_n(&counters->inkRefused[c], __ATOMIC_RELAXED);
 		}
+		total->lockStats.waits += __atomic_load_n(&counters->lockStats.waits, __ATOMIC_RELAXED);
+		total->lockStats.waitTime += __atomic_load_n(&counters->lockStats.waitTime, __ATOMIC_RELAXED);
 	}
-
-	//	Now we enter the main loop of the program and to a large extend
-	//	"lose control" over its execution.  The callback functions that 
-	//	we set up earlier will be called when the corresponding event
-	//	occurs
-	glutMainLoop();
-	
-	//	Free allocated resource before leaving (not absolutely needed, but
-	//	just nicer.  Also, if you crash there, you know something is wrong
-	//	in your code.
-	for (unsigned int i=0; i< NUM_ROWS; i++)
-		free(grid[i]);
-	free(grid);
-
-	// free 2D array of gridlocks
-	for (unsigned int i=0; i<NUM_ROWS; i++)
-		free(gridLocks[i]);
-	free(gridLocks);
-	
-	// free the travelerInfo array, producerInfo array, and array of traveler locks
-	free(travelList);
-	free(producerList);
-	free(travelerLocks);
-	
-	//	This will never be executed (the exit point will be in one of the
-	//	call back functions).
-	return 0;
 }
 
-
 /*
- * Function to initialize the program,
- *		-Allocating required memory
- *		-Seeding "random" number generator
- *		-Initializing mutex locks
+ * Run the traveler of slot index (and, in steady-state mode, those that follow it) on
+ * the calling thread, until it terminates.  counters are the thread's own.
  */
-void initializeApplication(void)
+static void runTraveler(unsigned int index, TravelerCounters* counters)
 {
-	//	Allocate the grid
-	grid = (int**) malloc(NUM_ROWS * sizeof(int*));
-	for (unsigned int i=0; i<NUM_ROWS; i++)
-		grid[i] = (int*) malloc(NUM_COLS * sizeof(int));
+	// the thread works on its own copy of the traveler, and publishes it to the store
+	TravelerInfo traveler;
+	TravelerInfo* info = &traveler;
+	loadTraveler(index, info);
 
-	// Allocate the grid locks
-	gridLocks = (pthread_mutex_t**) malloc(NUM_ROWS * sizeof(pthread_mutex_t*));
-	for (unsigned int i=0; i<NUM_ROWS; i++)
-		gridLocks[i] = (pthread_mutex_t*) malloc(NUM_COLS * sizeof(pthread_mutex_t));
+	// this thread's counters stay the same even if it moves on to another traveler slot
+	bindThreadCounters(counters);
 
-	// Allocate the traveler info locks
-	travelerLocks = (pthread_mutex_t*) malloc(MAX_NUM_TRAVELER_THREADS * sizeof(pthread_mutex_t));
+	// pin the thread before it touches the grid, so that the tiles it allocates land on its node
+	pinCurrentThread(placementPolicy == PLACE_REGION ? placementCpuForRow(info->row) : placementCpuForThread(info->index));
 
+	// when the traveler first spawns, claim the current grid square
+	claimStartSquare(info);
 	
-	//	seed the pseudo-random generator
-	srand((unsigned int) time(NULL));
-	
-	//	create RGB values (and alpha  = 255) for each pixel
-	//	A color is stored on 4 bytes ARGB.  However, because Intel (and compatible)
-	//	CPUs are small-endian, the order of bytes for int, float, double, etc. is
-	//	inverted.  So if we look at the int (4 bytes) storing 
-	for (unsigned int i=0; i<NUM_ROWS; i++)
+	// main while loop, run while the traveler is still alive
+	while(1)
 	{
-		for (unsigned int j=0; j<NUM_COLS; j++)
+		// a traveler that reached a corner gives its square and slot back.  In steady-state
+		// mode, this thread carries on with a new traveler in a recycled slot
+		if(!info->isLive)
 		{
-			grid[i][j] = 0xFF000000;
+			endTravelerLife(info->index, info->type);
+			releaseSquare(info->row, info->col);
+			publishTravelerLive(info->index, 0);
+			__atomic_sub_fetch(&numLiveThreads, 1, __ATOMIC_RELAXED);
+			pushFreeTraveler(info->index);
+
+			int slot;
+			if(!steadyState || (slot = popFreeTraveler()) < 0)
+				break;
+
+			info->index = (unsigned int) slot;
+			respawnTraveler(info);
+			__atomic_add_fetch(&numLiveThreads, 1, __ATOMIC_RELAXED);
+			counters->respawns++;
 		}
-	}
+		currentLife = &travelerLife[info->index];
+		flushStaleContention();
+		waitWhilePaused();
 
-	// initialize the grid locks
-	for(unsigned int i=0; i<NUM_ROWS; i++)
-	{
-		for(unsigned int j=0; j<NUM_COLS; j++)
+		// pick a direction perpendicular to the current one, and a distance
+		int distance = chooseMove(info);
+
+		// ink taken but not used yet
+		unsigned int held = 0;
+		if(inkMode == INK_RESERVE)
 		{
-			pthread_mutex_init(&gridLocks[i][j], NULL);
+			// check if the resources are available
+			if(!takeInk(info->type, distance))	// try to get enough ink to travel distance
+				continue;
+			held = distance;
 		}
-	}
 
-	// initialize the traveler info locks
-	for(unsigned int i=0; i<MAX_NUM_TRAVELER_THREADS; i++)
-	{
-		pthread_mutex_init(&travelerLocks[i], NULL);
-	}
+		// loop through grid and travel distance, leaving trail of color
+		for(int i = 0; i < distance; i++)	// for loop, looping for each square in the distance
+		{
+			// in stream mode, take the ink a few squares at a time (waiting if the tank is empty)
+			if(inkMode == INK_STREAM)
+				streamInk(info->type, &held, distance - i, 1);
+			waitWhilePaused();
 
-	
-	// Allocate space for the array of travelerInfo structs
-	travelList = (TravelerInfo*) malloc(MAX_NUM_TRAVELER_THREADS * sizeof(TravelerInfo));
+			if(!moveTraveler(info))		// call function to move the traveler
+			{
+				// blocked: pick another move
+				counters->reroutes++;
+				break;
+			}
+			held--;
+			counters->moves++;
+			__atomic_store_n(&travelerWatch[info->index].progress, travelerWatch[info->index].progress + 1, __ATOMIC_RELAXED);
+			
+			if(travelerSleepTime > 0)
+				usleep(travelerSleepTime);	// sleep for some amount of time (to make display easier to read)
 
-	// Loop through each of the travelerInfo structs in the list and initialize the values
-	for (unsigned int k=0; k< MAX_NUM_TRAVELER_THREADS; k++)
-	{
-		travelList[k].type = rand() % NUM_TRAV_TYPES;
-		travelList[k].row = (rand() % (NUM_ROWS-1)) + 1;
-		travelList[k].col = (rand() % (NUM_COLS-1)) + 1;
-		travelList[k].dir = rand() % NUM_TRAVEL_DIRECTIONS;
-		travelList[k].isLive = (unsigned  char) 1;
-		travelList[k].index = k;
+			if(!info->isLive)	// if the traveler is not live (reached corner space)
+			{
+				break;		// then break from the main while loop
+			}
+		}
+
+		// give back the ink for the rest of the move, if it was cut short
+		if(held > 0)
+			topUpInk((ProducerType) info->type, held, NULL);
 	}
+	flushContention();		// the number of live threads was decremented when the traveler terminated
+}
 
-	// Allocate space for the array of producerInfo structs
-	producerList = (ProducerInfo*) malloc(TOTAL_INK_PRODUCER_THREADS * sizeof(ProducerInfo));
+/*
+ * This function acts as the main function for each of the traveler threads that control 
+ * how the traveler acts and calculates various values.  arg is the index of its first
+ * traveler, whose counter slot it takes.
+ */
+void* travelerThread(void* arg)
+{
+	unsigned int index = (unsigned int) (uintptr_t) arg;
+	runTraveler(index, &travelerCounters[index]);
+	return NULL;
+}
+
+/*
+ * Main function of the threads started by spawnTravelers: arg is the thread's spawn
+ * counter slot, which it gives back when its travelers are done.
+ */
+void* spawnedTravelerThread(void* arg)
+{
+	unsigned int k = (unsigned int) (uintptr_t) arg;
+	runTraveler(spawnedTraveler[k], &travelerCounters[MAX_NUM_TRAVELER_THREADS + k]);
+	releaseSpawnCounters(k);
+	return NULL;
+}
+
+/*
+ * Pick the traveler's next move, following movePolicy: set info->dir to a direction
+ * perpendicular to the current one, and return the length of the displacement
+ * (which keeps the traveler on the grid).
+ */
+int chooseMove(TravelerInfo* info)
+{
+	if(movePolicy == MOVE_AWARE)
+	{
+		// the two perpendicular directions, and how far the traveler could go in each
+		TravelDirection choice[2];
+		unsigned int maxDist[2], freeRun[2];
+		if(info->dir == NORTH || info->dir == SOUTH)
+		{
+			choice[0] = EAST;
+			maxDist[0] = NUM_COLS - 1 - info->col;
+			choice[1] = WEST;
+			maxDist[1] = info->col;
+		}
+		else
+		{
+			choice[0] = NORTH;
+			maxDist[0] = NUM_ROWS - 1 - info->row;
+			choice[1] = SOUTH;
+			maxDist[1] = info->row;
+		}
+		for(int k = 0; k < 2; k++)
+		{
+			unsigned int lookahead = maxDist[k] < MOVE_LOOKAHEAD ? maxDist[k] : MOVE_LOOKAHEAD;
+			freeRun[k] = freeRunAhead(info->row, info->col, choice[k], lookahead);
+
+			// the traveler at the end of the free run is coming toward us: we would both
+			// end up blocked halfway, so only count half of the run
+			if(freeRun[k] > 0 && freeRun[k] < lookahead)
+			{
+				unsigned int row = info->row, col = info->col;
+				if(choice[k] == NORTH)
+					row += freeRun[k] + 1;
+				else if(choice[k] == SOUTH)
+					row -= freeRun[k] + 1;
+				else if(choice[k] == EAST)
+					col += freeRun[k] + 1;
+				else
+					col -= freeRun[k] + 1;
+				int other = squareOccupant(&grid, row, col);
+				if(other >= 0 && TRAVELER_DIR(__atomic_load_n(&travelerStore.attributes[other], __ATOMIC_RELAXED)) ==
+								 (TravelDirection) ((choice[k] + 2) % NUM_TRAVEL_DIRECTIONS))
+				{
+					freeRun[k] /= 2;
+					threadCounters->headOns++;
+				}
+			}
+		}
+
+		// prefer the longer free run (with probability proportional to its length), and
+		// fall back on the random walk if both directions are blocked
+		if(freeRun[0] + freeRun[1] > 0)
+		{
+			int k = ((unsigned int) rand() % (freeRun[0] + freeRun[1])) < freeRun[0] ? 0 : 1;
+			info->dir = choice[k];
+
+			// stay within the free run, unless it reaches as far as we looked
+			unsigned int limit = (freeRun[k] == MOVE_LOOKAHEAD) ? maxDist[k] : freeRun[k];
+			return 1 + rand() % limit;
+		}
+	}
+
+	// get a random direction perpendicular to current direction
+	if(info->dir == NORTH || info->dir == SOUTH)	// if direction is north or south
+	{
+		int temp = rand() % 2;		// calculate random number out of 2
+		if(temp)
+			info->dir = EAST;		// if 1, face east
+		else
+			info->dir = WEST;		// else face west
+	}
+	else						// else if the direction is east or west
+	{
+		int temp = rand() % 2;		// calculate random number out of 2
+		if(temp)
+			info->dir = NORTH;		// if 1, face north
+		else
+			info->dir = SOUTH;		// else face south
+	}
+
+	// calculate distance from available grid elements
+	int distance = 0;
+	if(info->dir == NORTH)	// if facing north
+	{
+		distance = rand() % (NUM_ROWS - info->row);	// calculate random distance within current row to max row
+		
+	}
+	else if(info->dir == SOUTH)		// else if facing south
+	{
+		distance = rand() % (info->row + 1);		// calculate random distance from 0 to current row
+	}
+	else if(info->dir == EAST)		// else if facing east
+	{
+		distance = rand() % (NUM_COLS - info->col);	// calculate random distance within current column to max column
+	}
+	else if(info->dir == WEST)		// else if facing west
+	{
+		distance = rand() % (info->col + 1);		// calculate random distance from 0 to current column
+	}
+
+	return distance;
+}
+
+/*
+ * Count the free squares ahead of (row, col) in direction dir, stopping at the first
+ * occupied one or after maxRun squares.
+ */
+unsigned int freeRunAhead(unsigned int row, unsigned int col, TravelDirection dir, unsigned int maxRun)
+{
+	unsigned int run = 0;
+	while(run < maxRun)
+	{
+		if(dir == NORTH)
+			row++;
+		else if(dir == SOUTH)
+			row--;
+		else if(dir == EAST)
+			col++;
+		else
+			col--;
+		if(!isSquareFree(row, col))
+			break;
+		run++;
+	}
+	return run;
+}
+
+/*
+ * Claim the square a traveler wants to move to, without blocking: try to claim it, back
+ * off, and try again, until backoffLimit is exceeded.  The traveler still holds its
+ * current square meanwhile, but since it never waits indefinitely, two travelers moving
+ * toward each other (or any longer cycle) can't deadlock.
+ * Returns 1 if the square was claimed, 0 if the traveler should give up this move.
+ */
+int acquireNextSquare(TravelerInfo* info, unsigned int row, unsigned int col)
+{
+	if (claimSquare(row, col, info->index))
+		return 1;
+
+	// let the watchdog know what we are waiting for
+	TravelerWatch* watch = &travelerWatch[info->index];
+	__atomic_store_n(&watch->waitingFor, WAITING_FLAG | ((unsigned long long) row << 32) | col, __ATOMIC_RELAXED);
+
+	unsigned long long limit = 1000ULL * (backoffLimit > 0 ? backoffLimit : 2ULL * travelerSleepTime + 1000);
+	struct timespec start, now;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	unsigned long long waited = 0;
+	unsigned int delay = 1;
+	int acquired = 0;
+
+	while (!acquired && waited < limit)
+	{
+		threadCounters->backoffs++;
+
+		// the first few retries only yield the CPU, then sleep for exponentially longer
+		if (delay < 8)
+			sched_yield();
+		else
+			usleep(delay);
+		if (delay < 1000)
+			delay *= 2;
+
+		acquired = claimSquare(row, col, info->index);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		waited = (now.tv_sec - start.tv_sec) * 1000000000ULL + now.tv_nsec - start.tv_nsec;
+	}
+
+	threadCounters->blockedTime += waited;
+	if (currentLife != NULL)
+		currentLife->blockedTime += waited;
+	noteContention(row, col, waited);
+	__atomic_store_n(&watch->waitingFor, 0, __ATOMIC_RELAXED);
+	return acquired;
+}
+
+/*
+ * This function is used by the traveler threads to execute the movement of the traveler by:
+ *		1.) Based off the orientation, attempt to claim the next grid square (giving up if it stays held)
+ * 		2.) alter the color of the current grid square based off of the traveler type
+ *		3.) release the current/previous grid square and update (and publish) the traveler's position
+ *		4.) if the traveler is located at one of the corner squares, set isLive to false (0)
+ * Returns 1 if the traveler moved, 0 if it was blocked.
+ */
+int moveTraveler(TravelerInfo* info)
+{
+	// amount to increment color by, 64 seemed to be the best choice for visual pleasure
+	unsigned char newColor = 64;
+
+	// find the next square from the current orientation
+	unsigned int nextRow, nextCol;
+	squareAhead(info, &nextRow, &nextCol);
+
+	if(!acquireNextSquare(info, nextRow, nextCol))	// try to claim the next grid square
+		return 0;
+
+	// increment the traveler's color channel of the current square
+	depositInk(info->row, info->col, info->type, newColor);
+
+	releaseSquare(info->row, info->col);		// release the current/previous grid square
+	info->row = nextRow;
+	info->col = nextCol;
+	publishTraveler(info);		// make the new position (and direction) visible to the front end
+
+	// if statement to check if the traveler is in one of the corner squares of the grid
+	if(isCorner(info->row, info->col))
+	{
+		info->isLive = 0;		// if it is, then set isLive value to 0 (false)
+	}
+	return 1;
+}
+
+/*
+ * Square the traveler steps onto next, in its direction
+ */
+void squareAhead(const TravelerInfo* info, unsigned int* row, unsigned int* col)
+{
+	*row = info->row;
+	*col = info->col;
+	if (info->dir == NORTH)
+		*row += 1;
+	else if (info->dir == SOUTH)
+		*row -= 1;
+	else if (info->dir == EAST)
+		*col += 1;
+	else
+		*col -= 1;
+}
+
+/*
+ * Is a square one of the four corners of the grid?
+ */
+int isCorner(unsigned int row, unsigned int col)
+{
+	return (row == 0 || row == NUM_ROWS-1) && (col == 0 || col == NUM_COLS-1);
+}
+
+//------------------------------------------------------------------------
+//	Single steps, for the engines that move each traveler a square at a
+//	time from a thread of their own (regions and wheel).  The traveler is
+//	worked on as a copy, published back to the store whenever it changes.
+//------------------------------------------------------------------------
+//
+
+/*
+ * Pick a new move (and take its ink in reserve mode) if the current one is done, then in
+ * stream mode make sure the traveler holds ink for its next square.  Returns 1 if the
+ * traveler can step, 0 if it stays put until a later step.
+ */
+int prepareStep(TravelerInfo* info, unsigned int* left, unsigned int* held, unsigned char* stalled)
+{
+	if (*left == 0)
+	{
+		unsigned int distance = (unsigned int) chooseMove(info);
+		publishTraveler(info);		// the new direction
+		if (distance == 0)
+			return 0;
+		if (inkMode == INK_RESERVE)
+		{
+			if (!takeInk(info->type, distance))
+				return 0;
+			*held = distance;
+		}
+		*left = distance;
+	}
+	// stream mode: with the tank empty, the traveler stays put until a later step
+	if (inkMode == INK_STREAM)
+	{
+		if (!streamInk(info->type, held, *left, 0))
+		{
+			if (!*stalled)
+				threadCounters->inkWaits++;
+			*stalled = 1;
+			return 0;
+		}
+		*stalled = 0;
+	}
+	return 1;
+}
+
+/*
+ * Color the square the traveler steps off and release it, and count the step.  The
+ * caller moves the traveler to its next square (already claimed, or to be claimed by
+ * the region it is handed over to).
+ */
+void leaveSquare(const TravelerInfo* info, unsigned int* left, unsigned int* held)
+{
+	// amount to increment color by, as in the thread engine
+	unsigned char newColor = 64;
+
+	depositInk(info->row, info->col, info->type, newColor);
+	releaseSquare(info->row, info->col);
+	(*left)--;
+	(*held)--;
+	threadCounters->moves++;
+	__atomic_store_n(&travelerWatch[info->index].progress, travelerWatch[info->index].progress + 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * The traveler's next square is occupied: give back the ink for the rest of its move,
+ * so that it picks another one at its next step
+ */
+void abandonMove(const TravelerInfo* info, unsigned int* left, unsigned int* held)
+{
+	topUpInk((ProducerType) info->type, *held, NULL);
+	*held = 0;
+	*left = 0;
+	threadCounters->reroutes++;
+}
+
+/*
+ * This function is the main function of the watchdog thread.  Every watchdogPeriod ms it
+ * looks for live travelers that haven't moved for STALL_PERIODS periods.  For the ones
+ * that are waiting for a square, it finds the traveler holding that square (the one
+ * standing on it), and follows these wait-for edges to report cycles.  Backoff counts
+ * are reported along with them.
+ */
+void* watchdogThread(void* arg)
+{
+	(void) arg;
+	const unsigned int N = MAX_NUM_TRAVELER_THREADS;
+	unsigned long long* lastProgress = (unsigned long long*) arenaAlloc(N, sizeof(unsigned long long), "watchdog");
+	unsigned int* stalledPeriods = (unsigned int*) arenaAlloc(N, sizeof(unsigned int), "watchdog");
+	int* waitsFor = (int*) arenaAlloc(N, sizeof(int), "watchdog");
+	unsigned char* mark = (unsigned char*) arenaAlloc(N, 1, "watchdog");
+
+	// open-addressing hash table from square to the traveler standing on it
+	size_t tableSize = 1;
+	while (tableSize < 2 * (size_t) N)
+		tableSize *= 2;
+	unsigned long long* tableKey = (unsigned long long*) arenaAlloc(tableSize, sizeof(unsigned long long), "watchdog");
+	int* tableValue = (int*) arenaAlloc(tableSize, sizeof(int), "watchdog");
+	for (unsigned int k=0; k<N; k++)
+		lastProgress[k] = __atomic_load_n(&travelerWatch[k].progress, __ATOMIC_RELAXED);
+
+	while (1)
+	{
+		usleep(watchdogPeriod * 1000);
+
+		// paused travelers aren't stalled
+		if (__atomic_load_n(&simPaused, __ATOMIC_RELAXED))
+		{
+			memset(stalledPeriods, 0, N * sizeof(unsigned int));
+			continue;
+		}
+
+		// which travelers haven't made progress, and where everyone is
+		unsigned int numStalled = 0, numBlocked = 0;
+		memset(tableKey, 0, tableSize * sizeof(unsigned long long));
+		for (unsigned int k=0; k<N; k++)
+		{
+			unsigned long long progress = __atomic_load_n(&travelerWatch[k].progress, __ATOMIC_RELAXED);
+			int isLive = isTravelerLive(k);
+			if (!isLive || progress != lastProgress[k])
+				stalledPeriods[k] = 0;
+			else
+				stalledPeriods[k]++;
+			lastProgress[k] = progress;
+			waitsFor[k] = -1;
+
+			if (isLive)
+			{
+				unsigned int position = __atomic_load_n(&travelerStore.position[k], __ATOMIC_RELAXED);
+				unsigned long long key = ((unsigned long long) TRAVELER_ROW(position) << 32) | TRAVELER_COL(position) | WAITING_FLAG;
+				size_t h = (size_t) ((key * 0x9E3779B97F4A7C15ULL) >> 20) & (tableSize - 1);
+				while (tableKey[h] != 0)
+					h = (h + 1) & (tableSize - 1);
+				tableKey[h] = key;
+				tableValue[h] = (int) k;
+			}
+		}
+
+		// wait-for edges of the stalled travelers
+		for (unsigned int k=0; k<N; k++)
+		{
+			if (stalledPeriods[k] < STALL_PERIODS)
+				continue;
+			numStalled++;
+
+			unsigned long long key = __atomic_load_n(&travelerWatch[k].waitingFor, __ATOMIC_RELAXED);
+			if (key == 0)
+				continue;		// not waiting for a square: starved of ink
+			numBlocked++;
+			size_t h = (size_t) ((key * 0x9E3779B97F4A7C15ULL) >> 20) & (tableSize - 1);
+			while (tableKey[h] != 0 && tableKey[h] != key)
+				h = (h + 1) & (tableSize - 1);
+			if (tableKey[h] == key)
+				waitsFor[k] = tableValue[h];
+		}
+
+		// each traveler waits for at most one other, so a cycle is found by following
+		// the edges from each traveler not visited yet (0: not visited, 1: on the current
+		// path, 2: done)
+		unsigned int numCycles = 0;
+		memset(mark, 0, N);
+		for (unsigned int k=0; k<N; k++)
+		{
+			int t = (int) k;
+			while (t >= 0 && mark[t] == 0)
+			{
+				mark[t] = 1;
+				t = waitsFor[t];
+			}
+			if (t >= 0 && mark[t] == 1)
+			{
+				numCycles++;
+				fprintf(stderr, "watchdog: wait-for cycle: %d", t);
+				for (int u = waitsFor[t]; u != t; u = waitsFor[u])
+					fprintf(stderr, " -> %d", u);
+				fprintf(stderr, " -> %d\n", t);
+			}
+			for (t = (int) k; t >= 0 && mark[t] == 1; t = waitsFor[t])
+				mark[t] = 2;
+		}
+
+		if (numStalled > 0)
+		{
+			unsigned long long backoffs = 0, reroutes = 0;
+			for (unsigned int k=0; k<numCounterSlots; k++)
+			{
+				backoffs += __atomic_load_n(&travelerCounters[k].backoffs, __ATOMIC_RELAXED);
+				reroutes += __atomic_load_n(&travelerCounters[k].reroutes, __ATOMIC_RELAXED);
+			}
+			fprintf(stderr, "watchdog: %u travelers without progress for %u ms (%u waiting for a square, %u for ink), "
+					"%u wait-for cycles, %llu backoffs, %llu reroutes so far\n", numStalled, STALL_PERIODS * watchdogPeriod,
+					numBlocked, numStalled - numBlocked, numCycles, backoffs, reroutes);
+		}
+		__atomic_add_fetch(&watchdogStalls, numStalled, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&watchdogCycles, numCycles, __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+/*
+ * Start a producer's timer: first refill after firstDelay microseconds, then every
+ * sleep time of its color
+ */
+void armProducer(ProducerInfo* producer, unsigned int firstDelay)
+{
+	unsigned int sleepTime = producerControl.sleepTime[producer->type];
+	struct itimerspec spec;
+	spec.it_interval.tv_sec = sleepTime / 1000000;
+	spec.it_interval.tv_nsec = (sleepTime % 1000000) * 1000;
+	spec.it_value.tv_sec = firstDelay / 1000000;
+	spec.it_value.tv_nsec = (firstDelay % 1000000) * 1000;
+	if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0)
+		spec.it_value.tv_nsec = 1;		// a zero value would disarm the timer
+	timerfd_settime(producer->timerFd, 0, &spec, NULL);
+	producer->isArmed = 1;
+}
+
+/*
+ * Stop a producer's timer
+ */
+void disarmProducer(ProducerInfo* producer)
+{
+	struct itimerspec spec;
+	memset(&spec, 0, sizeof(spec));
+	timerfd_settime(producer->timerFd, 0, &spec, NULL);
+	producer->isArmed = 0;
+}
+
+/*
+ * Apply a new sleep time to a running producer, without pushing back its next refill
+ * beyond the new sleep time (the controller changes it more often than a slow producer
+ * refills, and restarting the timer each time would never let it expire)
+ */
+void retimeProducer(ProducerInfo* producer)
+{
+	struct itimerspec current;
+	timerfd_gettime(producer->timerFd, &current);
+	unsigned long long remaining = current.it_value.tv_sec * 1000000ULL + current.it_value.tv_nsec / 1000;
+	unsigned int sleepTime = producerControl.sleepTime[producer->type];
+	armProducer(producer, remaining < sleepTime ? (unsigned int) remaining : sleepTime);
+}
+
+/*
+ * One step of the rate controller (see inkTarget): measure each color's consumption
+ * over the last interval seconds, and set its producers' sleep time.
+ */
+void adjustProductionRates(const unsigned int* numProducers, double interval)
+{
+	TravelerCounters total;
+	sumTravelerCounters(&total);
+	unsigned int target = __atomic_load_n(&producerControl.targetLevel, __ATOMIC_RELAXED);
+
+	for (unsigned int c=0; c<NUM_PRODUCER_TYPES; c++)
+	{
+		// what the travelers took (net of what they gave back) is what was produced
+		// minus what is left in the tank
+		unsigned int level = inkTankLevel((ProducerType) c);
+		long long consumed = (long long) (inkProduced[c] - controlProduced[c]) - ((long long) level - (long long) controlLevel[c]);
+		controlProduced[c] = inkProduced[c];
+		controlLevel[c] = level;
+		if (consumed < 0)
+			consumed = 0;
+		inkConsumption[c] = 0.7 * inkConsumption[c] + 0.3 * consumed / interval;
+
+		// ink per second that makes up for the consumption, and closes the gap to the target
+		double colorRefill = (double) numProducers[c] * MAX_ADD_INK * 1e6;
+		double rate = colorRefill / producerControl.sleepTime[c];
+		double wanted = inkConsumption[c] + ((double) target - level) / CONTROL_HORIZON;
+		if (total.inkRefused[c] > controlRefused[c] && level < target && wanted < 1.5 * rate)
+			wanted = 1.5 * rate;
+		controlRefused[c] = total.inkRefused[c];
+
+		unsigned int sleepTime = MAX_CONTROL_SLEEP_TIME;
+		if (wanted > colorRefill / MAX_CONTROL_SLEEP_TIME)
+			sleepTime = (colorRefill / wanted > MIN_SLEEP_TIME) ? (unsigned int) (colorRefill / wanted) : MIN_SLEEP_TIME;
+		__atomic_store_n(&producerControl.consumption[c], (unsigned int) inkConsumption[c], __ATOMIC_RELAXED);
+
+		// retime the running producers, unless the change is small
+		unsigned int previous = producerControl.sleepTime[c];
+		if (sleepTime > previous + previous / 8 || sleepTime + sleepTime / 8 < previous)
+		{
+			__atomic_store_n(&producerControl.sleepTime[c], sleepTime, __ATOMIC_RELAXED);
+			for (unsigned int k=0; k<TOTAL_INK_PRODUCER_THREADS; k++)
+			{
+				if (producerList[k].type == c && producerList[k].isArmed)
+					retimeProducer(&producerList[k]);
+			}
+		}
+	}
+}
+
+/*
+ * This function is the main function of the production scheduler thread.  All producers'
+ * timers and the demand eventfd are watched with a single epoll set:
+ *		- when a color's tank goes below its low-water mark, its producers' timers are started,
+ *		  staggered so that together they deliver MAX_ADD_INK per producer every producerSleepTime;
+ *		- each timer expiration is one refill by that producer (clamped to the tank's capacity);
+ *		- once the tank is full, the color's timers are stopped until the next demand;
+ *		- under rate control, a timer of its own runs the controller every CONTROL_PERIOD.
+ */
+void* productionSchedulerThread(void* arg)
+{
+	(void) arg;
+	threadLockStats = &producerLockStats;
+
+	const unsigned int DEMAND_EVENT = UINT32_MAX;
+	const unsigned int CONTROL_EVENT = UINT32_MAX - 1;
+	int epollFd = epoll_create1(0);
+	struct epoll_event event;
+	event.events = EPOLLIN;
+	event.data.u32 = DEMAND_EVENT;
+	epoll_ctl(epollFd, EPOLL_CTL_ADD, demandEventFd, &event);
+
+	int controlFd = -1;
+	if (inkTarget > 0)
+	{
+		controlFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+		struct itimerspec spec;
+		spec.it_interval.tv_sec = spec.it_value.tv_sec = CONTROL_PERIOD / 1000000;
+		spec.it_interval.tv_nsec = spec.it_value.tv_nsec = (CONTROL_PERIOD % 1000000) * 1000;
+		timerfd_settime(controlFd, 0, &spec, NULL);
+		event.data.u32 = CONTROL_EVENT;
+		epoll_ctl(epollFd, EPOLL_CTL_ADD, controlFd, &event);
+	}
+	struct timespec lastControl;
+	clock_gettime(CLOCK_MONOTONIC, &lastControl);
+	for (unsigned int k=0; k<TOTAL_INK_PRODUCER_THREADS; k++)
+	{
+		event.data.u32 = k;
+		epoll_ctl(epollFd, EPOLL_CTL_ADD, producerList[k].timerFd, &event);
+	}
+
+	// the number of producers of each color
+	unsigned int numProducers[NUM_PRODUCER_TYPES];
+	for (unsigned int c=0; c<NUM_PRODUCER_TYPES; c++)
+		numProducers[c] = (TOTAL_INK_PRODUCER_THREADS + NUM_PRODUCER_TYPES - 1 - c) / NUM_PRODUCER_TYPES;
+
+	struct epoll_event events[64];
+	while(1)
+	{
+		int numEvents = epoll_wait(epollFd, events, 64, -1);
+
+		for (int e=0; e<numEvents; e++)
+		{
+			if (events[e].data.u32 == DEMAND_EVENT)
+			{
+				eventfd_t count;
+				eventfd_read(demandEventFd, &count);
+
+				int rateChanged = __atomic_exchange_n(&productionRateChanged, 0, __ATOMIC_ACQ_REL);
+				if (rateChanged)
+				{
+					for (unsigned int c=0; c<NUM_PRODUCER_TYPES; c++)
+						__atomic_store_n(&producerControl.sleepTime[c], producerSleepTime, __ATOMIC_RELAXED);
+				}
+
+				// start the producers of the colors in demand (and restart the running ones
+				// if the production rate was changed)
+				for (unsigned int k=0; k<TOTAL_INK_PRODUCER_THREADS; k++)
+				{
+					ProducerInfo* producer = &producerList[k];
+					if ((!producer->isArmed && __atomic_load_n(&inkDemand[producer->type], __ATOMIC_ACQUIRE)) ||
+						(producer->isArmed && rateChanged))
+					{
+						armProducer(producer, (producerControl.sleepTime[producer->type] / numProducers[producer->type]) * (producer->rank + 1));
+					}
+				}
+			}
+			else if (events[e].data.u32 == CONTROL_EVENT)
+			{
+				// measure the interval: the ticks can be late when the travelers keep the cores busy
+				uint64_t expirations;
+				if (read(controlFd, &expirations, sizeof(expirations)) != sizeof(expirations))
+					continue;
+				struct timespec now;
+				clock_gettime(CLOCK_MONOTONIC, &now);
+				double interval = (now.tv_sec - lastControl.tv_sec) + (now.tv_nsec - lastControl.tv_nsec) * 1e-9;
+				lastControl = now;
+				adjustProductionRates(numProducers, interval);
+			}
+			else
+			{
+				ProducerInfo* producer = &producerList[events[e].data.u32];
+				uint64_t expirations;
+				if (read(producer->timerFd, &expirations, sizeof(expirations)) != sizeof(expirations))
+					continue;
+				producerWakeups++;
+
+				// top up the tank, without overfilling it
+				ProducerType type = producer->type;
+				unsigned int added;
+				int isFull = topUpInk(type, MAX_ADD_INK, &added);
+				inkRefills++;
+				inkProduced[type] += added;
+				__atomic_add_fetch(&inkOverflow, MAX_ADD_INK - added, __ATOMIC_RELAXED);
+
+				if (isFull)
+				{
+					// stop this color's production.  A traveler may have taken ink since
+					// the level was checked, so check again after clearing the demand flag,
+					// otherwise its signal could be lost.
+					for (unsigned int k=0; k<TOTAL_INK_PRODUCER_THREADS; k++)
+					{
+						if (producerList[k].type == type && producerList[k].isArmed)
+							disarmProducer(&producerList[k]);
+					}
+					__atomic_store_n(&inkDemand[type], 0, __ATOMIC_RELEASE);
+					if (inkTankLevel(type) < inkLowWater)
+						signalInkDemand(type);
+				}
+			}
+		}
+	}
+	return NULL;
+}
+
+//------------------------------------------------------------------------
+//	Commands.  The front end never acts on the simulation directly: it posts
+//	commands to a lock-free queue, and the control thread applies them, so
+//	that the GLUT thread never waits for a simulation lock.
+//------------------------------------------------------------------------
+//
+
+/*
+ * Post a command for the control thread (from any thread, without waiting).  Returns
+ * 0 if the queue is full and the command was dropped.
+ */
+int postCommand(CommandType type, unsigned int arg)
+{
+	SimCommand command = {type, arg};
+	if (!commandQueuePush(&commandQueue, command))
+		return 0;
+	eventNotifyAll(&commandPosted);
+	return 1;
+}
+
+/*
+ * Called by the engines before each step: return at once, unless the simulation is
+ * paused, in which case wait until it is resumed.
+ */
+void waitWhilePaused(void)
+{
+	while (__atomic_load_n(&simPaused, __ATOMIC_ACQUIRE))
+	{
+		unsigned int key = eventPrepareWait(&simResumed);
+		if (!__atomic_load_n(&simPaused, __ATOMIC_ACQUIRE))
+		{
+			eventCancelWait(&simResumed);
+			break;
+		}
+		eventWait(&simResumed, key, 1000000);
+	}
+}
+
+/*
+ * Take a spawn counter slot.  Returns its number, or -1 if they are all in use
+ */
+int acquireSpawnCounters(void)
+{
+	int k = -1;
+	pthread_mutex_lock(&spawnCounterLock);
+	if (numFreeSpawnCounters > 0)
+		k = (int) freeSpawnCounters[--numFreeSpawnCounters];
+	else if (numUsedSpawnCounters < numSpawnCounterSlots)
+		k = (int) numUsedSpawnCounters++;
+	pthread_mutex_unlock(&spawnCounterLock);
+	return k;
+}
+
+/*
+ * Give back spawn counter slot k.  Its counts stay, and add up with those of the next
+ * thread to take it.
+ */
+void releaseSpawnCounters(unsigned int k)
+{
+	pthread_mutex_lock(&spawnCounterLock);
+	freeSpawnCounters[numFreeSpawnCounters++] = k;
+	pthread_mutex_unlock(&spawnCounterLock);
+}
+
+/*
+ * Bring up to count terminated travelers back, each on a thread of its own, with a
+ * new random color, position and direction (thread engine only: the other engines
+ * don't take new travelers once started).  At most numSpawnCounterSlots spawned
+ * threads run at a time.
+ */
+void spawnTravelers(unsigned int count)
+{
+	if (engine != ENGINE_THREADS)
+	{
+		printf("Spawning travelers is only supported by the threads engine\n");
+		return;
+	}
+
+	unsigned int spawned = 0;
+	while (spawned < count)
+	{
+		int k = acquireSpawnCounters();
+		if (k < 0)
+		{
+			printf("Too many spawned threads running (%u)\n", numSpawnCounterSlots);
+			break;
+		}
+		int slot = popFreeTraveler();
+		if (slot < 0)
+		{
+			releaseSpawnCounters((unsigned int) k);
+			break;
+		}
+		unsigned int index = (unsigned int) slot;
+		spawnedTraveler[k] = index;
+		unsigned int row = (rand() % (NUM_ROWS-1)) + 1;
+		unsigned int col = (rand() % (NUM_COLS-1)) + 1;
+		travelerStore.position[index] = TRAVELER_POSITION(row, col);
+		travelerStore.attributes[index] = TRAVELER_ATTRIBUTES(rand() % NUM_TRAV_TYPES, rand() % NUM_TRAVEL_DIRECTIONS);
+		publishTravelerLive(index, 1);
+		__atomic_add_fetch(&numLiveThreads, 1, __ATOMIC_RELAXED);
+
+		pthread_t travelerThreadID;
+		int errCode = pthread_create(&travelerThreadID, NULL, spawnedTravelerThread, (void*) (uintptr_t) k);
+		if (errCode != 0)
+		{
+			printf("could not pthread_create thread %u. %d\n", index, errCode);
+			publishTravelerLive(index, 0);
+			__atomic_sub_fetch(&numLiveThreads, 1, __ATOMIC_RELAXED);
+			pushFreeTraveler(index);
+			releaseSpawnCounters((unsigned int) k);
+			break;
+		}
+		pthread_detach(travelerThreadID);
+		spawned++;
+	}
+	printf("Spawned %u travelers\n", spawned);
+}
+
+/*
+ * Write the state of the simulation to checkpoint.<n>.bin: a header (CHECKPOINT_MAGIC,
+ * grid dimensions, number of traveler slots and tank levels, as 32-bit values), the
+ * colors of the grid row by row (black for tiles never touched), then the traveler
+ * store's positions, attributes and live bits.  The travelers keep moving while it is
+ * written, unless the simulation is paused.
+ */
+#define CHECKPOINT_MAGIC	0x4B434C47	// "GLCK"
+void writeCheckpoint(void)
+{
+	char path[64];
+	snprintf(path, sizeof(path), "checkpoint.%u.bin", numCheckpoints);
+	FILE* out = fopen(path, "wb");
+	if (out == NULL)
+	{
+		perror(path);
+		return;
+	}
+
+	uint32_t header[] = {CHECKPOINT_MAGIC, NUM_ROWS, NUM_COLS, MAX_NUM_TRAVELER_THREADS,
+						 inkTankLevel(RED_INK), inkTankLevel(GREEN_INK), inkTankLevel(BLUE_INK)};
+	fwrite(header, sizeof(header), 1, out);
+
+	int* row = (int*) checkedMalloc(NUM_COLS, sizeof(int), "checkpoint row");
+	for (unsigned int r=0; r<NUM_ROWS; r++)
+	{
+		for (unsigned int c=0; c<NUM_COLS; c++)
+		{
+			GridTile* tile = __atomic_load_n(&grid.tiles[(size_t) (r >> GRID_TILE_SHIFT) * grid.numTileCols + (c >> GRID_TILE_SHIFT)], __ATOMIC_ACQUIRE);
+			row[c] = (tile == NULL) ? (int) 0xFF000000 :
+					 __atomic_load_n(&tile->color[((r & GRID_TILE_MASK) << GRID_TILE_SHIFT) | (c & GRID_TILE_MASK)], __ATOMIC_RELAXED);
+		}
+		fwrite(row, sizeof(int), NUM_COLS, out);
+	}
+	free(row);
+
+	fwrite(travelerStore.position, sizeof(unsigned int), MAX_NUM_TRAVELER_THREADS, out);
+	fwrite(travelerStore.attributes, 1, MAX_NUM_TRAVELER_THREADS, out);
+	fwrite(travelerStore.live, sizeof(unsigned long long), (MAX_NUM_TRAVELER_THREADS + 63) / 64, out);
+	if (fclose(out) != 0)
+	{
+		perror(path);
+		return;
+	}
+	printf("Checkpoint written to %s\n", path);
+	numCheckpoints++;
+}
+
+/*
+ * Apply a batch of commands.  Refills of the same color are merged into one (a single
+ * trip through the tank's lock); the other commands are applied in order.
+ */
+void applyCommands(const SimCommand* commands, unsigned int count)
+{
+	unsigned int refills[NUM_PRODUCER_TYPES] = {0};
+	for (unsigned int k=0; k<count; k++)
+	{
+		switch (commands[k].type)
+		{
+			case CMD_REFILL:
+				if (commands[k].arg < NUM_PRODUCER_TYPES)
+					refills[commands[k].arg]++;
+				break;
+
+			case CMD_SPEEDUP:
+				speedupProducers();
+				break;
+
+			case CMD_SLOWDOWN:
+				slowdownProducers();
+				break;
+
+			case CMD_PAUSE:
+				__atomic_store_n(&simPaused, 1, __ATOMIC_RELEASE);
+				break;
+
+			case CMD_RESUME:
+				__atomic_store_n(&simPaused, 0, __ATOMIC_RELEASE);
+				eventNotifyAll(&simResumed);
+				break;
+
+			case CMD_SPAWN:
+				spawnTravelers(commands[k].arg);
+				break;
+
+			case CMD_CHECKPOINT:
+				writeCheckpoint();
+				break;
+
+			default:
+				break;
+		}
+	}
+
+	for (unsigned int c=0; c<NUM_PRODUCER_TYPES; c++)
+	{
+		// merged refills can't add more than a full tank (nor wrap around)
+		if (refills[c] > 0)
+			topUpInk((ProducerType) c, refills[c] > MAX_LEVEL / MAX_ADD_INK ? MAX_LEVEL : refills[c] * MAX_ADD_INK, NULL);
+	}
+}
+
+/*
+ * This function is the main function of the control thread: wait for commands, and
+ * apply them up to COMMAND_BATCH at a time.
+ */
+void* controlThread(void* arg)
+{
+	(void) arg;
+	SimCommand batch[COMMAND_BATCH];
+	while (1)
+	{
+		unsigned int count = 0;
+		while (count < COMMAND_BATCH && commandQueuePop(&commandQueue, &batch[count]))
+			count++;
+		if (count > 0)
+		{
+			applyCommands(batch, count);
+			continue;
+		}
+
+		// register as a waiter, then check the queue again, so that a command posted
+		// in between is sure to wake us up
+		unsigned int key = eventPrepareWait(&commandPosted);
+		if (commandQueuePop(&commandQueue, &batch[0]))
+		{
+			eventCancelWait(&commandPosted);
+			applyCommands(batch, 1);
+			continue;
+		}
+		eventWait(&commandPosted, key, 1000000);
+	}
+	return NULL;
+}
+
+//==================================================================================
+//	Configuration
+//==================================================================================
+
+//	Grid dimensions are limited so that a row or column index always fits in 16 bits
+#define MIN_GRID_DIM	3
+#define MAX_GRID_DIM	65536
+
+// One entry per configurable simulation parameter.  The name is used both as the
+// command line option (preceded by '-') and as the key in a config file.
+// Options with a list of choices take one of the choice names as value, and store its index.
+typedef struct ConfigOption {
+								const char* name;
+								unsigned int* value;
+								unsigned int minValue;
+								unsigned int maxValue;
+								const char* help;
+								// NULL-terminated choice names, or NULL for numeric options
+								const char* const* choices;
+} ConfigOption;
+
+ConfigOption configOptions[] = {
+	{"rows",		&NUM_ROWS,					MIN_GRID_DIM,	MAX_GRID_DIM,	"number of rows in the grid", NULL},
+	{"cols",		&NUM_COLS,					MIN_GRID_DIM,	MAX_GRID_DIM,	"number of columns in the grid", NULL},
+	{"travelers",	&MAX_NUM_TRAVELER_THREADS,	1,				INT_MAX,		"number of traveler threads", NULL},
+	{"maxLevel",	&MAX_LEVEL,					1,				UINT32_MAX/2,	"capacity of each ink tank", NULL},
+	{"addInk",		&MAX_ADD_INK,				1,				UINT32_MAX/2,	"amount of ink added by one refill", NULL},
+	{"producers",	&TOTAL_INK_PRODUCER_THREADS,	NUM_PRODUCER_TYPES,	UINT32_MAX,	"total number of ink producer threads", NULL},
+	{"lowWater",	&lowWaterPercent,			0,				100,			"tank level (percent of maxLevel) below which the producers start", NULL},
+	{"inkShards",	&numInkShards,				0,				MAX_INK_SHARDS,	"number of shards per ink tank (0 or 1: a single global tank)", NULL},
+	{"inkMode",		&inkMode,					0,				NUM_INK_MODES-1,	"how travelers take ink for their moves", INK_MODE_NAMES},
+	{"inkTarget",	&inkTarget,					0,				100,			"tank level (percent of maxLevel) the producers' rates are adjusted to hold (0: manual rates)", NULL},
+	{"inkChunk",	&inkChunk,					1,				UINT32_MAX/2,	"stream ink mode: squares' worth of ink taken at a time", NULL},
+	{"backoffLimit",	&backoffLimit,			0,				UINT32_MAX,		"time a traveler waits for a square before moving elsewhere, in microseconds (0: auto)", NULL},
+	{"watchdog",	&watchdogPeriod,			0,				UINT32_MAX/1000,	"watchdog period in milliseconds (0: no watchdog)", NULL},
+	{"movePolicy",	&movePolicy,				0,				NUM_MOVE_POLICIES-1,	"how travelers choose their moves", MOVE_POLICY_NAMES},
+	{"engine",		&engine,					0,				NUM_ENGINES-1,	"how the travelers are run", ENGINE_NAMES},
+	{"regionRows",	&regionRows,				0,				MAX_GRID_DIM/2,	"regions engine: number of regions along the rows (0: auto)", NULL},
+	{"regionCols",	&regionCols,				0,				MAX_GRID_DIM/2,	"regions engine: number of regions along the columns (0: auto)", NULL},
+	{"wheelThreads",	&wheelThreads,			0,				1024,			"wheel engine: number of threads stepping the travelers (0: one per core)", NULL},
+	{"wheelTick",	&wheelTick,					100,			1000000,		"wheel engine: timer tick in microseconds", NULL},
+	{"lock",		&lockKind,					0,				NUM_LOCK_KINDS-1,	"implementation of the ink tank locks", LOCK_NAMES},
+	{"placement",	&placementPolicy,			0,				NUM_PLACEMENT_POLICIES-1,	"how traveler threads and region workers are pinned to cores", PLACEMENT_NAMES},
+	{"stepTime",	&travelerSleepTime,			0,				UINT32_MAX,		"traveler sleep time after each step, in microseconds (0: unpaced)", NULL},
+	{"steady",		&steadyState,				0,				1,				"1: respawn travelers that reach a corner", NULL},
+	{"headless",	&headless,					0,				1,				"1: run without the graphic front end", NULL},
+	{"metrics",		&metricsInstance,			0,				UINT32_MAX,		"serve Prometheus metrics on socket /tmp/glthreads.N.metrics (0: no metrics)", NULL},
+	{"hugePages",	&hugePageMode,				0,				NUM_HUGE_PAGE_MODES-1,	"pages backing the simulation state", HUGE_PAGE_NAMES},
+	{"history",		&historyBudget,				0,				1 << 20,		"memory for the grid's history in MB, before it goes to a file (0: no history)", NULL},
+	{"historyPeriod",	&historyPeriod,			10,				60000,			"time between two frames of the history, in milliseconds", NULL},
+	{"export",		&exportPeriod,				0,				60000,			"time between two frames exported to frame.N.<format>, in milliseconds (0: no export)", NULL},
+	{"exportFormat",	&exportFormat,			0,				NUM_EXPORT_FORMATS-1,	"image format of the exported frames", EXPORT_FORMAT_NAMES},
+	{"exportBuffers",	&exportBuffers,			1,				MAX_EXPORT_BUFFERS,	"frames that may wait to be written before the next ones are dropped", NULL},
+	{"shared",		&sharedInstance,			0,				UINT32_MAX,		"keep the simulation state in shared segment /glthreads.N for viewers (0: not shared)", NULL},
+	{"duration",	&runDuration,				0,				UINT32_MAX,		"headless run time in seconds (0: until all travelers terminate)", NULL},
+};
+const unsigned int NUM_CONFIG_OPTIONS = sizeof(configOptions) / sizeof(ConfigOption);
+
+/*
+ * Print the list of recognized options
+ */
+void printUsage(const char* progName)
+{
+	printf("Usage: %s [-config <file>] [-<option> <value> ...]\n", progName);
+	printf("Options (also accepted as \"option = value\" lines in a config file):\n");
+	for (unsigned int k=0; k<NUM_CONFIG_OPTIONS; k++)
+	{
+		if (configOptions[k].choices != NULL)
+		{
+			printf("  -%-12s %s (default %s, one of", configOptions[k].name, configOptions[k].help,
+					configOptions[k].choices[*configOptions[k].value]);
+			for (unsigned int c=0; configOptions[k].choices[c] != NULL; c++)
+				printf(" %s", configOptions[k].choices[c]);
+			printf(")\n");
+		}
+		else
+		{
+			printf("  -%-12s %s (default %u, range %u..%u)\n", configOptions[k].name, configOptions[k].help,
+					*configOptions[k].value, configOptions[k].minValue, configOptions[k].maxValue);
+		}
+	}
+}
+
+/*
+ * Set the option with the given name from its string value.  Returns 1 on success,
+ * 0 if the name is unknown or the value is not a number within the option's range
+ * (or not one of the option's choices).
+ */
+int setConfigOption(const char* name, const char* valueStr)
+{
+	for (unsigned int k=0; k<NUM_CONFIG_OPTIONS; k++)
+	{
+		if (strcmp(name, configOptions[k].name) == 0 && configOptions[k].choices != NULL)
+		{
+			for (unsigned int c=0; configOptions[k].choices[c] != NULL; c++)
+			{
+				if (strcmp(valueStr, configOptions[k].choices[c]) == 0)
+				{
+					*configOptions[k].value = c;
+					return 1;
+				}
+			}
+			fprintf(stderr, "Invalid value \"%s\" for %s\n", valueStr, name);
+			return 0;
+		}
+		else if (strcmp(name, configOptions[k].name) == 0)
+		{
+			char* end;
+			errno = 0;
+			unsigned long long value = strtoull(valueStr, &end, 10);
+
+			// reject empty strings, trailing garbage, negative numbers, and anything out of range
+			if ((end == valueStr) || (*end != '\0') || (valueStr[0] == '-') || (errno == ERANGE) ||
+				(value < configOptions[k].minValue) || (value > configOptions[k].maxValue))
+			{
+				fprintf(stderr, "Invalid value \"%s\" for %s (expected %u..%u)\n", valueStr, name,
+						configOptions[k].minValue, configOptions[k].maxValue);
+				return 0;
+			}
+			*configOptions[k].value = (unsigned int) value;
+			return 1;
+		}
+	}
+	fprintf(stderr, "Unknown option \"%s\"\n", name);
+	return 0;
+}
+
+/*
+ * Read "name = value" lines from a config file.  Blank lines and lines starting with '#' are ignored.
+ */
+void loadConfigFile(const char* path)
+{
+	FILE* fp = fopen(path, "r");
+	if (fp == NULL)
+	{
+		fprintf(stderr, "Could not open config file %s\n", path);
+		exit(EXIT_FAILURE);
+	}
+
+	char line[256];
+	unsigned int lineNum = 0;
+	while (fgets(line, sizeof(line), fp) != NULL)
+	{
+		lineNum++;
+		char name[64], valueStr[64], extra[2];
+
+		// skip leading white space, then comments and blank lines
+		char* start = line;
+		while (*start == ' ' || *start == '\t')
+			start++;
+		if (*start == '#' || *start == '\n' || *start == '\r' || *start == '\0')
+			continue;
+
+		// accept both "name = value" and "name value"
+		for (char* c = start; *c != '\0'; c++)
+		{
+			if (*c == '=')
+				*c = ' ';
+		}
+		if ((sscanf(start, "%63s %63s %1s", name, valueStr, extra) != 2) || !setConfigOption(name, valueStr))
+		{
+			fprintf(stderr, "%s:%u: invalid config line\n", path, lineNum);
+			exit(EXIT_FAILURE);
+		}
+	}
+	fclose(fp);
+}
+
+/*
+ * Process the command line.  Options are applied in order, so options given after
+ * -config override the values read from the file.
+ */
+void parseCommandLine(int argc, char** argv)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-help") == 0 || strcmp(argv[i], "--help") == 0)
+		{
+			printUsage(argv[0]);
+			exit(0);
+		}
+		else if (argv[i][0] != '-' || i + 1 >= argc)
+		{
+			fprintf(stderr, "Unexpected argument \"%s\"\n", argv[i]);
+			printUsage(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+		else if (strcmp(argv[i], "-config") == 0)
+		{
+			loadConfigFile(argv[++i]);
+		}
+		else
+		{
+			const char* name = argv[i] + 1;
+			if (!setConfigOption(name, argv[++i]))
+				exit(EXIT_FAILURE);
+		}
+	}
+}
+
+/*
+ * Compute count * elemSize into *bytes.  Returns 0 if the product does not fit in a size_t.
+ */
+int checkedArrayBytes(size_t count, size_t elemSize, size_t* bytes)
+{
+	if (elemSize != 0 && count > SIZE_MAX / elemSize)
+		return 0;
+	*bytes = count * elemSize;
+	return 1;
+}
+
+/*
+ * Allocate count elements of elemSize bytes, exiting with a message if the size overflows
+ * or the allocation fails.
+ */
+void* checkedMalloc(size_t count, size_t elemSize, const char* what)
+{
+	size_t bytes;
+	void* ptr = NULL;
+	if (checkedArrayBytes(count, elemSize, &bytes))
+		ptr = malloc(bytes > 0 ? bytes : 1);
+	if (ptr == NULL)
+	{
+		fprintf(stderr, "Could not allocate %s (%zu x %zu bytes)\n", what, count, elemSize);
+		exit(EXIT_FAILURE);
+	}
+	return ptr;
+}
+
+/*
+ * Check that the configured values are consistent with each other, and that the
+ * structures they size can be addressed without overflow.
+ */
+void validateConfiguration(void)
+{
+	size_t numCells, bytes;
+	int ok = 1;
+
+	if (MAX_ADD_INK > MAX_LEVEL)
+	{
+		fprintf(stderr, "addInk (%u) cannot exceed maxLevel (%u)\n", MAX_ADD_INK, MAX_LEVEL);
+		ok = 0;
+	}
+
+	// the grid's tile directory must be addressable
+	if (!checkedArrayBytes(NUM_ROWS, NUM_COLS, &numCells) ||
+		!checkedArrayBytes(((size_t) NUM_ROWS + GRID_TILE_MASK) >> GRID_TILE_SHIFT,
+						   (((size_t) NUM_COLS + GRID_TILE_MASK) >> GRID_TILE_SHIFT) * sizeof(GridTile*), &bytes))
+	{
+		fprintf(stderr, "Grid of %u x %u is too large for this platform\n", NUM_ROWS, NUM_COLS);
+		ok = 0;
+	}
+	// each traveler needs a square of its own, away from the first row and column
+	else if (MAX_NUM_TRAVELER_THREADS > (size_t) (NUM_ROWS - 1) * (NUM_COLS - 1))
+	{
+		fprintf(stderr, "Cannot place %u travelers on a %u x %u grid\n", MAX_NUM_TRAVELER_THREADS,
+				NUM_ROWS, NUM_COLS);
+		ok = 0;
+	}
+	// traveler indices are passed around as int (with -1 for none)
+	if (MAX_NUM_TRAVELER_THREADS > INT_MAX ||
+		!checkedArrayBytes(MAX_NUM_TRAVELER_THREADS, sizeof(TravelerWatch), &bytes) ||
+		!checkedArrayBytes(MAX_NUM_TRAVELER_THREADS, sizeof(TravelerCounters), &bytes))
+	{
+		fprintf(stderr, "Too many travelers (%u)\n", MAX_NUM_TRAVELER_THREADS);
+		ok = 0;
+	}
+
+	if (numInkShards > MAX_LEVEL)
+	{
+		fprintf(stderr, "inkShards (%u) cannot exceed maxLevel (%u)\n", numInkShards, MAX_LEVEL);
+		ok = 0;
+	}
+
+	if (engine == ENGINE_REGIONS && !configureRegions())
+		ok = 0;
+	if (engine == ENGINE_WHEEL && !configureWheel())
+		ok = 0;
+
+	if (!ok)
+		exit(EXIT_FAILURE);
+
+	// the initial ink levels cannot exceed the capacity of the tanks
+	if (redLevel > MAX_LEVEL)
+		redLevel = MAX_LEVEL;
+	if (greenLevel > MAX_LEVEL)
+		greenLevel = MAX_LEVEL;
+	if (blueLevel > MAX_LEVEL)
+		blueLevel = MAX_LEVEL;
+}
+
+/*
+ * Run the simulation without a front end: sleep for the requested duration (or until all
+ * travelers have terminated), then print a summary of the run and exit.
+ */
+void runHeadless(void)
+{
+	struct timespec start, now;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	double elapsed = 0.0;
+
+	do
+	{
+		usleep(100000);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		elapsed = (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) * 1e-9;
+	} while ((runDuration == 0 || elapsed < runDuration) &&
+			 (steadyState || __atomic_load_n(&numLiveThreads, __ATOMIC_RELAXED) > 0));
+
+	// add up the per-thread counters
+	TravelerCounters total;
+	sumTravelerCounters(&total);
+
+	printf("grid %u x %u, %u travelers, %u producers, steady %u, step time %u us, move policy %s\n",
+			NUM_ROWS, NUM_COLS, MAX_NUM_TRAVELER_THREADS, TOTAL_INK_PRODUCER_THREADS, steadyState, travelerSleepTime,
+			MOVE_POLICY_NAMES[movePolicy]);
+	if (engine == ENGINE_REGIONS)
+		printf("engine regions, %u x %u regions, ", regionRows, regionCols);
+	else
+		printf("engine %s, ", ENGINE_NAMES[engine]);
+	printf("lock %s, placement %s (%u cpus, %u packages, %u threads pinned), lock waits %llu (%.3f s)\n", LOCK_NAMES[lockKind],
+			PLACEMENT_NAMES[placementPolicy], numPlacementCpus, numPlacementPackages, __atomic_load_n(&numPinnedThreads, __ATOMIC_RELAXED),
+			total.lockStats.waits + __atomic_load_n(&producerLockStats.waits, __ATOMIC_RELAXED),
+			(total.lockStats.waitTime + __atomic_load_n(&producerLockStats.waitTime, __ATOMIC_RELAXED)) * 1e-9);
+	printf("elapsed %.2f s, live travelers %u, moves %llu (%.0f moves/s), respawns %llu\n",
+			elapsed, __atomic_load_n(&numLiveThreads, __ATOMIC_RELAXED), total.moves, total.moves / elapsed, total.respawns);
+	printf("producer wakeups %llu, refills %llu (overflow %llu), ink shards %u, ink steals %llu, ink mode %s, ink waits %llu\n",
+			__atomic_load_n(&producerWakeups, __ATOMIC_RELAXED), __atomic_load_n(&inkRefills, __ATOMIC_RELAXED),
+			__atomic_load_n(&inkOverflow, __ATOMIC_RELAXED), numInkShards, total.inkSteals, INK_MODE_NAMES[inkMode], total.inkWaits);
+	if (inkTarget > 0)
+	{
+		printf("rate control: target level %u", __atomic_load_n(&producerControl.targetLevel, __ATOMIC_RELAXED));
+		const char* const colorNames[NUM_PRODUCER_TYPES] = {"red", "green", "blue"};
+		for (unsigned int c=0; c<NUM_PRODUCER_TYPES; c++)
+			printf(", %s every %.1f ms (%u/s used, %llu refused)", colorNames[c],
+					__atomic_load_n(&producerControl.sleepTime[c], __ATOMIC_RELAXED) / 1000.,
+					__atomic_load_n(&producerControl.consumption[c], __ATOMIC_RELAXED), total.inkRefused[c]);
+		printf("\n");
+	}
+	printf("backoffs %llu, reroutes %llu, blocked time %.3f s, watchdog stalls %llu, wait-for cycles %llu, head-ons avoided %llu\n",
+			total.backoffs, total.reroutes, total.blockedTime * 1e-9, __atomic_load_n(&watchdogStalls, __ATOMIC_RELAXED),
+			__atomic_load_n(&watchdogCycles, __ATOMIC_RELAXED), total.headOns);
+	printContentionSummary();
+	if (historyBudget > 0)
+		printHistorySummary();
+	if (exportPeriod > 0)
+		printExportSummary();
+	if (engine == ENGINE_WHEEL)
+		printWheelJitter();
+	exit(0);
+}
+
+
+/*
+ * Main function (left out with -DGLTHREADS_NO_MAIN, when main.c is linked into the
+ * microbenchmarks)
+ */
+#ifndef GLTHREADS_NO_MAIN
+int main(int argc, char** argv)
+{
+	// read the simulation parameters from the command line (and config file, if any)
+	parseCommandLine(argc, argv);
+	validateConfiguration();
+	if(placementPolicy != PLACE_NONE)
+		initializePlacement();
+
+	if(!headless)
+		initializeFrontEnd(argc, argv, displayGridPane, displayStatePane);
+	
+	//	Now we can do application-level
+	initializeApplication();
+
+	// declare errCode value to store the return value of pthread_create
+	int errCode;
+
+	// the region and wheel engines run all travelers on their own threads
+	if(engine == ENGINE_REGIONS)
+		startRegionEngine();
+	else if(engine == ENGINE_WHEEL)
+		startWheelEngine();
+	printArenaFootprint();
+
+	// for loop to run through the max number of traveler threads and create a thread for each one
+	for(unsigned int i = 0; engine == ENGINE_THREADS && i < MAX_NUM_TRAVELER_THREADS; i++)
+	{
+		// create a pthread, sending the travelerThread function to run and the index of its traveler
+		pthread_t travelerThreadID;
+		errCode = pthread_create(&travelerThreadID, NULL, travelerThread, (void*) (uintptr_t) i);
+
+		// increment the number of live threads
+		__atomic_add_fetch(&numLiveThreads, 1, __ATOMIC_RELAXED);
+
+		// if the errCode is nonzero, then the pthread was not created. print error and exit
+		if(errCode != 0)
+		{
+			printf ("could not pthread_create thread %u. %d\n",
+					 i, errCode);
+			exit(0);
+		}
+	}
+
+	// create the watchdog thread
+	if(watchdogPeriod > 0)
+	{
+		pthread_t watchdog;
+		errCode = pthread_create(&watchdog, NULL, watchdogThread, NULL);
+		if(errCode != 0)
+		{
+			printf ("could not pthread_create watchdog thread. %d\n", errCode);
+			exit(0);
+		}
+	}
+
+	// create the production scheduler thread, which runs all the ink producers, then
+	// start production for the tanks that aren't full
+	pthread_t schedulerThread;
+	errCode = pthread_create(&schedulerThread, NULL, productionSchedulerThread, NULL);
+	if(errCode != 0)
+	{
+		printf ("could not pthread_create production scheduler thread. %d\n", errCode);
+		exit(0);
+	}
+	for(unsigned int c = 0; c < NUM_PRODUCER_TYPES; c++)
+	{
+		if(inkTankLevel((ProducerType) c) < inkLowWater)
+			signalInkDemand((ProducerType) c);
+	}
+
+	// create the control thread, which applies the front end's commands
+	pthread_t control;
+	errCode = pthread_create(&control, NULL, controlThread, NULL);
+	if(errCode != 0)
+	{
+		printf ("could not pthread_create control thread. %d\n", errCode);
+		exit(0);
+	}
+
+	// keep the state that viewers read from the shared segment up to date
+	if(sharedInstance > 0)
+		startSharedStatePublisher();
+	if(metricsInstance > 0)
+		startMetricsServer();
+	if(historyBudget > 0)
+		startHistory();
+	if(exportPeriod > 0)
+		startFrameExport();
+
+	// without a front end, let the simulation run, report, and leave
+	if(headless)
+		runHeadless();
+
+	//	Now we enter the main loop of the program and to a large extend
+	//	"lose control" over its execution.  The callback functions that 
+	//	we set up earlier will be called when the corresponding event
+	//	occurs
+	glutMainLoop();
+	
+	//	Free allocated resource before leaving (not absolutely needed, but
+	//	just nicer.  Also, if you crash there, you know something is wrong
+	//	in your code.
+
+	// close the producers' timers, then give back the arena with everything in it (the
+	// shared segment, with its tiles and the traveler store, is removed at exit)
+	for (unsigned int k=0; k<TOTAL_INK_PRODUCER_THREADS; k++)
+		close(producerList[k].timerFd);
+	close(demandEventFd);
+	releaseArena();
+	
+	//	This will never be executed (the exit point will be in one of the
+	//	call back functions).
+	return 0;
+}
+#endif // GLTHREADS_NO_MAIN
+
+
+/*
+ * Function to initialize the program,
+ *		-Allocating required memory
+ *		-Seeding "random" number generator
+ *		-Initializing mutex locks
+ */
+void initializeApplication(void)
+{
+	grid.numRows = NUM_ROWS;
+	grid.numCols = NUM_COLS;
+	grid.numTileRows = (NUM_ROWS + GRID_TILE_MASK) >> GRID_TILE_SHIFT;
+	grid.numTileCols = (NUM_COLS + GRID_TILE_MASK) >> GRID_TILE_SHIFT;
+	size_t numTiles = (size_t) grid.numTileRows * grid.numTileCols;
+	// one set of counters per traveler thread (and per spawned thread), or per region
+	// worker or wheel thread
+	if (engine == ENGINE_REGIONS)
+		numCounterSlots = regionRows * regionCols;
+	else if (engine == ENGINE_WHEEL)
+		numCounterSlots = wheelThreads;
+	else
+	{
+		numSpawnCounterSlots = SPAWN_COUNTER_SLOTS;
+		numCounterSlots = MAX_NUM_TRAVELER_THREADS + numSpawnCounterSlots;
+	}
+
+	// Reserve the arena that all the arrays below (and the engines') are carved from
+	reserveArena(numTiles * (sizeof(GridTile) + sizeof(TileContention) + sizeof(GridTile*) + sizeof(unsigned int)) +
+				 (size_t) MAX_NUM_TRAVELER_THREADS * ARENA_BYTES_PER_TRAVELER +
+				 (size_t) numCounterSlots * (sizeof(TravelerCounters) + ARENA_BYTES_PER_THREAD) +
+				 (size_t) (NUM_ROWS + NUM_COLS) * sizeof(unsigned int) +
+				 (historyBudget > 0 ? numTiles * HISTORY_BYTES_PER_TILE : 0) + ARENA_SLACK);
+
+	//	Allocate the grid's tile directory.  The tiles themselves are built (black,
+	//	with no square occupied) by the first traveler to touch one of their squares,
+	//	so memory and startup time scale with the area visited, not the area declared.
+	grid.tiles = (GridTile**) arenaAlloc(numTiles, sizeof(GridTile*), "grid tile directory");
+	
+	// Allocate the tiles and the traveler store (in the shared segment, if viewers may attach)
+	if (sharedInstance > 0)
+		createSharedState();
+	else
+	{
+		tileState = (unsigned int*) arenaAlloc(numTiles, sizeof(unsigned int), "grid tile states");
+		tileStorage = (GridTile*) arenaAllocLazy(numTiles, sizeof(GridTile), "grid tiles");
+		grid.contention = (TileContention*) arenaAllocLazy(numTiles, sizeof(TileContention), "contention counters");
+		travelerStore.count = MAX_NUM_TRAVELER_THREADS;
+		travelerStore.position = (unsigned int*) arenaAlloc(MAX_NUM_TRAVELER_THREADS, sizeof(unsigned int), "traveler positions");
+		travelerStore.attributes = (unsigned char*) arenaAlloc(MAX_NUM_TRAVELER_THREADS, 1, "traveler attributes");
+		travelerStore.live = (unsigned long long*) arenaAlloc((MAX_NUM_TRAVELER_THREADS + 63) / 64, sizeof(unsigned long long), "traveler live bits");
+	}
+
+	// Allocate what the watchdog watches, the travelers' lifecycle records, the traveler
+	// free list (initially empty), the per-thread counters and the producers
+	travelerWatch = (TravelerWatch*) arenaAlloc(MAX_NUM_TRAVELER_THREADS, sizeof(TravelerWatch), "traveler watch");
+	initializeLifecycle();
+	freeTravelerNext = (unsigned int*) arenaAlloc(MAX_NUM_TRAVELER_THREADS, sizeof(unsigned int), "traveler free list");
+	travelerCounters = (TravelerCounters*) arenaAlloc(numCounterSlots, sizeof(TravelerCounters), "traveler counters");
+	producerList = (ProducerInfo*) arenaAlloc(TOTAL_INK_PRODUCER_THREADS, sizeof(ProducerInfo), "producer list");
+
+	// Place their pages before initializing them
+	firstTouchArena();
+
+	//	seed the pseudo-random generator
+	srand((unsigned int) time(NULL));
+
+	// Give each traveler a random color, position and direction, and make it live
+	for (unsigned int k=0; k< MAX_NUM_TRAVELER_THREADS; k++)
+	{
+		unsigned int row = (rand() % (NUM_ROWS-1)) + 1;
+		unsigned int col = (rand() % (NUM_COLS-1)) + 1;
+		travelerStore.position[k] = TRAVELER_POSITION(row, col);
+		travelerStore.attributes[k] = TRAVELER_ATTRIBUTES(rand() % NUM_TRAV_TYPES, rand() % NUM_TRAVEL_DIRECTIONS);
+		travelerStore.live[k / 64] |= 1ULL << (k % 64);
+	}
 
 	// Loop through each of the producerInfo structs in the list and initialize the values
 	for(unsigned int k=0; k< TOTAL_INK_PRODUCER_THREADS; k++)
 	{
 		// set the type of the (regardless of number of producers, will either be 0, 1, or 2)
 		producerList[k].type = k%NUM_PRODUCER_TYPES;
+		producerList[k].rank = k/NUM_PRODUCER_TYPES;
+		producerList[k].isArmed = 0;
+		producerList[k].timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+		if (producerList[k].timerFd < 0)
+		{
+			perror("timerfd_create");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	// initialize the locks of the ink tanks (of the kind selected with -lock), and
+	// split the tanks in shards if requested
+	simLockInit(&redInkLock);
+	simLockInit(&greenInkLock);
+	simLockInit(&blueInkLock);
+	if (numInkShards > 1)
+		initializeInkShards();
+
+	// the queue of the front end's commands
+	if (!commandQueueInit(&commandQueue, COMMAND_QUEUE_SIZE))
+	{
+		fprintf(stderr, "Out of memory (command queue)\n");
+		exit(EXIT_FAILURE);
+	}
+
+	// production starts when a tank falls below this level
+	inkLowWater = (unsigned int) (((unsigned long long) MAX_LEVEL * lowWaterPercent) / 100);
+
+	// all colors start at the manual rate; the controller, if any, takes it from there
+	if (inkTarget > 0)
+		producerControl.targetLevel = ((unsigned long long) MAX_LEVEL * inkTarget + 99) / 100;
+	for (unsigned int c=0; c<NUM_PRODUCER_TYPES; c++)
+	{
+		producerControl.sleepTime[c] = producerSleepTime;
+		controlLevel[c] = inkTankLevel((ProducerType) c);
+	}
+	demandEventFd = eventfd(0, EFD_CLOEXEC);
+	if (demandEventFd < 0)
+	{
+		perror("eventfd");
+		exit(EXIT_FAILURE);
 	}
 }
 
@@ -0,0 +1,239 @@
+//
+//  metrics.c
+//  GL threads
+//
+//  Metrics endpoint (see metrics.h).  A single thread accepts the connections and
+//  answers each request with all the metrics; the request itself isn't looked at.
+//
+//  Nathan Larson 2017-05-02
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "simulation.h"
+#include "metrics.h"
+#include "frameExport.h"
+
+
+//-----------------------------------------------------------------------------
+//	Global variables
+//-----------------------------------------------------------------------------
+
+unsigned int metricsInstance = 0;
+
+static const char* const INK_COLOR_NAMES[NUM_PRODUCER_TYPES] = {"red", "green", "blue"};
+
+static struct sockaddr_un metricsAddress;
+static int metricsFd;
+
+// moves and time of the previous scrape, for the moves/s gauge (only used by the server thread)
+static unsigned long long previousMoves = 0;
+static struct timespec previousScrape;
+
+
+//-----------------------------------------------------------------------------
+//	Metrics
+//-----------------------------------------------------------------------------
+
+/*
+ * Write the HELP and TYPE lines of a metric
+ */
+static void describeMetric(FILE* out, const char* name, const char* type, const char* help)
+{
+	fprintf(out, "# HELP glthreads_%s %s\n# TYPE glthreads_%s %s\n", name, help, name, type);
+}
+
+/*
+ * Write all the metrics, in the Prometheus text exposition format
+ */
+static void writeMetrics(FILE* out)
+{
+	TravelerCounters total;
+	sumTravelerCounters(&total);
+	unsigned long long lockWaits = total.lockStats.waits + __atomic_load_n(&producerLockStats.waits, __ATOMIC_RELAXED);
+	unsigned long long lockWaitTime = total.lockStats.waitTime + __atomic_load_n(&producerLockStats.waitTime, __ATOMIC_RELAXED);
+
+	// moves/s since the previous scrape (or since the server started)
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	double interval = (now.tv_sec - previousScrape.tv_sec) + (now.tv_nsec - previousScrape.tv_nsec) * 1e-9;
+	double moveRate = interval > 0 ? (total.moves - previousMoves) / interval : 0.0;
+	previousMoves = total.moves;
+	previousScrape = now;
+
+	describeMetric(out, "live_travelers", "gauge", "Number of live travelers.");
+	fprintf(out, "glthreads_live_travelers %u\n", __atomic_load_n(&numLiveThreads, __ATOMIC_RELAXED));
+	describeMetric(out, "moves_total", "counter", "Squares moved by all travelers.");
+	fprintf(out, "glthreads_moves_total %llu\n", total.moves);
+	describeMetric(out, "moves_per_second", "gauge", "Moves per second since the previous scrape.");
+	fprintf(out, "glthreads_moves_per_second %.1f\n", moveRate);
+	describeMetric(out, "respawns_total", "counter", "Travelers respawned after reaching a corner.");
+	fprintf(out, "glthreads_respawns_total %llu\n", total.respawns);
+
+	describeMetric(out, "ink_level", "gauge", "Ink in each tank.");
+	for (unsigned int c=0; c<NUM_PRODUCER_TYPES; c++)
+		fprintf(out, "glthreads_ink_level{color=\"%s\"} %u\n", INK_COLOR_NAMES[c], inkTankLevel((ProducerType) c));
+	describeMetric(out, "ink_capacity", "gauge", "Capacity of each ink tank.");
+	fprintf(out, "glthreads_ink_capacity %u\n", MAX_LEVEL);
+	describeMetric(out, "ink_acquires_total", "counter", "Ink requests of the travelers, by tank and result.");
+	for (unsigned int c=0; c<NUM_PRODUCER_TYPES; c++)
+	{
+		fprintf(out, "glthreads_ink_acquires_total{color=\"%s\",result=\"success\"} %llu\n", INK_COLOR_NAMES[c], total.inkAcquired[c]);
+		fprintf(out, "glthreads_ink_acquires_total{color=\"%s\",result=\"failure\"} %llu\n", INK_COLOR_NAMES[c], total.inkRefused[c]);
+	}
+	describeMetric(out, "ink_steals_total", "counter", "Ink requests served in part by another core's shard.");
+	fprintf(out, "glthreads_ink_steals_total %llu\n", total.inkSteals);
+	describeMetric(out, "ink_waits_total", "counter", "Travelers stopped mid-move by an empty tank (stream ink mode).");
+	fprintf(out, "glthreads_ink_waits_total %llu\n", total.inkWaits);
+
+	describeMetric(out, "producer_wakeups_total", "counter", "Producer timer expirations.");
+	fprintf(out, "glthreads_producer_wakeups_total %llu\n", __atomic_load_n(&producerWakeups, __ATOMIC_RELAXED));
+	describeMetric(out, "ink_refills_total", "counter", "Refills made by the producers.");
+	fprintf(out, "glthreads_ink_refills_total %llu\n", __atomic_load_n(&inkRefills, __ATOMIC_RELAXED));
+	describeMetric(out, "ink_overflow_total", "counter", "Ink of the refills that didn't fit in the tank.");
+	fprintf(out, "glthreads_ink_overflow_total %llu\n", __atomic_load_n(&inkOverflow, __ATOMIC_RELAXED));
+	describeMetric(out, "producer_sleep_seconds", "gauge", "Time between two refills of one producer, by color.");
+	for (unsigned int c=0; c<NUM_PRODUCER_TYPES; c++)
+		fprintf(out, "glthreads_producer_sleep_seconds{color=\"%s\"} %.6f\n", INK_COLOR_NAMES[c],
+				__atomic_load_n(&producerControl.sleepTime[c], __ATOMIC_RELAXED) * 1e-6);
+	describeMetric(out, "ink_target_level", "gauge", "Tank level held by the rate controller (0: manual rates).");
+	fprintf(out, "glthreads_ink_target_level %u\n", __atomic_load_n(&producerControl.targetLevel, __ATOMIC_RELAXED));
+	describeMetric(out, "ink_consumption_per_second", "gauge", "Ink consumption measured by the rate controller, by color.");
+	for (unsigned int c=0; c<NUM_PRODUCER_TYPES; c++)
+		fprintf(out, "glthreads_ink_consumption_per_second{color=\"%s\"} %u\n", INK_COLOR_NAMES[c],
+				__atomic_load_n(&producerControl.consumption[c], __ATOMIC_RELAXED));
+
+	describeMetric(out, "lock_waits_total", "counter", "Ink tank lock acquisitions that found the lock taken.");
+	fprintf(out, "glthreads_lock_waits_total %llu\n", lockWaits);
+	describeMetric(out, "lock_wait_seconds_total", "counter", "Time spent waiting for the ink tank locks.");
+	fprintf(out, "glthreads_lock_wait_seconds_total %.6f\n", lockWaitTime * 1e-9);
+
+	describeMetric(out, "backoffs_total", "counter", "Failed attempts to claim the next square.");
+	fprintf(out, "glthreads_backoffs_total %llu\n", total.backoffs);
+	describeMetric(out, "reroutes_total", "counter", "Moves abandoned because the next square stayed occupied.");
+	fprintf(out, "glthreads_reroutes_total %llu\n", total.reroutes);
+	describeMetric(out, "head_ons_total", "counter", "Moves shortened because the traveler ahead was coming the other way.");
+	fprintf(out, "glthreads_head_ons_total %llu\n", total.headOns);
+	describeMetric(out, "blocked_seconds_total", "counter", "Time travelers spent waiting for squares.");
+	fprintf(out, "glthreads_blocked_seconds_total %.6f\n", total.blockedTime * 1e-9);
+	describeMetric(out, "watchdog_stalls_total", "counter", "Stalled travelers reported by the watchdog.");
+	fprintf(out, "glthreads_watchdog_stalls_total %llu\n", __atomic_load_n(&watchdogStalls, __ATOMIC_RELAXED));
+	describeMetric(out, "wait_for_cycles_total", "counter", "Wait-for cycles found by the watchdog.");
+	fprintf(out, "glthreads_wait_for_cycles_total %llu\n", __atomic_load_n(&watchdogCycles, __ATOMIC_RELAXED));
+
+	describeMetric(out, "frames_total", "counter", "Frames of the grid pane drawn (0 when headless).");
+	fprintf(out, "glthreads_frames_total %llu\n", __atomic_load_n(&framesRendered, __ATOMIC_RELAXED));
+	describeMetric(out, "render_seconds_total", "counter", "Time spent drawing the grid pane.");
+	fprintf(out, "glthreads_render_seconds_total %.6f\n", __atomic_load_n(&renderTime, __ATOMIC_RELAXED) * 1e-9);
+	describeMetric(out, "frame_seconds", "gauge", "Time taken to draw the last frame of the grid pane.");
+	fprintf(out, "glthreads_frame_seconds %.6f\n", __atomic_load_n(&lastFrameTime, __ATOMIC_RELAXED) * 1e-9);
+	describeMetric(out, "frames_exported_total", "counter", "Frames written by the frame export.");
+	fprintf(out, "glthreads_frames_exported_total %llu\n", __atomic_load_n(&framesExported, __ATOMIC_RELAXED));
+	describeMetric(out, "frames_dropped_total", "counter", "Frames the frame export dropped because no buffer was free or the write failed.");
+	fprintf(out, "glthreads_frames_dropped_total %llu\n", __atomic_load_n(&framesDropped, __ATOMIC_RELAXED));
+}
+
+
+//-----------------------------------------------------------------------------
+//	Server
+//-----------------------------------------------------------------------------
+
+/*
+ * Answer one scrape: read the request (whatever it is), and reply with the metrics
+ */
+static void serveScrape(int fd)
+{
+	// don't let a client that never sends its request hold up the server
+	struct timeval timeout = {1, 0};
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	char request[1024];
+	if (recv(fd, request, sizeof(request), 0) < 0)
+		return;
+
+	char* body = NULL;
+	size_t bodySize = 0;
+	FILE* out = open_memstream(&body, &bodySize);
+	if (out == NULL)
+		return;
+	writeMetrics(out);
+	fclose(out);
+
+	char head[256];
+	int headSize = snprintf(head, sizeof(head), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+							"Content-Length: %zu\r\nConnection: close\r\n\r\n", bodySize);
+	if (send(fd, head, (size_t) headSize, MSG_NOSIGNAL) == headSize)
+	{
+		for (size_t sent = 0; sent < bodySize; )
+		{
+			ssize_t n = send(fd, body + sent, bodySize - sent, MSG_NOSIGNAL);
+			if (n <= 0)
+				break;
+			sent += (size_t) n;
+		}
+	}
+	free(body);
+}
+
+static void* metricsServerThread(void* arg)
+{
+	while (1)
+	{
+		int fd = accept(metricsFd, NULL, NULL);
+		if (fd < 0)
+			continue;
+		serveScrape(fd);
+		close(fd);
+	}
+	return NULL;
+}
+
+static void removeMetricsSocket(void)
+{
+	unlink(metricsAddress.sun_path);
+}
+
+void startMetricsServer(void)
+{
+	metricsAddress.sun_family = AF_UNIX;
+	snprintf(metricsAddress.sun_path, sizeof(metricsAddress.sun_path), METRICS_SOCKET_FORMAT, metricsInstance);
+
+	// replace the socket of a previous run, unless that run is still answering on it
+	int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (probe >= 0 && connect(probe, (struct sockaddr*) &metricsAddress, sizeof(metricsAddress)) == 0)
+	{
+		fprintf(stderr, "Metrics socket %s is in use\n", metricsAddress.sun_path);
+		exit(EXIT_FAILURE);
+	}
+	close(probe);
+	unlink(metricsAddress.sun_path);
+
+	metricsFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (metricsFd < 0)
+	{
+		perror("socket");
+		exit(EXIT_FAILURE);
+	}
+	if (bind(metricsFd, (struct sockaddr*) &metricsAddress, sizeof(metricsAddress)) != 0 || listen(metricsFd, 16) != 0)
+	{
+		perror(metricsAddress.sun_path);
+		exit(EXIT_FAILURE);
+	}
+	atexit(removeMetricsSocket);
+	clock_gettime(CLOCK_MONOTONIC, &previousScrape);
+
+	pthread_t server;
+	int errCode = pthread_create(&server, NULL, metricsServerThread, NULL);
+	if (errCode != 0)
+	{
+		printf("could not pthread_create metrics server thread. %d\n", errCode);
+		exit(0);
+	}
+	printf("Metrics on %s\n", metricsAddress.sun_path);
+}
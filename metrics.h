@@ -0,0 +1,26 @@
+//
+//  metrics.h
+//  GL threads
+//
+//  Metrics endpoint for operators of headless runs: with -metrics N, the simulation
+//  serves its counters and gauges in the Prometheus text format, over HTTP on the Unix
+//  domain socket /tmp/glthreads.N.metrics, e.g.
+//      curl --unix-socket /tmp/glthreads.1.metrics http://localhost/metrics
+//  The values are added up from the per-thread counters when they are scraped, so the
+//  travelers never write to a shared cache line for the sake of the metrics.
+//
+//  Nathan Larson 2017-05-02
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#define METRICS_SOCKET_FORMAT	"/tmp/glthreads.%u.metrics"
+
+// instance number of the socket (0: no metrics endpoint)
+extern unsigned int metricsInstance;
+
+// Create the socket and start the thread that answers the scrapes.  The socket is
+// removed when the process exits.
+void startMetricsServer(void);
+
+#endif // METRICS_H
@@ -0,0 +1,655 @@
+//
+//  microbench.c
+//  GL threads
+//
+//  Microbenchmarks of the simulation's hot functions, to see which function a change of
+//  data layout or lock speeds up or slows down (benchmark.sh measures whole runs).
+//  Each benchmark is repeated -warmup times untimed, then -reps times, and reported
+//  as the median, mean, standard deviation (relative to the mean), min and max of its
+//  time per operation:
+//		- ink.take+topUp/Nt: takeInk() then topUpInk() of one unit on the same tank, by N
+//		  threads at once (time per pair, as seen by each thread)
+//		- move.hotRow/Nt: moveTraveler() by N travelers following each other along a
+//		  row, so that each square is handed from a traveler to the next (time per move)
+//		- grid.init/S: building the tiles of an S x S grid (time per grid)
+//		- draw.snapshot/S, draw.rasterize/S: the software path of the grid pane (see
+//		  raster.h) on an S x S grid with inked squares and travelers (time per frame)
+//
+//  Each run has an identifier (-runId, by default the host name and the time of the
+//  run).  -save appends the run's results, tagged with it, to a file, and -baseline
+//  compares the run with one saved in such a file (-baselineRun, by default the last
+//  one): a median more than -tolerance percent slower than the baseline's is reported
+//  as a regression, and makes the exit status 1.  The simulation's own options
+//  (-lock, -inkShards, -inkMode...) are accepted too.
+//
+//  It is built from the simulation's sources (see README.md), with -DGLTHREADS_NO_MAIN
+//  to leave out the simulation's main().
+//  Usage: ./microbench [-reps N] [-only ink|move|grid|draw] [-save FILE] [-baseline FILE] ...
+//
+//  Nathan Larson 2017-05-02
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "gl_frontEnd.h"
+#include "simulation.h"
+#include "lock.h"
+#include "sharedState.h"
+#include "history.h"
+#include "raster.h"
+
+#define MAX_RESULTS			64
+#define MAX_SIZES			8
+#define NAME_SIZE			48
+#define RUN_ID_SIZE			64
+// row of the hot-row benchmark
+#define HOT_ROW				1
+
+// Statistics of a benchmark's repetitions, in nanoseconds per operation
+typedef struct BenchResult {
+								char name[NAME_SIZE];
+								unsigned long long ops;			// operations per repetition
+								unsigned int samples;
+								double median, mean, stddev, min, max;
+} BenchResult;
+
+// One repetition of a benchmark: returns the time it took, in nanoseconds, and sets *ops
+// to the number of operations it timed.  Its setup isn't timed.
+typedef unsigned long long (*BenchFunction)(unsigned int param, unsigned long long* ops);
+
+//==================================================================================
+//	Function prototypes
+//==================================================================================
+void parseArguments(int argc, char** argv);
+void loadBaseline(const char* path, const char* runId);
+void saveResults(const char* path);
+void measure(const char* name, BenchFunction function, unsigned int param);
+unsigned long long runThreads(unsigned int count, void (*body)(unsigned int));
+unsigned long long inkBench(unsigned int numThreads, unsigned long long* ops);
+unsigned long long hotRowBench(unsigned int numThreads, unsigned long long* ops);
+unsigned long long gridInitBench(unsigned int size, unsigned long long* ops);
+unsigned long long snapshotBench(unsigned int size, unsigned long long* ops);
+unsigned long long rasterizeBench(unsigned int size, unsigned long long* ops);
+void setDrawSize(unsigned int size);
+
+//==================================================================================
+//	Global variables
+//==================================================================================
+
+// repetitions (untimed, then timed), largest number of contending threads, grid sizes,
+// and the work of one repetition of the ink and hot-row benchmarks
+unsigned int warmupReps = 3, timedReps = 15;
+unsigned int maxThreads = 0;				// 0: the number of cores, 4 at least
+unsigned int drawSizes[MAX_SIZES] = {64, 512, 2048};
+unsigned int numDrawSizes = 3;
+unsigned int inkOps = 100000;				// pairs per thread
+unsigned int hotRowLength = 256;			// moves per traveler
+// only run the benchmarks whose name starts with this
+const char* onlyPrefix = "";
+
+// the run, its results, and the baseline they are compared with
+char runId[RUN_ID_SIZE];
+const char* savePath = NULL;
+const char* baselinePath = NULL;
+const char* baselineRun = NULL;
+char baselineId[RUN_ID_SIZE];
+unsigned int tolerance = 10;				// percent
+BenchResult results[MAX_RESULTS], baseline[MAX_RESULTS];
+unsigned int numResults = 0, numBaseline = 0, numRegressions = 0;
+
+// the threads of a repetition wait on this until they are all started, then run the
+// body, and record when they started and ended it
+pthread_barrier_t startBarrier;
+void (*threadBody)(unsigned int index);
+unsigned long long* threadStart;
+unsigned long long* threadEnd;
+
+// the hot row's travelers, one per thread, starting one after the other on row 1
+TravelerInfo* hotRowTravelers;
+
+// build states of the tiles of the private grid (main.c, see touchTile)
+extern unsigned int* tileState;
+
+// the frame the draw benchmarks work on
+FrameSnapshot snapshot;
+unsigned char* framePixels;
+
+
+//------------------------------------------------------------------------
+//	Measurement and reporting
+//------------------------------------------------------------------------
+//
+
+static unsigned long long nanoseconds(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static int compareDoubles(const void* a, const void* b)
+{
+	double x = *(const double*) a, y = *(const double*) b;
+	return (x > y) - (x < y);
+}
+
+/*
+ * Run a benchmark: warm it up, time its repetitions, print their statistics (compared
+ * with the baseline's, if any) and keep them for -save
+ */
+void measure(const char* name, BenchFunction function, unsigned int param)
+{
+	if (strncmp(name, onlyPrefix, strlen(onlyPrefix)) != 0 || numResults == MAX_RESULTS)
+		return;
+
+	unsigned long long ops = 1;
+	for (unsigned int k=0; k<warmupReps; k++)
+		function(param, &ops);
+
+	double* sample = (double*) checkedMalloc(timedReps, sizeof(double), "samples");
+	BenchResult* result = &results[numResults++];
+	snprintf(result->name, NAME_SIZE, "%s", name);
+	result->samples = timedReps;
+	result->mean = 0.;
+	for (unsigned int k=0; k<timedReps; k++)
+	{
+		unsigned long long elapsed = function(param, &ops);
+		sample[k] = (double) elapsed / (ops > 0 ? ops : 1);
+		result->mean += sample[k] / timedReps;
+	}
+	result->ops = ops;
+	qsort(sample, timedReps, sizeof(double), compareDoubles);
+	result->median = (timedReps % 2) ? sample[timedReps/2] : (sample[timedReps/2 - 1] + sample[timedReps/2]) / 2;
+	result->min = sample[0];
+	result->max = sample[timedReps - 1];
+	double variance = 0.;
+	for (unsigned int k=0; k<timedReps; k++)
+		variance += (sample[k] - result->mean) * (sample[k] - result->mean);
+	result->stddev = timedReps > 1 ? sqrt(variance / (timedReps - 1)) : 0.;
+	free(sample);
+
+	printf("%-22s %9llu %12.1f %12.1f %6.1f%% %12.1f %12.1f", result->name, result->ops, result->median,
+			result->mean, result->mean > 0. ? 100. * result->stddev / result->mean : 0., result->min, result->max);
+
+	// compare the medians
+	for (unsigned int b=0; b<numBaseline; b++)
+	{
+		if (strcmp(baseline[b].name, name) != 0)
+			continue;
+		double change = 100. * (result->median - baseline[b].median) / baseline[b].median;
+		const char* verdict = "";
+		if (change > tolerance)
+		{
+			verdict = "  REGRESSION";
+			numRegressions++;
+		}
+		else if (change < -(double) tolerance)
+			verdict = "  faster";
+		printf(" %12.1f %+7.1f%%%s", baseline[b].median, change, verdict);
+		break;
+	}
+	printf("\n");
+	fflush(stdout);
+}
+
+/*
+ * Read the results of run runId (or of the last run, if runId is NULL) from a file written
+ * with -save
+ */
+void loadBaseline(const char* path, const char* runId)
+{
+	FILE* fp = fopen(path, "r");
+	if (fp == NULL)
+	{
+		fprintf(stderr, "Could not open baseline file %s\n", path);
+		exit(EXIT_FAILURE);
+	}
+
+	char line[512], id[RUN_ID_SIZE];
+	BenchResult entry;
+	while (fgets(line, sizeof(line), fp) != NULL)
+	{
+		if (line[0] == '#' || sscanf(line, "%63s %47s %llu %u %lf %lf %lf %lf %lf", id, entry.name, &entry.ops,
+									 &entry.samples, &entry.median, &entry.mean, &entry.stddev, &entry.min, &entry.max) != 9)
+			continue;
+		if (runId != NULL && strcmp(id, runId) != 0)
+			continue;
+
+		// the lines of a run are contiguous: a new identifier starts a new run
+		if (strcmp(id, baselineId) != 0)
+		{
+			snprintf(baselineId, RUN_ID_SIZE, "%s", id);
+			numBaseline = 0;
+		}
+		if (numBaseline < MAX_RESULTS)
+			baseline[numBaseline++] = entry;
+	}
+	fclose(fp);
+
+	if (numBaseline == 0)
+	{
+		fprintf(stderr, "No results%s%s in baseline file %s\n", runId != NULL ? " for run " : "",
+				runId != NULL ? runId : "", path);
+		exit(EXIT_FAILURE);
+	}
+}
+
+/*
+ * Append the results of this run to a file, one line per benchmark, tagged with the run's
+ * identifier
+ */
+void saveResults(const char* path)
+{
+	FILE* fp = fopen(path, "a");
+	if (fp == NULL)
+	{
+		fprintf(stderr, "Could not open %s\n", path);
+		exit(EXIT_FAILURE);
+	}
+	fprintf(fp, "# run name ops samples median mean stddev min max (ns per op), %u warm-up repetitions\n", warmupReps);
+	for (unsigned int k=0; k<numResults; k++)
+		fprintf(fp, "%s %s %llu %u %.2f %.2f %.2f %.2f %.2f\n", runId, results[k].name, results[k].ops,
+				results[k].samples, results[k].median, results[k].mean, results[k].stddev, results[k].min, results[k].max);
+	fclose(fp);
+}
+
+/*
+ * Thread of runThreads(): wait for the others, then time the body
+ */
+static void* benchThread(void* arg)
+{
+	unsigned int index = (unsigned int) (uintptr_t) arg;
+	bindThreadCounters(&travelerCounters[index]);
+	pthread_barrier_wait(&startBarrier);
+	threadStart[index] = nanoseconds();
+	threadBody(index);
+	threadEnd[index] = nanoseconds();
+	return NULL;
+}
+
+/*
+ * Run body on count threads (bound to the first count traveler counters), which all
+ * start together.  Returns the time from the first start to the last end: each thread
+ * times itself, since with fewer cores than threads the caller may only run again once
+ * they are done.
+ */
+unsigned long long runThreads(unsigned int count, void (*body)(unsigned int))
+{
+	pthread_t thread[count];
+	threadBody = body;
+	pthread_barrier_init(&startBarrier, NULL, count + 1);
+	for (unsigned int k=0; k<count; k++)
+	{
+		int errCode = pthread_create(&thread[k], NULL, benchThread, (void*) (uintptr_t) k);
+		if (errCode != 0)
+		{
+			printf("could not pthread_create benchmark thread %u. %d\n", k, errCode);
+			exit(0);
+		}
+	}
+
+	pthread_barrier_wait(&startBarrier);
+	for (unsigned int k=0; k<count; k++)
+		pthread_join(thread[k], NULL);
+	pthread_barrier_destroy(&startBarrier);
+
+	unsigned long long start = threadStart[0], end = threadEnd[0];
+	for (unsigned int k=1; k<count; k++)
+	{
+		start = threadStart[k] < start ? threadStart[k] : start;
+		end = threadEnd[k] > end ? threadEnd[k] : end;
+	}
+	return end - start;
+}
+
+
+//------------------------------------------------------------------------
+//	Ink tanks: every thread takes a unit of red ink and puts it back, so
+//	the tank never runs dry or overflows.
+//------------------------------------------------------------------------
+//
+
+static void inkThread(unsigned int index)
+{
+	for (unsigned int k=0; k<inkOps; k++)
+	{
+		takeInk(RED_TRAV, 1);
+		topUpInk(RED_INK, 1, NULL);
+	}
+}
+
+unsigned long long inkBench(unsigned int numThreads, unsigned long long* ops)
+{
+	*ops = inkOps;
+	return runThreads(numThreads, inkThread);
+}
+
+
+//------------------------------------------------------------------------
+//	Hot row: the travelers start on consecutive squares of a row and all
+//	move east, so each one keeps claiming the square the one ahead of it
+//	just released (backing off while it is still held).
+//------------------------------------------------------------------------
+//
+
+static void hotRowThread(unsigned int index)
+{
+	TravelerInfo* info = &hotRowTravelers[index];
+	for (unsigned int k=0; k<hotRowLength; )
+	{
+		// blocked for longer than backoffLimit: try again
+		if (moveTraveler(info))
+			k++;
+	}
+}
+
+unsigned long long hotRowBench(unsigned int numThreads, unsigned long long* ops)
+{
+	for (unsigned int k=0; k<numThreads; k++)
+	{
+		TravelerInfo* info = &hotRowTravelers[k];
+		info->index = k;
+		info->row = HOT_ROW;
+		info->col = 1 + k;
+		info->type = (TravelerType) (k % NUM_TRAV_TYPES);
+		info->dir = EAST;
+		info->isLive = 1;
+		claimSquare(info->row, info->col, info->index);
+	}
+
+	*ops = (unsigned long long) numThreads * hotRowLength;
+	unsigned long long elapsed = runThreads(numThreads, hotRowThread);
+
+	for (unsigned int k=0; k<numThreads; k++)
+		releaseSquare(hotRowTravelers[k].row, hotRowTravelers[k].col);
+	return elapsed;
+}
+
+
+//------------------------------------------------------------------------
+//	Grid initialization: the tiles of the S x S corner of the grid are
+//	put back in their unbuilt state, then touched.  After the warm-up their
+//	pages are mapped, so this times building the tiles, not faulting them in.
+//------------------------------------------------------------------------
+//
+
+unsigned long long gridInitBench(unsigned int size, unsigned long long* ops)
+{
+	unsigned int numTileRows = (size + GRID_TILE_MASK) >> GRID_TILE_SHIFT;
+	unsigned int numTileCols = (size + GRID_TILE_MASK) >> GRID_TILE_SHIFT;
+	for (unsigned int tr=0; tr<numTileRows; tr++)
+	{
+		for (unsigned int tc=0; tc<numTileCols; tc++)
+		{
+			size_t t = (size_t) tr * grid.numTileCols + tc;
+			grid.tiles[t] = NULL;
+			tileState[t] = SHARED_TILE_EMPTY;
+		}
+	}
+
+	*ops = 1;
+	unsigned long long start = nanoseconds();
+	for (unsigned int tr=0; tr<numTileRows; tr++)
+	{
+		for (unsigned int tc=0; tc<numTileCols; tc++)
+			touchTile(tr << GRID_TILE_SHIFT, tc << GRID_TILE_SHIFT);
+	}
+	return nanoseconds() - start;
+}
+
+
+//------------------------------------------------------------------------
+//	Drawing: the grid is shrunk to its S x S corner (the tile directory
+//	stays the same), with all the travelers inside it.
+//------------------------------------------------------------------------
+//
+
+void setDrawSize(unsigned int size)
+{
+	grid.numRows = size;
+	grid.numCols = size;
+	for (unsigned int k=0; k<MAX_NUM_TRAVELER_THREADS; k++)
+		travelerStore.position[k] = TRAVELER_POSITION(rand() % size, rand() % size);
+	takeSnapshot(&snapshot);
+}
+
+unsigned long long snapshotBench(unsigned int size, unsigned long long* ops)
+{
+	*ops = 1;
+	unsigned long long start = nanoseconds();
+	takeSnapshot(&snapshot);
+	return nanoseconds() - start;
+}
+
+unsigned long long rasterizeBench(unsigned int size, unsigned long long* ops)
+{
+	*ops = 1;
+	unsigned long long start = nanoseconds();
+	rasterizeFrame(&snapshot, framePixels);
+	return nanoseconds() - start;
+}
+
+
+//------------------------------------------------------------------------
+//	Command line
+//------------------------------------------------------------------------
+//
+
+static void printMicrobenchUsage(const char* progName)
+{
+	printf("Usage: %s [-<option> <value> ...]\n", progName);
+	printf("  -reps         timed repetitions of each benchmark (default %u)\n", timedReps);
+	printf("  -warmup       untimed repetitions before them (default %u)\n", warmupReps);
+	printf("  -threads      largest number of contending threads (default: the number of cores, 4 at least)\n");
+	printf("  -sizes        grid sizes of the grid and draw benchmarks, comma-separated (default 64,512,2048)\n");
+	printf("  -inkOps       take/top-up pairs per thread and repetition (default %u)\n", inkOps);
+	printf("  -hotRow       moves per traveler and repetition on the hot row (default %u)\n", hotRowLength);
+	printf("  -only         only run the benchmarks whose name starts with this (ink, move, grid, draw...)\n");
+	printf("  -runId        identifier of the run, without spaces (default: host name and time)\n");
+	printf("  -save         append the results to this file\n");
+	printf("  -baseline     compare with the results saved in this file\n");
+	printf("  -baselineRun  identifier of the run to compare with (default: the last one in the file)\n");
+	printf("  -tolerance    slowdown of a median, in percent, reported as a regression (default %u)\n", tolerance);
+	printf("and the simulation's options (see ./travel -help), e.g. -lock, -inkShards, -inkMode, -backoffLimit\n");
+}
+
+static unsigned int parseCount(const char* name, const char* valueStr, unsigned int minValue)
+{
+	char* end;
+	unsigned long value = strtoul(valueStr, &end, 10);
+	if (end == valueStr || *end != '\0' || valueStr[0] == '-' || value < minValue || value > 1000000000UL)
+	{
+		fprintf(stderr, "Invalid value \"%s\" for %s\n", valueStr, name);
+		exit(EXIT_FAILURE);
+	}
+	return (unsigned int) value;
+}
+
+/*
+ * Process the command line: the microbenchmarks' options, then the simulation's
+ */
+void parseArguments(int argc, char** argv)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-help") == 0 || strcmp(argv[i], "--help") == 0)
+		{
+			printMicrobenchUsage(argv[0]);
+			exit(0);
+		}
+		else if (argv[i][0] != '-' || i + 1 >= argc)
+		{
+			fprintf(stderr, "Unexpected argument \"%s\"\n", argv[i]);
+			printMicrobenchUsage(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+
+		const char* name = argv[i] + 1;
+		const char* value = argv[++i];
+		if (strcmp(name, "reps") == 0)
+			timedReps = parseCount(name, value, 1);
+		else if (strcmp(name, "warmup") == 0)
+			warmupReps = parseCount(name, value, 0);
+		else if (strcmp(name, "threads") == 0)
+			maxThreads = parseCount(name, value, 1);
+		else if (strcmp(name, "inkOps") == 0)
+			inkOps = parseCount(name, value, 1);
+		else if (strcmp(name, "hotRow") == 0)
+			hotRowLength = parseCount(name, value, 1);
+		else if (strcmp(name, "only") == 0)
+			onlyPrefix = value;
+		else if (strcmp(name, "save") == 0)
+			savePath = value;
+		else if (strcmp(name, "baseline") == 0)
+			baselinePath = value;
+		else if (strcmp(name, "baselineRun") == 0)
+			baselineRun = value;
+		else if (strcmp(name, "tolerance") == 0)
+			tolerance = parseCount(name, value, 0);
+		else if (strcmp(name, "runId") == 0)
+		{
+			if (value[0] == '\0' || strlen(value) >= RUN_ID_SIZE || strpbrk(value, " \t\n") != NULL)
+			{
+				fprintf(stderr, "Invalid run identifier \"%s\"\n", value);
+				exit(EXIT_FAILURE);
+			}
+			snprintf(runId, RUN_ID_SIZE, "%s", value);
+		}
+		else if (strcmp(name, "sizes") == 0)
+		{
+			char list[256];
+			snprintf(list, sizeof(list), "%s", value);
+			numDrawSizes = 0;
+			for (char* size = strtok(list, ","); size != NULL; size = strtok(NULL, ","))
+			{
+				if (numDrawSizes == MAX_SIZES)
+				{
+					fprintf(stderr, "At most %u sizes\n", MAX_SIZES);
+					exit(EXIT_FAILURE);
+				}
+				drawSizes[numDrawSizes++] = parseCount(name, size, 16);
+			}
+			if (numDrawSizes == 0)
+			{
+				fprintf(stderr, "Invalid value \"%s\" for %s\n", value, name);
+				exit(EXIT_FAILURE);
+			}
+		}
+		else if (!setConfigOption(name, value))
+			exit(EXIT_FAILURE);
+	}
+}
+
+
+/*
+ * Main function
+ */
+int main(int argc, char** argv)
+{
+	// defaults for the simulation: no history, a full tank, and travelers that wait for
+	// the square ahead of them rather than give up their move
+	historyBudget = 0;
+	MAX_LEVEL = 1000000;
+	MAX_NUM_TRAVELER_THREADS = 256;
+	setConfigOption("backoffLimit", "1000000");
+	parseArguments(argc, argv);
+
+	if (maxThreads == 0)
+	{
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		maxThreads = cpus > 4 ? (unsigned int) cpus : 4;
+	}
+	if (runId[0] == '\0')
+	{
+		char host[32] = "host";
+		gethostname(host, sizeof(host));
+		host[sizeof(host) - 1] = '\0';
+		time_t now = time(NULL);
+		char date[32];
+		strftime(date, sizeof(date), "%Y%m%d-%H%M%S", localtime(&now));
+		snprintf(runId, RUN_ID_SIZE, "%s-%s", host, date);
+	}
+	if (baselinePath != NULL)
+		loadBaseline(baselinePath, baselineRun);
+
+	// a grid large enough for the largest size and the hot row, with a counter slot per thread;
+	// nothing is shared with viewers, and only the benchmarks' threads run
+	unsigned int largest = 0;
+	for (unsigned int s=0; s<numDrawSizes; s++)
+		largest = drawSizes[s] > largest ? drawSizes[s] : largest;
+	NUM_ROWS = largest;
+	NUM_COLS = largest > maxThreads + hotRowLength + 2 ? largest : maxThreads + hotRowLength + 2;
+	if (MAX_NUM_TRAVELER_THREADS < maxThreads)
+		MAX_NUM_TRAVELER_THREADS = maxThreads;
+	sharedInstance = 0;
+	validateConfiguration();
+	initializeApplication();
+	srand(1);
+
+	// half-fill the red tank, so that the ink benchmark never empties or overfills it
+	unsigned int level = inkTankLevel(RED_INK);
+	if (level < MAX_LEVEL / 2)
+		topUpInk(RED_INK, MAX_LEVEL / 2 - level, NULL);
+	hotRowTravelers = (TravelerInfo*) checkedMalloc(maxThreads, sizeof(TravelerInfo), "hot row travelers");
+	threadStart = (unsigned long long*) checkedMalloc(maxThreads, sizeof(unsigned long long), "thread start times");
+	threadEnd = (unsigned long long*) checkedMalloc(maxThreads, sizeof(unsigned long long), "thread end times");
+	allocateSnapshot(&snapshot, MAX_NUM_TRAVELER_THREADS);
+	framePixels = (unsigned char*) checkedMalloc((size_t) rasterWidth() * rasterHeight(), 3, "framebuffer");
+
+	printf("run %s: %u repetitions after %u warm-up, lock %s, ink shards %u, ink mode %s, %u cores\n", runId,
+			timedReps, warmupReps, LOCK_NAMES[lockKind], numInkShards, INK_MODE_NAMES[inkMode],
+			(unsigned int) sysconf(_SC_NPROCESSORS_ONLN));
+	if (numBaseline > 0)
+		printf("baseline %s (%s), tolerance %u%%\n", baselineId, baselinePath, tolerance);
+	printf("%-22s %9s %12s %12s %7s %12s %12s%s\n", "benchmark", "ops", "median ns", "mean ns", "stddev", "min ns",
+			"max ns", numBaseline > 0 ? "  baseline ns   change" : "");
+
+	char name[NAME_SIZE];
+	for (unsigned int n=1; n<=maxThreads; n = (n < maxThreads && 2*n > maxThreads) ? maxThreads : 2*n)
+	{
+		snprintf(name, NAME_SIZE, "ink.take+topUp/%ut", n);
+		measure(name, inkBench, n);
+	}
+	for (unsigned int n=1; n<=maxThreads; n = (n < maxThreads && 2*n > maxThreads) ? maxThreads : 2*n)
+	{
+		snprintf(name, NAME_SIZE, "move.hotRow/%ut", n);
+		measure(name, hotRowBench, n);
+	}
+	for (unsigned int s=0; s<numDrawSizes; s++)
+	{
+		snprintf(name, NAME_SIZE, "grid.init/%u", drawSizes[s]);
+		measure(name, gridInitBench, drawSizes[s]);
+	}
+
+	// ink every square of the grid for the draw benchmarks (unless -only leaves them out)
+	if (strncmp("draw", onlyPrefix, strlen(onlyPrefix)) == 0 || strncmp(onlyPrefix, "draw", 4) == 0)
+	{
+		for (unsigned int row=0; row<NUM_ROWS; row++)
+			for (unsigned int col=0; col<largest; col++)
+				depositInk(row, col, (TravelerType) (rand() % NUM_TRAV_TYPES), 32 + rand() % 192);
+		for (unsigned int s=0; s<numDrawSizes; s++)
+		{
+			setDrawSize(drawSizes[s]);
+			snprintf(name, NAME_SIZE, "draw.snapshot/%u", drawSizes[s]);
+			measure(name, snapshotBench, drawSizes[s]);
+			snprintf(name, NAME_SIZE, "draw.rasterize/%u", drawSizes[s]);
+			measure(name, rasterizeBench, drawSizes[s]);
+		}
+	}
+
+	if (savePath != NULL)
+		saveResults(savePath);
+	if (numRegressions > 0)
+		printf("%u regression%s against baseline %s\n", numRegressions, numRegressions > 1 ? "s" : "", baselineId);
+
+	// leave without the simulation's end-of-run summaries (registered with atexit)
+	fflush(stdout);
+	_exit(numRegressions > 0 ? 1 : 0);
+}
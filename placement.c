@@ -0,0 +1,211 @@
+//
+//  placement.c
+//  GL threads
+//
+//  Placement of the simulation threads on the cores (see placement.h).
+//  The topology is read from /sys; where it isn't available, every CPU is
+//  taken as a core of its own in a single package.
+//
+//  Nathan Larson 2017-05-02
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "simulation.h"
+#include "placement.h"
+
+
+//-----------------------------------------------------------------------------
+//	Data types
+//-----------------------------------------------------------------------------
+
+typedef struct CpuInfo {
+								int cpu;
+								int package;
+								int core;
+								// rank of the core within its package, and of the CPU among its SMT siblings
+								unsigned int coreRank;
+								unsigned int smtRank;
+} CpuInfo;
+
+
+//-----------------------------------------------------------------------------
+//	Global variables
+//-----------------------------------------------------------------------------
+
+const char* const PLACEMENT_NAMES[] = {"none", "compact", "scatter", "region", NULL};
+unsigned int placementPolicy = PLACE_NONE;
+
+unsigned int numPlacementCpus = 0, numPlacementPackages = 0;
+unsigned int numPinnedThreads = 0;
+
+// the CPUs in the order threads are placed on them
+static CpuInfo* cpuOrder;
+
+
+//-----------------------------------------------------------------------------
+//	Function prototypes
+//-----------------------------------------------------------------------------
+
+static int readTopologyValue(int cpu, const char* name, int defaultValue);
+static int compareTopology(const void* a, const void* b);
+static int compareCompact(const void* a, const void* b);
+static int compareScatter(const void* a, const void* b);
+
+
+/*
+ * Read one of the /sys/devices/system/cpu/cpuN/topology values of a CPU
+ */
+static int readTopologyValue(int cpu, const char* name, int defaultValue)
+{
+	char path[128];
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, name);
+	FILE* file = fopen(path, "r");
+	if (file == NULL)
+		return defaultValue;
+	int value;
+	if (fscanf(file, "%d", &value) != 1)
+		value = defaultValue;
+	fclose(file);
+	return value;
+}
+
+/*
+ * Topology order: by package, then core, then CPU
+ */
+static int compareTopology(const void* a, const void* b)
+{
+	const CpuInfo* x = (const CpuInfo*) a;
+	const CpuInfo* y = (const CpuInfo*) b;
+	if (x->package != y->package)
+		return x->package < y->package ? -1 : 1;
+	if (x->core != y->core)
+		return x->core < y->core ? -1 : 1;
+	return x->cpu < y->cpu ? -1 : (x->cpu > y->cpu);
+}
+
+/*
+ * Compact order: by package, then the first SMT sibling of each core, then the second, etc.
+ */
+static int compareCompact(const void* a, const void* b)
+{
+	const CpuInfo* x = (const CpuInfo*) a;
+	const CpuInfo* y = (const CpuInfo*) b;
+	if (x->package != y->package)
+		return x->package < y->package ? -1 : 1;
+	if (x->smtRank != y->smtRank)
+		return x->smtRank < y->smtRank ? -1 : 1;
+	return x->coreRank < y->coreRank ? -1 : (x->coreRank > y->coreRank);
+}
+
+/*
+ * Scatter order: first SMT sibling of the first core of each package, then of the
+ * second core of each package, etc.
+ */
+static int compareScatter(const void* a, const void* b)
+{
+	const CpuInfo* x = (const CpuInfo*) a;
+	const CpuInfo* y = (const CpuInfo*) b;
+	if (x->smtRank != y->smtRank)
+		return x->smtRank < y->smtRank ? -1 : 1;
+	if (x->coreRank != y->coreRank)
+		return x->coreRank < y->coreRank ? -1 : 1;
+	return x->package < y->package ? -1 : (x->package > y->package);
+}
+
+/*
+ * Read the CPUs available to the process and their topology, and order them for the policy
+ */
+void initializePlacement(void)
+{
+	cpu_set_t available;
+	CPU_ZERO(&available);
+	if (sched_getaffinity(0, sizeof(available), &available) != 0)
+	{
+		perror("sched_getaffinity");
+		placementPolicy = PLACE_NONE;
+		return;
+	}
+
+	numPlacementCpus = (unsigned int) CPU_COUNT(&available);
+	cpuOrder = (CpuInfo*) checkedMalloc(numPlacementCpus, sizeof(CpuInfo), "CPU list");
+	unsigned int n = 0;
+	for (int cpu=0; cpu<CPU_SETSIZE && n<numPlacementCpus; cpu++)
+	{
+		if (!CPU_ISSET(cpu, &available))
+			continue;
+		cpuOrder[n].cpu = cpu;
+		cpuOrder[n].package = readTopologyValue(cpu, "physical_package_id", 0);
+		cpuOrder[n].core = readTopologyValue(cpu, "core_id", cpu);
+		n++;
+	}
+	numPlacementCpus = n;
+
+	// rank the cores within their package, and the CPUs among their siblings
+	qsort(cpuOrder, n, sizeof(CpuInfo), compareTopology);
+	numPlacementPackages = 0;
+	for (unsigned int k=0; k<n; k++)
+	{
+		if (k == 0 || cpuOrder[k].package != cpuOrder[k-1].package)
+		{
+			numPlacementPackages++;
+			cpuOrder[k].coreRank = 0;
+			cpuOrder[k].smtRank = 0;
+		}
+		else if (cpuOrder[k].core != cpuOrder[k-1].core)
+		{
+			cpuOrder[k].coreRank = cpuOrder[k-1].coreRank + 1;
+			cpuOrder[k].smtRank = 0;
+		}
+		else
+		{
+			cpuOrder[k].coreRank = cpuOrder[k-1].coreRank;
+			cpuOrder[k].smtRank = cpuOrder[k-1].smtRank + 1;
+		}
+	}
+
+	// order the CPUs for the policy
+	qsort(cpuOrder, n, sizeof(CpuInfo), (placementPolicy == PLACE_SCATTER) ? compareScatter : compareCompact);
+}
+
+/*
+ * CPU for the k-th simulation thread
+ */
+int placementCpuForThread(unsigned int k)
+{
+	if (placementPolicy == PLACE_NONE || numPlacementCpus == 0)
+		return -1;
+	return cpuOrder[k % numPlacementCpus].cpu;
+}
+
+/*
+ * CPU for a thread working on a grid row: the grid is split in one band of rows per CPU
+ */
+int placementCpuForRow(unsigned int row)
+{
+	if (placementPolicy == PLACE_NONE || numPlacementCpus == 0)
+		return -1;
+	return cpuOrder[(unsigned int) (((unsigned long long) row * numPlacementCpus) / NUM_ROWS)].cpu;
+}
+
+/*
+ * Pin the calling thread to a CPU
+ */
+void pinCurrentThread(int cpu)
+{
+	if (cpu < 0)
+		return;
+
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	int errCode = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (errCode != 0)
+		fprintf(stderr, "could not pin thread to CPU %d. %d\n", cpu, errCode);
+	else
+		__atomic_add_fetch(&numPinnedThreads, 1, __ATOMIC_RELAXED);
+}
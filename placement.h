@@ -0,0 +1,49 @@
+//
+//  placement.h
+//  GL threads
+//
+//  Placement of the simulation threads on the cores:
+//	- PLACE_NONE: threads are left to the OS scheduler
+//	- PLACE_COMPACT: thread k runs on the k-th core, filling each package (socket)
+//	  before the next one, and the cores of a package before their SMT siblings
+//	- PLACE_SCATTER: consecutive threads go to different packages, then to different
+//	  cores of a package, then to SMT siblings
+//	- PLACE_REGION: threads are placed by the part of the grid they work on: a region
+//	  worker by its region, a traveler thread by the band of rows it starts in, with
+//	  neighboring parts of the grid on neighboring cores (in compact order)
+//
+//  Nathan Larson 2017-05-02
+
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+typedef enum PlacementPolicy {
+								PLACE_NONE = 0,
+								PLACE_COMPACT,
+								PLACE_SCATTER,
+								PLACE_REGION,
+								//
+								NUM_PLACEMENT_POLICIES
+} PlacementPolicy;
+
+extern const char* const PLACEMENT_NAMES[];
+extern unsigned int placementPolicy;
+
+// number of CPUs the process may run on and packages they belong to (set by initializePlacement)
+extern unsigned int numPlacementCpus, numPlacementPackages;
+// number of threads pinned so far
+extern unsigned int numPinnedThreads;
+
+// Read the CPUs available to the process and their topology, and order them for the policy
+void initializePlacement(void);
+
+// CPU for the k-th simulation thread, or for a thread working on a grid row
+// (-1 if the policy doesn't place threads)
+int placementCpuForThread(unsigned int k);
+int placementCpuForRow(unsigned int row);
+
+// Pin the calling thread to a CPU (nothing is done for cpu < 0).  Threads pin themselves
+// before touching their data, so that the pages they allocate land on their NUMA node.
+void pinCurrentThread(int cpu);
+
+#endif // PLACEMENT_H
@@ -0,0 +1,268 @@
+//
+//  raster.c
+//  GL threads
+//
+//  Software rasterizer (see raster.h).  Coordinates are those of the panes, as in
+//  gl_frontEnd.c: in pixels, y pointing up.  A pixel is covered by a shape when its
+//  center is.
+//
+//  Nathan Larson 2017-05-02
+
+#include <string.h>
+
+#include "simulation.h"
+#include "raster.h"
+
+
+//-----------------------------------------------------------------------------
+//	Data types and constants
+//-----------------------------------------------------------------------------
+
+// layout of the GLUT window (see gl_frontEnd.c)
+extern const unsigned int GRID_PANE_WIDTH, GRID_PANE_HEIGHT, STATE_PANE_WIDTH, STATE_PANE_HEIGHT;
+
+//	A pane of the framebuffer: x is offset by left
+typedef struct Canvas {
+								unsigned char* pixels;
+								unsigned int width;
+								unsigned int height;
+								int left;
+} Canvas;
+
+static const unsigned char BLACK[3] = {0, 0, 0};
+static const unsigned char WHITE[3] = {255, 255, 255};
+static const unsigned char GRAY[3] = {128, 128, 128};
+static const unsigned char INK_COLORS[NUM_PRODUCER_TYPES][3] = {{255, 0, 0}, {0, 255, 0}, {0, 0, 255}};
+// cosine and sine of the travelers' rotations (TRAVELER_DIR * 90 degrees)
+static const float DIR_COS[NUM_TRAVEL_DIRECTIONS] = {1.f, 0.f, -1.f, 0.f};
+static const float DIR_SIN[NUM_TRAVEL_DIRECTIONS] = {0.f, 1.f, 0.f, -1.f};
+
+
+//-----------------------------------------------------------------------------
+//	Primitives
+//-----------------------------------------------------------------------------
+
+static inline int pixelFloor(float v)
+{
+	int i = (int) v;
+	return (v < (float) i) ? i - 1 : i;
+}
+
+static inline void putPixel(const Canvas* canvas, int x, int y, const unsigned char rgb[3])
+{
+	x += canvas->left;
+	if (x < 0 || y < 0 || x >= (int) canvas->width || y >= (int) canvas->height)
+		return;
+	unsigned char* p = canvas->pixels + ((size_t) (canvas->height - 1 - y) * canvas->width + x) * 3;
+	p[0] = rgb[0];
+	p[1] = rgb[1];
+	p[2] = rgb[2];
+}
+
+static void fillRect(const Canvas* canvas, float x0, float y0, float x1, float y1, const unsigned char rgb[3])
+{
+	// pixels whose center is in [x0, x1) x [y0, y1)
+	for (int y=pixelFloor(y0 + 0.5f); (float) y + 0.5f < y1; y++)
+	{
+		for (int x=pixelFloor(x0 + 0.5f); (float) x + 0.5f < x1; x++)
+			putPixel(canvas, x, y, rgb);
+	}
+}
+
+/*
+ * Draw a one pixel wide line, stepping along its longer axis.  A line shorter than a
+ * pixel still draws one, like a traveler's outline on a fine grid.
+ */
+static void drawLine(const Canvas* canvas, float x0, float y0, float x1, float y1, const unsigned char rgb[3])
+{
+	float dx = x1 - x0, dy = y1 - y0;
+	float length = (dx < 0 ? -dx : dx) > (dy < 0 ? -dy : dy) ? (dx < 0 ? -dx : dx) : (dy < 0 ? -dy : dy);
+	int steps = pixelFloor(length) + 1;
+	for (int s=0; s<=steps; s++)
+		putPixel(canvas, pixelFloor(x0 + dx * s / steps), pixelFloor(y0 + dy * s / steps), rgb);
+}
+
+static void fillTriangle(const Canvas* canvas, const float x[3], const float y[3], const unsigned char rgb[3])
+{
+	float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+	if (area == 0.f)
+		return;
+	float minX = x[0], maxX = x[0], minY = y[0], maxY = y[0];
+	for (unsigned int k=1; k<3; k++)
+	{
+		minX = x[k] < minX ? x[k] : minX;
+		maxX = x[k] > maxX ? x[k] : maxX;
+		minY = y[k] < minY ? y[k] : minY;
+		maxY = y[k] > maxY ? y[k] : maxY;
+	}
+
+	for (int py=pixelFloor(minY); py<=pixelFloor(maxY); py++)
+	{
+		for (int px=pixelFloor(minX); px<=pixelFloor(maxX); px++)
+		{
+			// the center is inside if it is on the same side of all three edges
+			float cx = px + 0.5f, cy = py + 0.5f;
+			int inside = 1;
+			for (unsigned int k=0; k<3 && inside; k++)
+			{
+				unsigned int n = (k + 1) % 3;
+				float edge = (x[n] - x[k]) * (cy - y[k]) - (y[n] - y[k]) * (cx - x[k]);
+				inside = (area > 0.f) ? edge >= 0.f : edge <= 0.f;
+			}
+			if (inside)
+				putPixel(canvas, px, py, rgb);
+		}
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+//	Panes
+//-----------------------------------------------------------------------------
+
+/*
+ * Same picture as drawGridAndTravelers(): the squares, the grid lines if the squares
+ * are large enough, then the travelers as black triangles outlined in white
+ */
+static void rasterizeGrid(const Canvas* canvas, const FrameSnapshot* snapshot)
+{
+	const float DH = (1.f*GRID_PANE_WIDTH) / snapshot->numCols;
+	const float DV = (1.f*GRID_PANE_HEIGHT) / snapshot->numRows;
+
+	for (unsigned int y=0; y<GRID_PANE_HEIGHT; y++)
+	{
+		unsigned int r = (unsigned int) ((2ULL*y + 1) * snapshot->sampleRows / (2ULL*GRID_PANE_HEIGHT));
+		const int* row = snapshot->samples + (size_t) r * snapshot->sampleCols;
+		for (unsigned int x=0; x<GRID_PANE_WIDTH; x++)
+		{
+			unsigned int color = (unsigned int) row[(2ULL*x + 1) * snapshot->sampleCols / (2ULL*GRID_PANE_WIDTH)];
+			const unsigned char rgb[3] = {(unsigned char) color, (unsigned char) (color >> 8), (unsigned char) (color >> 16)};
+			putPixel(canvas, (int) x, (int) y, rgb);
+		}
+	}
+
+	if (DH >= 3.f && DV >= 3.f)
+	{
+		for (unsigned int i=0; i<=snapshot->numRows; i++)
+			drawLine(canvas, 0.f, i*DV, GRID_PANE_WIDTH - 1.f, i*DV, GRAY);
+		for (unsigned int j=0; j<=snapshot->numCols; j++)
+			drawLine(canvas, j*DH, 0.f, j*DH, GRID_PANE_HEIGHT - 1.f, GRAY);
+	}
+
+	for (unsigned int k=0; k<snapshot->numTravelers; k++)
+	{
+		unsigned int position = snapshot->position[k];
+		unsigned int dir = TRAVELER_DIR(snapshot->attributes[k]);
+		const float cx = (TRAVELER_COL(position) + 0.5f)*DH, cy = (TRAVELER_ROW(position) + 0.5f)*DV;
+		const float shapeX[3] = {DH/6.f, 0.f, -DH/6.f}, shapeY[3] = {-DV/4.f, DV/4.f, -DV/4.f};
+		float x[3], y[3];
+		for (unsigned int v=0; v<3; v++)
+		{
+			x[v] = cx + shapeX[v]*DIR_COS[dir] - shapeY[v]*DIR_SIN[dir];
+			y[v] = cy + shapeX[v]*DIR_SIN[dir] + shapeY[v]*DIR_COS[dir];
+		}
+		fillTriangle(canvas, x, y, BLACK);
+		for (unsigned int v=0; v<3; v++)
+			drawLine(canvas, x[v], y[v], x[(v + 1) % 3], y[(v + 1) % 3], WHITE);
+	}
+}
+
+/*
+ * Same tanks as drawState(), filled to their level and framed in gray
+ */
+static void rasterizeState(const Canvas* canvas, const FrameSnapshot* snapshot)
+{
+	const unsigned int LEVEL_WIDTH = STATE_PANE_WIDTH / 4;
+	const unsigned int LEVEL_HEIGHT = STATE_PANE_HEIGHT / 3;
+	const unsigned int LEVEL_BOTTOM = STATE_PANE_HEIGHT / 8;
+	const unsigned int H_PAD = LEVEL_WIDTH / 4;
+	const unsigned int tankLeft[NUM_PRODUCER_TYPES] = {H_PAD, 2*H_PAD + LEVEL_WIDTH, STATE_PANE_WIDTH - LEVEL_WIDTH - H_PAD};
+
+	for (unsigned int c=0; c<NUM_PRODUCER_TYPES; c++)
+	{
+		const float left = tankLeft[c], right = left + LEVEL_WIDTH, top = (float) (LEVEL_BOTTOM + LEVEL_HEIGHT);
+		unsigned int y = snapshot->maxLevel > 0 ? (unsigned int) ((unsigned long long) snapshot->level[c] * LEVEL_HEIGHT / snapshot->maxLevel) : 0;
+		fillRect(canvas, left, LEVEL_BOTTOM, right, LEVEL_BOTTOM + (float) y, INK_COLORS[c]);
+		drawLine(canvas, left, LEVEL_BOTTOM, right, LEVEL_BOTTOM, GRAY);
+		drawLine(canvas, right, LEVEL_BOTTOM, right, top, GRAY);
+		drawLine(canvas, right, top, left, top, GRAY);
+		drawLine(canvas, left, top, left, LEVEL_BOTTOM, GRAY);
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+//	Frames
+//-----------------------------------------------------------------------------
+
+unsigned int rasterWidth(void)
+{
+	return GRID_PANE_WIDTH + STATE_PANE_WIDTH;
+}
+
+unsigned int rasterHeight(void)
+{
+	return GRID_PANE_HEIGHT > STATE_PANE_HEIGHT ? GRID_PANE_HEIGHT : STATE_PANE_HEIGHT;
+}
+
+void allocateSnapshot(FrameSnapshot* snapshot, unsigned int maxTravelers)
+{
+	memset(snapshot, 0, sizeof(FrameSnapshot));
+	snapshot->samples = (int*) checkedMalloc((size_t) GRID_PANE_WIDTH * GRID_PANE_HEIGHT, sizeof(int), "frame snapshot");
+	snapshot->position = (unsigned int*) checkedMalloc(maxTravelers, sizeof(unsigned int), "frame snapshot travelers");
+	snapshot->attributes = (unsigned char*) checkedMalloc(maxTravelers, sizeof(unsigned char), "frame snapshot travelers");
+}
+
+void takeSnapshot(FrameSnapshot* snapshot)
+{
+	snapshot->numRows = grid.numRows;
+	snapshot->numCols = grid.numCols;
+	snapshot->sampleRows = grid.numRows < GRID_PANE_HEIGHT ? grid.numRows : GRID_PANE_HEIGHT;
+	snapshot->sampleCols = grid.numCols < GRID_PANE_WIDTH ? grid.numCols : GRID_PANE_WIDTH;
+
+	// the square under the center of each sample, black where no tile was touched
+	for (unsigned int r=0; r<snapshot->sampleRows; r++)
+	{
+		unsigned int row = (unsigned int) ((2ULL*r + 1) * grid.numRows / (2ULL*snapshot->sampleRows));
+		GridTile** tileRow = grid.tiles + (size_t) (row >> GRID_TILE_SHIFT) * grid.numTileCols;
+		int* samples = snapshot->samples + (size_t) r * snapshot->sampleCols;
+		for (unsigned int c=0; c<snapshot->sampleCols; c++)
+		{
+			unsigned int col = (unsigned int) ((2ULL*c + 1) * grid.numCols / (2ULL*snapshot->sampleCols));
+			GridTile* tile = __atomic_load_n(&tileRow[col >> GRID_TILE_SHIFT], __ATOMIC_ACQUIRE);
+			samples[c] = (tile == NULL) ? (int) 0xFF000000 :
+						 __atomic_load_n(&tile->color[((row & GRID_TILE_MASK) << GRID_TILE_SHIFT) | (col & GRID_TILE_MASK)], __ATOMIC_RELAXED);
+		}
+	}
+
+	// the live travelers, 64 slots at a time as in drawGridAndTravelers()
+	unsigned int n = 0;
+	for (unsigned int w=0; w<(travelerStore.count + 63) / 64; w++)
+	{
+		unsigned long long live = __atomic_load_n(&travelerStore.live[w], __ATOMIC_RELAXED);
+		while (live != 0)
+		{
+			unsigned int k = 64*w + __builtin_ctzll(live);
+			live &= live - 1;
+			snapshot->position[n] = __atomic_load_n(&travelerStore.position[k], __ATOMIC_RELAXED);
+			snapshot->attributes[n] = __atomic_load_n(&travelerStore.attributes[k], __ATOMIC_RELAXED);
+			n++;
+		}
+	}
+	snapshot->numTravelers = n;
+
+	snapshot->numLiveThreads = __atomic_load_n(&numLiveThreads, __ATOMIC_RELAXED);
+	for (unsigned int c=0; c<NUM_PRODUCER_TYPES; c++)
+		snapshot->level[c] = inkTankLevel((ProducerType) c);
+	snapshot->maxLevel = MAX_LEVEL;
+}
+
+void rasterizeFrame(const FrameSnapshot* snapshot, unsigned char* pixels)
+{
+	// both panes are cleared to black, like the GLUT subwindows
+	memset(pixels, 0, (size_t) rasterWidth() * rasterHeight() * 3);
+	Canvas canvas = {pixels, rasterWidth(), rasterHeight(), 0};
+	rasterizeGrid(&canvas, snapshot);
+	canvas.left = (int) GRID_PANE_WIDTH;
+	rasterizeState(&canvas, snapshot);
+}
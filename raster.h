@@ -0,0 +1,53 @@
+//
+//  raster.h
+//  GL threads
+//
+//  Software rasterizer: draws the picture of the GLUT window (the grid pane's
+//  squares, grid lines and travelers, and the state pane's ink tanks) into an RGB
+//  framebuffer in memory, so that frames can be made without a display.  It draws
+//  from a FrameSnapshot of the simulation rather than from the live state, so a
+//  frame is consistent however long rasterizing it takes.  Text isn't drawn (its
+//  fonts come from GLUT), nor the selection, heatmap and timeline of the front end.
+//
+//  Nathan Larson 2017-05-02
+
+#ifndef RASTER_H
+#define RASTER_H
+
+#include "gl_frontEnd.h"
+
+//	The simulation as the window would show it.  The grid is sampled at one cell per
+//	pixel of the grid pane at most (cell (r, c) is the square under the center of
+//	that pixel), so a snapshot of a large grid is no larger than the pane.
+typedef struct FrameSnapshot {
+								unsigned int numRows;
+								unsigned int numCols;
+								unsigned int sampleRows;
+								unsigned int sampleCols;
+								//	sampleRows x sampleCols ARGB colors, row 0 at the bottom
+								int* samples;
+								//	live travelers: TRAVELER_POSITION and TRAVELER_ATTRIBUTES
+								unsigned int numTravelers;
+								unsigned int* position;
+								unsigned char* attributes;
+								unsigned int numLiveThreads;
+								unsigned int level[NUM_PRODUCER_TYPES];
+								unsigned int maxLevel;
+} FrameSnapshot;
+
+// Size of the framebuffer: the whole window, both panes side by side
+unsigned int rasterWidth(void);
+unsigned int rasterHeight(void);
+
+// Allocate the arrays of a snapshot of up to maxTravelers travelers (exits with a
+// message if memory runs out)
+void allocateSnapshot(FrameSnapshot* snapshot, unsigned int maxTravelers);
+
+// Take a snapshot of the live simulation.  Reads the grid, the travelers and the
+// tanks like the front end does, without taking any lock.
+void takeSnapshot(FrameSnapshot* snapshot);
+
+// Draw the snapshot into pixels: rasterWidth() x rasterHeight() RGB pixels, top row first
+void rasterizeFrame(const FrameSnapshot* snapshot, unsigned char* pixels);
+
+#endif // RASTER_H
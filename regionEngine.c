@@ -0,0 +1,520 @@
+//
+//  regionEngine.c
+//  GL threads
+//
+//  Region-partitioned simulation engine.  Each worker thread owns a rectangular
+//  region of the grid and steps every traveler standing in it, one square per tick.
+//  Only the owner claims the squares of its region and writes their color, so the
+//  occupancy and color words of a region are never contended (region boundaries
+//  are aligned on tiles when the regions are large enough).  A traveler that steps
+//  out of its region gives up its square and is pushed on the queue from its region
+//  to the neighbor's; the neighbor claims the arrival square when it pops it.
+//  A traveler in transit holds no square, so hand-offs can't deadlock.
+//
+//  Nathan Larson 2017-05-02
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "simulation.h"
+#include "spscQueue.h"
+#include "regionEngine.h"
+#include "placement.h"
+#include "lifecycle.h"
+#include "contention.h"
+#include "arena.h"
+
+
+//-----------------------------------------------------------------------------
+//	Data types
+//-----------------------------------------------------------------------------
+
+// Growable array of traveler indices, only accessed by the worker that owns it
+typedef struct TravelerSet {
+								unsigned int* index;
+								unsigned int count;
+								unsigned int capacity;
+} TravelerSet;
+
+typedef struct RegionWorker {
+								unsigned int id;
+								// squares [firstRow, endRow) x [firstCol, endCol)
+								unsigned int firstRow, endRow, firstCol, endCol;
+								// travelers standing in the region
+								TravelerSet owned;
+								// travelers handed over by a neighbor whose arrival square was occupied
+								TravelerSet pending;
+								// inbound[d]: travelers moving in direction d into this region, pushed
+								// by the neighbor on the other side (one producer per queue)
+								SpscQueue inbound[NUM_TRAVEL_DIRECTIONS];
+								// neighboring region in each direction, or -1 at the edge of the grid
+								int neighbor[NUM_TRAVEL_DIRECTIONS];
+								pthread_t thread;
+} __attribute__((aligned(64))) RegionWorker;
+
+
+//-----------------------------------------------------------------------------
+//	Global variables
+//-----------------------------------------------------------------------------
+
+unsigned int regionRows = 0, regionCols = 0;
+
+// region row (column) of each grid row (column)
+static unsigned int* regionOfRow;
+static unsigned int* regionOfCol;
+
+static RegionWorker* workers;
+static unsigned int numWorkers;
+
+// squares left in the current segment of each traveler (0: pick a new move).
+// Written by whichever worker owns the traveler; the hand-off queue orders the accesses.
+static unsigned int* segmentLeft;
+// ink each traveler has taken but not used yet (as much as segmentLeft in reserve ink
+// mode, at most that much in stream mode); same ownership as segmentLeft
+static unsigned int* inkHeld;
+// 1 while a traveler is stopped for lack of ink (so that each stop is counted once)
+static unsigned char* inkStalled;
+
+// each queue holds up to this many travelers in transit
+#define MIN_QUEUE_CAPACITY	16
+#define MAX_QUEUE_CAPACITY	4096
+
+
+//-----------------------------------------------------------------------------
+//	Function prototypes
+//-----------------------------------------------------------------------------
+
+static void splitAxis(unsigned int numSquares, unsigned int numParts, unsigned int* regionOf);
+static void addTraveler(TravelerSet* set, unsigned int index);
+static RegionWorker* regionOfSquare(unsigned int row, unsigned int col);
+static int placeInRegion(RegionWorker* worker, TravelerInfo* info);
+static void claimStartSquares(RegionWorker* worker);
+static int retireTraveler(RegionWorker* worker, TravelerInfo* info);
+static int stepTraveler(RegionWorker* worker, unsigned int index);
+static int receiveTraveler(RegionWorker* worker, unsigned int index);
+static void* regionWorkerThread(void* arg);
+
+
+//==================================================================================
+//	Region layout
+//==================================================================================
+
+/*
+ * Resolve the automatic region layout and check it against the grid size
+ */
+int configureRegions(void)
+{
+	// by default, one region per core, in a grid of regions as square as possible
+	if (regionRows == 0 || regionCols == 0)
+	{
+		long numCores = sysconf(_SC_NPROCESSORS_ONLN);
+		unsigned int n = (numCores > 0) ? (unsigned int) numCores : 1;
+		unsigned int small = 1;
+		for (unsigned int f=1; f*f<=n; f++)
+			if (n % f == 0)
+				small = f;
+
+		// more regions along the longer side of the grid
+		unsigned int large = n / small;
+		if (regionRows == 0 && regionCols == 0)
+		{
+			regionRows = (NUM_ROWS >= NUM_COLS) ? large : small;
+			regionCols = (NUM_ROWS >= NUM_COLS) ? small : large;
+		}
+		else if (regionRows == 0)
+			regionRows = (n + regionCols - 1) / regionCols;
+		else
+			regionCols = (n + regionRows - 1) / regionRows;
+
+		// regions at least 2 squares wide
+		if (regionRows > NUM_ROWS / 2)
+			regionRows = NUM_ROWS / 2;
+		if (regionCols > NUM_COLS / 2)
+			regionCols = NUM_COLS / 2;
+	}
+
+	if (regionRows > NUM_ROWS / 2 || regionCols > NUM_COLS / 2)
+	{
+		fprintf(stderr, "Cannot split a %u x %u grid in %u x %u regions of at least 2 x 2 squares\n",
+				NUM_ROWS, NUM_COLS, regionRows, regionCols);
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * Split numSquares rows (or columns) in numParts ranges of about the same size, and
+ * record the range of each square.  Boundaries fall on tile boundaries when the ranges
+ * are at least a tile long, so that regions don't share tiles.
+ */
+static void splitAxis(unsigned int numSquares, unsigned int numParts, unsigned int* regionOf)
+{
+	int alignOnTiles = (numSquares / numParts >= GRID_TILE_SIZE);
+	unsigned int first = 0;
+	for (unsigned int p=0; p<numParts; p++)
+	{
+		unsigned int end = (unsigned int) (((unsigned long long) numSquares * (p + 1)) / numParts);
+		if (alignOnTiles && p < numParts - 1)
+			end = ((end + GRID_TILE_SIZE / 2) >> GRID_TILE_SHIFT) << GRID_TILE_SHIFT;
+		for (unsigned int k=first; k<end; k++)
+			regionOf[k] = p;
+		first = end;
+	}
+}
+
+/*
+ * Worker owning a square
+ */
+static RegionWorker* regionOfSquare(unsigned int row, unsigned int col)
+{
+	return &workers[regionOfRow[row] * regionCols + regionOfCol[col]];
+}
+
+/*
+ * Add a traveler to a set, growing it if needed
+ */
+static void addTraveler(TravelerSet* set, unsigned int index)
+{
+	if (set->count == set->capacity)
+	{
+		set->capacity = (set->capacity > 0) ? 2 * set->capacity : 16;
+		set->index = (unsigned int*) realloc(set->index, set->capacity * sizeof(unsigned int));
+		if (set->index == NULL)
+		{
+			fprintf(stderr, "Out of memory for the travelers of a region\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	set->index[set->count++] = index;
+}
+
+/*
+ * Distribute the travelers to the regions they start in, and start the worker threads
+ */
+void startRegionEngine(void)
+{
+	numWorkers = regionRows * regionCols;
+	workers = (RegionWorker*) arenaAlloc(numWorkers, sizeof(RegionWorker), "region workers");
+	regionOfRow = (unsigned int*) arenaAlloc(NUM_ROWS, sizeof(unsigned int), "region layout");
+	regionOfCol = (unsigned int*) arenaAlloc(NUM_COLS, sizeof(unsigned int), "region layout");
+	segmentLeft = (unsigned int*) arenaAlloc(MAX_NUM_TRAVELER_THREADS, sizeof(unsigned int), "traveler segments");
+	inkHeld = (unsigned int*) arenaAlloc(MAX_NUM_TRAVELER_THREADS, sizeof(unsigned int), "traveler segments");
+	inkStalled = (unsigned char*) arenaAlloc(MAX_NUM_TRAVELER_THREADS, sizeof(unsigned char), "traveler segments");
+	firstTouchArena();
+	splitAxis(NUM_ROWS, regionRows, regionOfRow);
+	splitAxis(NUM_COLS, regionCols, regionOfCol);
+
+	unsigned int queueCapacity = MAX_NUM_TRAVELER_THREADS;
+	if (queueCapacity < MIN_QUEUE_CAPACITY)
+		queueCapacity = MIN_QUEUE_CAPACITY;
+	if (queueCapacity > MAX_QUEUE_CAPACITY)
+		queueCapacity = MAX_QUEUE_CAPACITY;
+
+	for (unsigned int r=0; r<regionRows; r++)
+	{
+		for (unsigned int c=0; c<regionCols; c++)
+		{
+			RegionWorker* worker = &workers[r * regionCols + c];
+			worker->id = r * regionCols + c;
+
+			// the region's extent, from the lookup tables
+			worker->firstRow = 0;
+			while (regionOfRow[worker->firstRow] != r)
+				worker->firstRow++;
+			for (worker->endRow = worker->firstRow; worker->endRow < NUM_ROWS && regionOfRow[worker->endRow] == r; worker->endRow++)
+				;
+			worker->firstCol = 0;
+			while (regionOfCol[worker->firstCol] != c)
+				worker->firstCol++;
+			for (worker->endCol = worker->firstCol; worker->endCol < NUM_COLS && regionOfCol[worker->endCol] == c; worker->endCol++)
+				;
+
+			worker->neighbor[NORTH] = (r + 1 < regionRows) ? (int) ((r + 1) * regionCols + c) : -1;
+			worker->neighbor[SOUTH] = (r > 0) ? (int) ((r - 1) * regionCols + c) : -1;
+			worker->neighbor[EAST] = (c + 1 < regionCols) ? (int) (r * regionCols + c + 1) : -1;
+			worker->neighbor[WEST] = (c > 0) ? (int) (r * regionCols + c - 1) : -1;
+
+			for (int d=0; d<NUM_TRAVEL_DIRECTIONS; d++)
+			{
+				if (!spscInit(&worker->inbound[d], queueCapacity))
+				{
+					fprintf(stderr, "Out of memory for the region queues\n");
+					exit(EXIT_FAILURE);
+				}
+			}
+		}
+	}
+
+	// give each traveler to the region it starts in.  The workers claim the starting
+	// squares themselves, so that they are the first to touch the tiles of their region.
+	for (unsigned int k=0; k<MAX_NUM_TRAVELER_THREADS; k++)
+	{
+		unsigned int position = travelerStore.position[k];
+		addTraveler(&regionOfSquare(TRAVELER_ROW(position), TRAVELER_COL(position))->owned, k);
+	}
+	__atomic_store_n(&numLiveThreads, MAX_NUM_TRAVELER_THREADS, __ATOMIC_RELAXED);
+
+	for (unsigned int w=0; w<numWorkers; w++)
+	{
+		int errCode = pthread_create(&workers[w].thread, NULL, regionWorkerThread, &workers[w]);
+		if (errCode != 0)
+		{
+			printf ("could not pthread_create region worker %u. %d\n", w, errCode);
+			exit(0);
+		}
+	}
+}
+
+
+//==================================================================================
+//	Workers
+//==================================================================================
+
+/*
+ * Respawn a traveler with a new random color and direction on a free square of the
+ * worker's region (away from the first row and column, as at startup), so that it
+ * stays with the same worker.  Returns 0 if the region has no free square.
+ */
+static int placeInRegion(RegionWorker* worker, TravelerInfo* info)
+{
+	unsigned int firstRow = (worker->firstRow > 0) ? worker->firstRow : 1;
+	unsigned int firstCol = (worker->firstCol > 0) ? worker->firstCol : 1;
+	unsigned int height = worker->endRow - firstRow, width = worker->endCol - firstCol;
+	unsigned int row = 0, col = 0;
+	int placed = 0;
+
+	// a few random tries, then a scan of the region from a random square
+	for (int attempt = 0; attempt < 16 && !placed; attempt++)
+	{
+		row = firstRow + rand() % height;
+		col = firstCol + rand() % width;
+		placed = claimSquare(row, col, info->index);
+	}
+	for (unsigned long long k = 0, start = rand(); k < (unsigned long long) height * width && !placed; k++)
+	{
+		unsigned long long square = (start + k) % ((unsigned long long) height * width);
+		row = firstRow + (unsigned int) (square / width);
+		col = firstCol + (unsigned int) (square % width);
+		placed = claimSquare(row, col, info->index);
+	}
+	if (!placed)
+		return 0;
+
+	info->type = rand() % NUM_TRAV_TYPES;
+	info->row = row;
+	info->col = col;
+	info->dir = rand() % NUM_TRAVEL_DIRECTIONS;
+	segmentLeft[info->index] = 0;
+	inkHeld[info->index] = 0;
+	publishTraveler(info);
+	return 1;
+}
+
+/*
+ * Claim the starting squares of the travelers initially in the worker's region, moving
+ * the ones whose square is already taken elsewhere in the region.  A traveler that
+ * doesn't fit in its region terminates.
+ */
+static void claimStartSquares(RegionWorker* worker)
+{
+	unsigned int k = 0;
+	while (k < worker->owned.count)
+	{
+		TravelerInfo traveler;
+		TravelerInfo* info = &traveler;
+		loadTraveler(worker->owned.index[k], info);
+		if (claimSquare(info->row, info->col, info->index) || placeInRegion(worker, info))
+		{
+			beginTravelerLife(info->index);
+			k++;
+		}
+		else
+		{
+			publishTravelerLive(info->index, 0);
+			__atomic_sub_fetch(&numLiveThreads, 1, __ATOMIC_RELAXED);
+			pushFreeTraveler(info->index);
+			worker->owned.index[k] = worker->owned.index[--worker->owned.count];
+		}
+	}
+}
+
+/*
+ * A traveler standing on its square reached a corner.  In steady-state mode it is
+ * respawned in the worker's region; otherwise it gives back its square and slot.
+ * Returns 1 if the traveler is still owned by the worker.
+ */
+static int retireTraveler(RegionWorker* worker, TravelerInfo* info)
+{
+	unsigned int row = info->row, col = info->col;
+	releaseSquare(row, col);
+
+	if (steadyState)
+	{
+		TravelerType type = info->type;
+		if (placeInRegion(worker, info))
+		{
+			endTravelerLife(info->index, type);
+			beginTravelerLife(info->index);
+			threadCounters->respawns++;
+			return 1;
+		}
+		// the region is full: stay on the corner (only this worker claims squares of
+		// its region, so the square is still free) and try again at the next tick
+		claimSquare(row, col, info->index);
+		return 1;
+	}
+
+	endTravelerLife(info->index, info->type);
+	info->isLive = 0;
+	publishTravelerLive(info->index, 0);
+	__atomic_sub_fetch(&numLiveThreads, 1, __ATOMIC_RELAXED);
+	pushFreeTraveler(info->index);
+	return 0;
+}
+
+/*
+ * Move an owned traveler by one square, picking a new move (and taking its ink) when
+ * the current one is finished.  A traveler whose next square is occupied abandons its
+ * move, as in the thread engine; one whose next square is in another region is handed
+ * over to that region, which publishes its new position once it has claimed the
+ * square.  Returns 1 if the traveler is still owned by the worker.
+ */
+static int stepTraveler(RegionWorker* worker, unsigned int index)
+{
+	TravelerInfo traveler;
+	TravelerInfo* info = &traveler;
+	loadTraveler(index, info);
+	currentLife = &travelerLife[index];
+
+	unsigned int* left = &segmentLeft[index];
+	if (!prepareStep(info, left, &inkHeld[index], &inkStalled[index]))
+		return 1;
+
+	unsigned int nextRow, nextCol;
+	squareAhead(info, &nextRow, &nextCol);
+
+	RegionWorker* owner = regionOfSquare(nextRow, nextCol);
+	if (owner != worker)
+	{
+		// leave the square and hand the traveler over, unless the neighbor is behind
+		// on its queue: then wait here for the next tick.  Until the neighbor claims
+		// the next square, the store still has the traveler on the square it left.
+		SpscQueue* queue = &owner->inbound[info->dir];
+		if (spscIsFull(queue))
+		{
+			threadCounters->backoffs++;
+			noteBlocked(currentLife);
+			return 1;
+		}
+		noteUnblocked(currentLife);
+		leaveSquare(info, left, &inkHeld[index]);
+		spscPush(queue, index);
+		return 0;
+	}
+
+	if (!claimSquare(nextRow, nextCol, index))
+	{
+		// blocked: pick another move
+		abandonMove(info, left, &inkHeld[index]);
+		return 1;
+	}
+	leaveSquare(info, left, &inkHeld[index]);
+	info->row = nextRow;
+	info->col = nextCol;
+	publishTraveler(info);
+
+	if (isCorner(nextRow, nextCol))
+		return retireTraveler(worker, info);
+	return 1;
+}
+
+/*
+ * Claim the arrival square of a traveler handed over by a neighbor (the square ahead
+ * of the one it left), and publish the traveler there.  Returns 1 if the traveler now
+ * stands in the region, 0 if the square is occupied.
+ */
+static int receiveTraveler(RegionWorker* worker, unsigned int index)
+{
+	TravelerInfo traveler;
+	TravelerInfo* info = &traveler;
+	loadTraveler(index, info);
+
+	unsigned int row, col;
+	squareAhead(info, &row, &col);
+	TravelerWatch* watch = &travelerWatch[index];
+	if (!claimSquare(row, col, index))
+	{
+		__atomic_store_n(&watch->waitingFor, WAITING_FLAG | ((unsigned long long) row << 32) | col, __ATOMIC_RELAXED);
+		noteBlocked(&travelerLife[index]);
+		return 0;
+	}
+	info->row = row;
+	info->col = col;
+	publishTraveler(info);
+	__atomic_store_n(&watch->waitingFor, 0, __ATOMIC_RELAXED);
+	noteContention(row, col, noteUnblocked(&travelerLife[index]));
+
+	if (!isCorner(info->row, info->col) || retireTraveler(worker, info))
+		addTraveler(&worker->owned, index);
+	return 1;
+}
+
+/*
+ * This function is the main function of a region worker.  Each tick, it takes in the
+ * travelers handed over by its neighbors, then moves each of its travelers by one square.
+ */
+static void* regionWorkerThread(void* arg)
+{
+	RegionWorker* worker = (RegionWorker*) arg;
+	bindThreadCounters(&travelerCounters[worker->id]);
+
+	// pin the worker (regions are placed on cores in row-major order, so that most
+	// neighbors share a package), then take possession of the region
+	pinCurrentThread(placementCpuForThread(worker->id));
+	claimStartSquares(worker);
+
+	while (1)
+	{
+		waitWhilePaused();
+
+		// arrivals that were waiting for their square, then the new ones
+		unsigned int k = 0;
+		while (k < worker->pending.count)
+		{
+			if (receiveTraveler(worker, worker->pending.index[k]))
+				worker->pending.index[k] = worker->pending.index[--worker->pending.count];
+			else
+				k++;
+		}
+		for (int d=0; d<NUM_TRAVEL_DIRECTIONS; d++)
+		{
+			unsigned int index;
+			while (spscPop(&worker->inbound[d], &index))
+			{
+				if (!receiveTraveler(worker, index))
+					addTraveler(&worker->pending, index);
+			}
+		}
+
+		// one step for each traveler in the region (a traveler that left is replaced
+		// by the last one of the set)
+		k = 0;
+		while (k < worker->owned.count)
+		{
+			if (stepTraveler(worker, worker->owned.index[k]))
+				k++;
+			else
+				worker->owned.index[k] = worker->owned.index[--worker->owned.count];
+		}
+
+		flushStaleContention();
+		if (travelerSleepTime > 0)
+			usleep(travelerSleepTime);	// sleep for some amount of time (to make display easier to read)
+		else if (worker->owned.count == 0 && worker->pending.count == 0)
+			usleep(100);				// nothing to move: poll the queues less often
+	}
+	return NULL;
+}
@@ -0,0 +1,25 @@
+//
+//  regionEngine.h
+//  GL threads
+//
+//  Region-partitioned simulation engine: the grid is split into regionRows x regionCols
+//  rectangular regions, each owned by one worker thread that moves all the travelers
+//  inside it.  A traveler crossing into a neighboring region is handed over through a
+//  single-producer/single-consumer queue.
+//
+//  Nathan Larson 2017-05-02
+
+#ifndef REGION_ENGINE_H
+#define REGION_ENGINE_H
+
+// number of regions along each axis of the grid (0: chosen from the number of cores)
+extern unsigned int regionRows, regionCols;
+
+// Resolve the automatic region layout and check it against the grid size.
+// Returns 0 (after printing why) if the layout can't be used.
+int configureRegions(void);
+
+// Distribute the travelers to the regions they start in, and start the worker threads
+void startRegionEngine(void);
+
+#endif // REGION_ENGINE_H
@@ -0,0 +1,19 @@
+#!/bin/sh
+#
+#  scrapeMetrics.sh
+#  GL threads
+#
+#  Stand-in for a Prometheus scraper: fetches the metrics of the simulation run with
+#  -metrics N, once, or every INTERVAL seconds, e.g.
+#      ./scrapeMetrics.sh 1
+#      INTERVAL=5 ./scrapeMetrics.sh 1 | grep moves_per_second
+
+INSTANCE=${1:-1}
+INTERVAL=${INTERVAL:-0}
+SOCKET=/tmp/glthreads.$INSTANCE.metrics
+
+while :; do
+	curl -s --fail --unix-socket $SOCKET http://localhost/metrics || exit 1
+	[ "$INTERVAL" -gt 0 ] || break
+	sleep $INTERVAL
+done
@@ -0,0 +1,235 @@
+//
+//  sharedState.c
+//  GL threads
+//
+//  Shared-memory segment exposing the simulation to viewer processes (see sharedState.h).
+//  The segment is sized for the whole grid, but it is sparse: only the tiles that
+//  travelers touch take memory, as with the private tiled grid.
+//
+//  Nathan Larson 2017-05-02
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "simulation.h"
+#include "sharedState.h"
+
+
+//-----------------------------------------------------------------------------
+//	Global variables
+//-----------------------------------------------------------------------------
+
+unsigned int sharedInstance = 0;
+
+static char segmentName[64];
+static SharedStateHeader* header = NULL;
+static unsigned int* tileState;
+static GridTile* sharedTiles;
+// serializes the writers of the state block: the publisher thread, and the exit handler
+static pthread_mutex_t stateBlockLock = PTHREAD_MUTEX_INITIALIZER;
+
+
+//-----------------------------------------------------------------------------
+//	Segment
+//-----------------------------------------------------------------------------
+
+/*
+ * Offset of the next region of the segment, rounded up to a multiple of alignment
+ */
+static unsigned long long alignOffset(unsigned long long offset, unsigned long long alignment)
+{
+	return (offset + alignment - 1) / alignment * alignment;
+}
+
+/*
+ * Open a new segment.  A segment left behind by a simulation that no longer runs is
+ * replaced; one that belongs to a running simulation is not.
+ */
+static int openSegment(void)
+{
+	int fd = shm_open(segmentName, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (fd >= 0 || errno != EEXIST)
+		return fd;
+
+	int old = shm_open(segmentName, O_RDONLY, 0);
+	if (old >= 0)
+	{
+		SharedStateHeader oldHeader;
+		ssize_t n = read(old, &oldHeader, sizeof(oldHeader));
+		close(old);
+		if (n == (ssize_t) sizeof(oldHeader) && oldHeader.magic == SHARED_STATE_MAGIC &&
+			!oldHeader.state.finished && (kill(oldHeader.pid, 0) == 0 || errno == EPERM))
+		{
+			fprintf(stderr, "Shared segment %s is in use by process %d\n", segmentName, oldHeader.pid);
+			exit(EXIT_FAILURE);
+		}
+	}
+	shm_unlink(segmentName);
+	return shm_open(segmentName, O_RDWR | O_CREAT | O_EXCL, 0644);
+}
+
+/*
+ * Rewrite the state block.  The sequence counter is odd while this is going on, so
+ * a reader that overlaps with it knows to try again.
+ */
+static void writeStateBlock(unsigned int finished)
+{
+	pthread_mutex_lock(&stateBlockLock);
+	unsigned int sequence = header->sequence;
+	__atomic_store_n(&header->sequence, sequence + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&header->state.numLiveThreads, __atomic_load_n(&numLiveThreads, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+	for (unsigned int c=0; c<NUM_PRODUCER_TYPES; c++)
+		__atomic_store_n(&header->state.inkLevel[c], inkTankLevel((ProducerType) c), __ATOMIC_RELAXED);
+	__atomic_store_n(&header->state.producerSleepTime, producerSleepTime, __ATOMIC_RELAXED);
+	__atomic_store_n(&header->state.control.targetLevel, __atomic_load_n(&producerControl.targetLevel, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+	for (unsigned int c=0; c<NUM_PRODUCER_TYPES; c++)
+	{
+		__atomic_store_n(&header->state.control.sleepTime[c], __atomic_load_n(&producerControl.sleepTime[c], __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+		__atomic_store_n(&header->state.control.consumption[c], __atomic_load_n(&producerControl.consumption[c], __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+	}
+	__atomic_store_n(&header->state.finished, finished, __ATOMIC_RELAXED);
+	__atomic_store_n(&header->sequence, sequence + 2, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&stateBlockLock);
+}
+
+/*
+ * Mark the segment finished for the viewers still attached, and remove its name
+ */
+static void destroySharedState(void)
+{
+	writeStateBlock(1);
+	shm_unlink(segmentName);
+}
+
+void createSharedState(void)
+{
+	snprintf(segmentName, sizeof(segmentName), SHARED_STATE_NAME_FORMAT, sharedInstance);
+	size_t numTiles = (size_t) grid.numTileRows * grid.numTileCols;
+	size_t pageSize = (size_t) sysconf(_SC_PAGESIZE);
+
+	// layout: header, tile states, traveler store, then the tiles and their contention
+	// counters on their own pages
+	unsigned long long tileStateOffset = alignOffset(sizeof(SharedStateHeader), 64);
+	unsigned long long positionOffset = alignOffset(tileStateOffset + numTiles * sizeof(unsigned int), 64);
+	unsigned long long attributesOffset = alignOffset(positionOffset + (unsigned long long) MAX_NUM_TRAVELER_THREADS * sizeof(unsigned int), 64);
+	unsigned long long liveOffset = alignOffset(attributesOffset + MAX_NUM_TRAVELER_THREADS, 64);
+	unsigned long long tilesOffset = alignOffset(liveOffset + (MAX_NUM_TRAVELER_THREADS + 63ULL) / 64 * sizeof(unsigned long long), pageSize);
+	unsigned long long contentionOffset = alignOffset(tilesOffset + numTiles * sizeof(GridTile), pageSize);
+	unsigned long long segmentSize = alignOffset(contentionOffset + numTiles * sizeof(TileContention), pageSize);
+
+	int fd = openSegment();
+	if (fd < 0)
+	{
+		perror(segmentName);
+		exit(EXIT_FAILURE);
+	}
+	// the segment reads as zeros, and pages are only allocated when written
+	if (ftruncate(fd, (off_t) segmentSize) != 0)
+	{
+		perror("ftruncate");
+		exit(EXIT_FAILURE);
+	}
+	char* base = (char*) mmap(NULL, segmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED)
+	{
+		perror("mmap");
+		exit(EXIT_FAILURE);
+	}
+
+	header = (SharedStateHeader*) base;
+	header->headerSize = sizeof(SharedStateHeader);
+	header->tileSize = GRID_TILE_SIZE;
+	header->segmentSize = segmentSize;
+	header->pid = getpid();
+	header->numRows = grid.numRows;
+	header->numCols = grid.numCols;
+	header->numTileRows = grid.numTileRows;
+	header->numTileCols = grid.numTileCols;
+	header->numTravelers = MAX_NUM_TRAVELER_THREADS;
+	header->maxLevel = MAX_LEVEL;
+	header->tileStateOffset = tileStateOffset;
+	header->tilesOffset = tilesOffset;
+	header->contentionOffset = contentionOffset;
+	header->positionOffset = positionOffset;
+	header->attributesOffset = attributesOffset;
+	header->liveOffset = liveOffset;
+
+	tileState = (unsigned int*) (base + tileStateOffset);
+	sharedTiles = (GridTile*) (base + tilesOffset);
+	grid.contention = (TileContention*) (base + contentionOffset);
+	travelerStore.count = MAX_NUM_TRAVELER_THREADS;
+	travelerStore.position = (unsigned int*) (base + positionOffset);
+	travelerStore.attributes = (unsigned char*) (base + attributesOffset);
+	travelerStore.live = (unsigned long long*) (base + liveOffset);
+
+	// viewers check the magic number and version last, once the layout is in place
+	header->version = SHARED_STATE_VERSION;
+	__atomic_store_n(&header->magic, SHARED_STATE_MAGIC, __ATOMIC_RELEASE);
+
+	atexit(destroySharedState);
+	printf("Shared state in %s (%llu KB reserved)\n", segmentName, segmentSize >> 10);
+}
+
+/*
+ * Tiles can't be built privately and swapped in, as in the private grid, since each
+ * has a fixed place in the segment: the first thread to touch a tile builds it in
+ * place, and the others wait for it to be ready.
+ */
+GridTile* touchSharedTile(size_t t)
+{
+	GridTile* tile = &sharedTiles[t];
+	unsigned int state = SHARED_TILE_EMPTY;
+	if (__atomic_compare_exchange_n(&tileState[t], &state, SHARED_TILE_BUILDING, 0, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+	{
+		// black, with no traveler on it (the occupancy bits are already zero)
+		for (unsigned int k=0; k<GRID_TILE_SIZE*GRID_TILE_SIZE; k++)
+			tile->color[k] = 0xFF000000;
+		__atomic_store_n(&tileState[t], SHARED_TILE_READY, __ATOMIC_RELEASE);
+	}
+	else
+	{
+		while (__atomic_load_n(&tileState[t], __ATOMIC_ACQUIRE) != SHARED_TILE_READY)
+			sched_yield();
+	}
+
+	__atomic_store_n(&grid.tiles[t], tile, __ATOMIC_RELEASE);
+	return tile;
+}
+
+
+//-----------------------------------------------------------------------------
+//	State block
+//-----------------------------------------------------------------------------
+
+static void* sharedStatePublisherThread(void* arg)
+{
+	while (1)
+	{
+		writeStateBlock(0);
+		usleep(SHARED_STATE_PERIOD);
+	}
+	return NULL;
+}
+
+void startSharedStatePublisher(void)
+{
+	pthread_t publisher;
+	int errCode = pthread_create(&publisher, NULL, sharedStatePublisherThread, NULL);
+	if (errCode != 0)
+	{
+		printf("could not pthread_create shared state publisher thread. %d\n", errCode);
+		exit(0);
+	}
+}
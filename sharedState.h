@@ -0,0 +1,120 @@
+//
+//  sharedState.h
+//  GL threads
+//
+//  Shared-memory segment through which a simulation run with -shared N exposes its
+//  state to viewer processes.  The segment, named /glthreads.N, starts with a header
+//  describing its layout, followed by the grid tiles and the traveler store: the
+//  simulation works directly in the segment, so a viewer maps it read-only and draws
+//  from it without copying anything, the same way the in-process front end does.
+//  The few values that aren't kept in the segment (live travelers, ink levels, ...)
+//  are copied to the header's state block periodically, under a sequence counter.
+//
+//  Nathan Larson 2017-05-02
+
+#ifndef SHARED_STATE_H
+#define SHARED_STATE_H
+
+#include <stddef.h>
+
+#include "gl_frontEnd.h"
+
+#define SHARED_STATE_MAGIC			0x474C5448	// "GLTH"
+// to be incremented whenever the layout below changes
+#define SHARED_STATE_VERSION		6
+#define SHARED_STATE_NAME_FORMAT	"/glthreads.%u"
+// period of the state block updates, in microseconds
+#define SHARED_STATE_PERIOD			20000
+
+// state of each tile of the segment: a tile is built by the first simulation thread
+// that touches it, and may only be read once it is ready
+#define SHARED_TILE_EMPTY			0
+#define SHARED_TILE_BUILDING		1
+#define SHARED_TILE_READY			2
+
+// values that change as the simulation runs, and aren't stored in the segment otherwise
+typedef struct SharedStateBlock {
+								unsigned int numLiveThreads;
+								unsigned int inkLevel[NUM_PRODUCER_TYPES];
+								unsigned int producerSleepTime;
+								ProducerControl control;
+								// set when the simulation terminates
+								unsigned int finished;
+} SharedStateBlock;
+
+typedef struct SharedStateHeader {
+								// checked by a viewer before it reads anything else
+								unsigned int magic;
+								unsigned int version;
+								unsigned int headerSize;
+								unsigned int tileSize;
+								unsigned long long segmentSize;
+								// process id of the simulation
+								int pid;
+
+								unsigned int numRows, numCols;
+								unsigned int numTileRows, numTileCols;
+								unsigned int numTravelers;
+								unsigned int maxLevel;
+
+								// offsets from the start of the segment of: the tile states (one
+								// unsigned int per tile), the tiles (one GridTile per tile of the
+								// grid, row-major), their contention counters (one TileContention
+								// per tile), and the arrays of the traveler store
+								unsigned long long tileStateOffset;
+								unsigned long long tilesOffset;
+								unsigned long long contentionOffset;
+								unsigned long long positionOffset;
+								unsigned long long attributesOffset;
+								unsigned long long liveOffset;
+
+								// odd while the state block is being rewritten
+								unsigned int sequence __attribute__((aligned(64)));
+								SharedStateBlock state;
+} SharedStateHeader;
+
+/*
+ * Read a consistent copy of the state block: retry until the sequence counter was
+ * even and unchanged across the read.
+ */
+static inline void readSharedState(const SharedStateHeader* header, SharedStateBlock* state)
+{
+	unsigned int before, after;
+	do
+	{
+		before = __atomic_load_n(&header->sequence, __ATOMIC_ACQUIRE);
+		state->numLiveThreads = __atomic_load_n(&header->state.numLiveThreads, __ATOMIC_RELAXED);
+		for (unsigned int c=0; c<NUM_PRODUCER_TYPES; c++)
+			state->inkLevel[c] = __atomic_load_n(&header->state.inkLevel[c], __ATOMIC_RELAXED);
+		state->producerSleepTime = __atomic_load_n(&header->state.producerSleepTime, __ATOMIC_RELAXED);
+		state->control.targetLevel = __atomic_load_n(&header->state.control.targetLevel, __ATOMIC_RELAXED);
+		for (unsigned int c=0; c<NUM_PRODUCER_TYPES; c++)
+		{
+			state->control.sleepTime[c] = __atomic_load_n(&header->state.control.sleepTime[c], __ATOMIC_RELAXED);
+			state->control.consumption[c] = __atomic_load_n(&header->state.control.consumption[c], __ATOMIC_RELAXED);
+		}
+		state->finished = __atomic_load_n(&header->state.finished, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		after = __atomic_load_n(&header->sequence, __ATOMIC_RELAXED);
+	} while ((before & 1) != 0 || before != after);
+}
+
+
+//-----------------------------------------------------------------------------
+//	Simulation side (sharedState.c)
+//-----------------------------------------------------------------------------
+
+// instance number of the segment (0: no shared segment)
+extern unsigned int sharedInstance;
+
+// Create the segment once the grid's dimensions are known, and place the traveler
+// store in it.  The segment is removed when the process exits.
+void createSharedState(void);
+
+// Return tile t of the grid, building it in the segment if needed
+GridTile* touchSharedTile(size_t t);
+
+// Start the thread that keeps the state block up to date
+void startSharedStatePublisher(void);
+
+#endif // SHARED_STATE_H
@@ -0,0 +1,200 @@
+//
+//  simulation.h
+//  GL threads
+//
+//  Declarations shared by the simulation engines (main.c and the alternative
+//  engines), which the graphic front end doesn't need to know about.
+//
+//  Nathan Larson 2017-05-02
+
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include <pthread.h>
+
+#include "gl_frontEnd.h"
+#include "lock.h"
+
+
+//-----------------------------------------------------------------------------
+//	Data types
+//-----------------------------------------------------------------------------
+
+// Per-thread counters.  Each engine thread only writes to its own entry, and the
+// entries are padded to a cache line so that no two threads write to the same line.
+typedef struct TravelerCounters {
+								unsigned long long moves;
+								unsigned long long respawns;
+								// number of times ink was taken from another core's shard
+								unsigned long long inkSteals;
+								// times a traveler stopped mid-move because its tank was empty (stream mode)
+								unsigned long long inkWaits;
+								// failed attempts to get the next square, and moves abandoned because of them
+								unsigned long long backoffs;
+								unsigned long long reroutes;
+								// moves shortened because a traveler ahead was heading toward us (aware policy)
+								unsigned long long headOns;
+								// total time spent waiting for squares, in nanoseconds
+								unsigned long long blockedTime;
+								// ink requests granted and refused, by color
+								unsigned long long inkAcquired[NUM_TRAV_TYPES];
+								unsigned long long inkRefused[NUM_TRAV_TYPES];
+								// waits for the ink tank locks
+								LockStats lockStats;
+} __attribute__((aligned(64))) TravelerCounters;
+
+// What the watchdog can see of each traveler slot, written by the thread running it:
+// the number of moves made so far, and the square the traveler is waiting for
+// (WAITING_FLAG | row << 32 | col), or 0 if it isn't waiting.
+#define WAITING_FLAG	(1ULL << 63)
+typedef struct TravelerWatch {
+								unsigned long long progress;
+								unsigned long long waitingFor;
+} TravelerWatch;
+
+// How travelers take ink.  INK_RESERVE: all the ink of a move is taken before the
+// traveler sets off (if the tank can't cover it, the traveler picks another move).
+// INK_STREAM: the ink is taken inkChunk squares at a time as the traveler goes, and a
+// traveler that finds its tank empty stops mid-move until the producers refill it.
+typedef enum InkMode {
+								INK_RESERVE = 0,
+								INK_STREAM,
+								//
+								NUM_INK_MODES
+} InkMode;
+
+//-----------------------------------------------------------------------------
+//	Simulation state (defined in main.c)
+//-----------------------------------------------------------------------------
+
+extern TiledGrid grid;
+extern unsigned int NUM_ROWS, NUM_COLS;
+extern unsigned int MAX_NUM_TRAVELER_THREADS;
+extern unsigned int numLiveThreads;
+extern unsigned int steadyState;
+extern unsigned int travelerSleepTime;
+extern unsigned int inkMode;
+extern const char* const INK_MODE_NAMES[];
+extern unsigned int numInkShards;
+extern unsigned int MAX_LEVEL;
+extern unsigned int producerSleepTime;
+// written by the production scheduler thread
+extern ProducerControl producerControl;
+
+// shared state of the travelers; each thread works on TravelerInfo copies of the travelers it moves
+extern TravelerStore travelerStore;
+extern TravelerWatch* travelerWatch;
+
+// one entry per engine thread (numCounterSlots of them)
+extern TravelerCounters* travelerCounters;
+extern unsigned int numCounterSlots;
+extern __thread TravelerCounters* threadCounters;
+
+// statistics that aren't kept per traveler thread (each has a single writer)
+extern unsigned long long producerWakeups, inkRefills, inkOverflow;
+extern LockStats producerLockStats;
+extern unsigned long long watchdogStalls, watchdogCycles;
+// time spent drawing the panes, in nanoseconds, and the time of the last frame
+extern unsigned long long framesRendered, renderTime, lastFrameTime;
+
+
+//-----------------------------------------------------------------------------
+//	Function prototypes
+//-----------------------------------------------------------------------------
+
+// unpack a traveler from the store
+static inline void loadTraveler(unsigned int index, TravelerInfo* info)
+{
+	unsigned int position = __atomic_load_n(&travelerStore.position[index], __ATOMIC_RELAXED);
+	unsigned char attributes = __atomic_load_n(&travelerStore.attributes[index], __ATOMIC_RELAXED);
+	info->index = index;
+	info->row = TRAVELER_ROW(position);
+	info->col = TRAVELER_COL(position);
+	info->type = TRAVELER_TYPE(attributes);
+	info->dir = TRAVELER_DIR(attributes);
+	info->isLive = (__atomic_load_n(&travelerStore.live[index / 64], __ATOMIC_RELAXED) >> (index % 64)) & 1;
+}
+
+// publish a traveler's position, type and direction to the store
+static inline void publishTraveler(const TravelerInfo* info)
+{
+	__atomic_store_n(&travelerStore.position[info->index], TRAVELER_POSITION(info->row, info->col), __ATOMIC_RELAXED);
+	__atomic_store_n(&travelerStore.attributes[info->index], TRAVELER_ATTRIBUTES(info->type, info->dir), __ATOMIC_RELAXED);
+}
+
+// set or clear a traveler's live bit (the other bits of the word belong to other travelers)
+static inline void publishTravelerLive(unsigned int index, int isLive)
+{
+	if (isLive)
+		__atomic_fetch_or(&travelerStore.live[index / 64], 1ULL << (index % 64), __ATOMIC_RELEASE);
+	else
+		__atomic_fetch_and(&travelerStore.live[index / 64], ~(1ULL << (index % 64)), __ATOMIC_RELEASE);
+}
+
+static inline int isTravelerLive(unsigned int index)
+{
+	return (__atomic_load_n(&travelerStore.live[index / 64], __ATOMIC_ACQUIRE) >> (index % 64)) & 1;
+}
+
+// startup: set an option from its string value, check the configuration, then allocate
+// and seed the simulation (used by main() and by the microbenchmarks)
+int setConfigOption(const char* name, const char* valueStr);
+void validateConfiguration(void);
+void initializeApplication(void);
+
+// allocation that exits with a message if the size overflows or memory runs out
+int checkedArrayBytes(size_t count, size_t elemSize, size_t* bytes);
+void* checkedMalloc(size_t count, size_t elemSize, const char* what);
+
+// access to the squares of the tiled grid (allocating their tile on first touch)
+GridTile* touchTile(unsigned int row, unsigned int col);
+int claimSquare(unsigned int row, unsigned int col, unsigned int index);
+int isSquareFree(unsigned int row, unsigned int col);
+void releaseSquare(unsigned int row, unsigned int col);
+void depositInk(unsigned int row, unsigned int col, TravelerType type, unsigned int amount);
+
+// take ink for a traveler (signaling the production scheduler if the tank ran low),
+// or put some back
+int takeInk(TravelerType type, unsigned int amount);
+int topUpInk(ProducerType type, unsigned int amount, unsigned int* added);
+// level of a tank, whether it is sharded or not
+unsigned int inkTankLevel(ProducerType type);
+// stream mode: make sure the traveler holds ink for its next square
+int streamInk(TravelerType type, unsigned int* held, unsigned int remaining, int wait);
+
+// move a traveler to the next square in its direction, coloring the square it leaves.
+// Returns 0 if the traveler was blocked (see acquireNextSquare) and should pick another move.
+int moveTraveler(TravelerInfo* info);
+
+// pick a traveler's next direction (set in info->dir) and displacement length
+int chooseMove(TravelerInfo* info);
+
+// the square a traveler steps onto next, in its direction, and whether a square is one
+// of the grid's corners
+void squareAhead(const TravelerInfo* info, unsigned int* row, unsigned int* col);
+int isCorner(unsigned int row, unsigned int col);
+
+// single steps of the engines that move the travelers a square at a time (regions and
+// wheel).  left, held and stalled are the traveler's squares left in its move, ink taken
+// but not used yet, and whether it is stopped for lack of ink.  prepareStep picks a new
+// move when the current one is done and makes sure the traveler holds ink for its next
+// square (returns 0 if it can't step now); leaveSquare colors and releases the square the
+// traveler steps off, the caller publishing its new position; abandonMove gives back the
+// ink of a blocked move, so that the next step picks another one.
+int prepareStep(TravelerInfo* info, unsigned int* left, unsigned int* held, unsigned char* stalled);
+void leaveSquare(const TravelerInfo* info, unsigned int* left, unsigned int* held);
+void abandonMove(const TravelerInfo* info, unsigned int* left, unsigned int* held);
+
+// make counters those of the calling thread, and add up the counters of all threads
+void bindThreadCounters(TravelerCounters* counters);
+void sumTravelerCounters(TravelerCounters* total);
+
+// recycling of the slots of terminated travelers
+void pushFreeTraveler(unsigned int index);
+int popFreeTraveler(void);
+void claimStartSquare(TravelerInfo* info);
+void respawnTraveler(TravelerInfo* info);
+// engines call this before each step, to stop there while the simulation is paused
+void waitWhilePaused(void);
+
+#endif // SIMULATION_H
@@ -0,0 +1,87 @@
+//
+//  spscQueue.h
+//  GL threads
+//
+//  Bounded lock-free single-producer/single-consumer queue of traveler indices.
+//  Exactly one thread may push and exactly one thread may pop.  The head and tail
+//  live on separate cache lines, and each side keeps a cached copy of the other
+//  side's index so that it only reads the shared line when the cached copy says
+//  the queue is full (or empty).
+//
+//  Nathan Larson 2017-05-02
+
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <stdlib.h>
+
+typedef struct SpscQueue {
+								// consumer side: next slot to pop, and last tail seen
+								unsigned int head __attribute__((aligned(64)));
+								unsigned int cachedTail;
+								// producer side: next slot to push, and last head seen
+								unsigned int tail __attribute__((aligned(64)));
+								unsigned int cachedHead;
+								// ring buffer (power-of-two size, read-only after initialization)
+								unsigned int* slots __attribute__((aligned(64)));
+								unsigned int mask;
+} SpscQueue;
+
+/*
+ * Allocate a queue holding up to capacity indices, rounded up to a power of two.
+ * Returns 0 if memory runs out.
+ */
+static inline int spscInit(SpscQueue* q, unsigned int capacity)
+{
+	unsigned int size = 1;
+	while (size < capacity)
+		size *= 2;
+	q->slots = (unsigned int*) malloc(size * sizeof(unsigned int));
+	q->mask = size - 1;
+	q->head = q->cachedTail = 0;
+	q->tail = q->cachedHead = 0;
+	return q->slots != NULL;
+}
+
+/*
+ * Producer side: is the queue full?  Only the consumer can make room, so a push
+ * right after this returned 0 can't fail.
+ */
+static inline int spscIsFull(SpscQueue* q)
+{
+	if (q->tail - q->cachedHead <= q->mask)
+		return 0;
+	q->cachedHead = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+	return q->tail - q->cachedHead > q->mask;
+}
+
+/*
+ * Producer side: push an index.  Returns 0 if the queue is full.  Everything the
+ * producer wrote before the push is visible to the consumer after the pop.
+ */
+static inline int spscPush(SpscQueue* q, unsigned int value)
+{
+	if (spscIsFull(q))
+		return 0;
+	q->slots[q->tail & q->mask] = value;
+	__atomic_store_n(&q->tail, q->tail + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+/*
+ * Consumer side: pop an index into *value.  Returns 0 if the queue is empty.
+ */
+static inline int spscPop(SpscQueue* q, unsigned int* value)
+{
+	if (q->head == q->cachedTail)
+	{
+		q->cachedTail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+		if (q->head == q->cachedTail)
+			return 0;
+	}
+	*value = q->slots[q->head & q->mask];
+	__atomic_store_n(&q->head, q->head + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+#endif // SPSC_QUEUE_H
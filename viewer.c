@@ -0,0 +1,237 @@
+//
+//  viewer.c
+//  GL threads
+//
+//  Viewer process for a simulation run with -shared N.  It maps the simulation's
+//  shared segment read-only and draws the grid, the travelers and the ink tanks with
+//  the simulation's own front end, reading them in place.  The simulation never waits
+//  for a viewer, so viewers can be started and closed at any time without slowing it.
+//  The keys that act on the simulation ('r', 'g', 'b', ',', '.', 'p', 'n' and 'c') do
+//  nothing here; the heatmap ('h') and the selection of squares work as in the
+//  simulation.
+//
+//  Usage: ./viewer [-shared N]		(N defaults to 1)
+//
+//  Nathan Larson 2017-05-02
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "gl_frontEnd.h"
+#include "sharedState.h"
+
+//==================================================================================
+//	Function prototypes
+//==================================================================================
+void displayGridPane(void);
+void displayStatePane(void);
+void attachSharedState(unsigned int instance);
+void updateTileDirectory(void);
+
+//==================================================================================
+//	Application-level global variables
+//==================================================================================
+
+//	Don't touch
+extern const int GRID_PANE, STATE_PANE;
+extern int	gMainWindow, gSubwindow[2];
+
+// read by the front end: taken from the segment's header
+unsigned int MAX_LEVEL;
+
+// the segment, and the simulation's grid and traveler store inside it
+const SharedStateHeader* header;
+const unsigned int* tileState;
+GridTile* sharedTiles;
+TiledGrid grid;
+TravelerStore travelerStore;
+
+//------------------------------------------------------------------------
+//	The viewer can't change the simulation, so the front end's commands
+//	are ignored.
+//------------------------------------------------------------------------
+//
+int postCommand(CommandType type, unsigned int arg)
+{
+	return 1;
+}
+
+
+void displayGridPane(void)
+{
+	//	This is OpenGL/glut magic.
+	glutSetWindow(gSubwindow[GRID_PANE]);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	glMatrixMode(GL_MODELVIEW);
+	glLoadIdentity();
+
+	// pick up the tiles the simulation built since the last frame
+	updateTileDirectory();
+	drawGridAndTravelers(&grid, &travelerStore);
+
+	//	This is OpenGL/glut magic.
+	glutSwapBuffers();
+
+	glutSetWindow(gMainWindow);
+}
+
+void displayStatePane(void)
+{
+	SharedStateBlock state;
+	readSharedState(header, &state);
+
+	// leave when the simulation is over (or was killed before it could say so)
+	if (state.finished || (kill(header->pid, 0) != 0 && errno == ESRCH))
+	{
+		printf("The simulation has terminated\n");
+		exit(0);
+	}
+
+	//	This is OpenGL/glut magic.
+	glutSetWindow(gSubwindow[STATE_PANE]);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	glMatrixMode(GL_MODELVIEW);
+	glLoadIdentity();
+
+	drawState(state.numLiveThreads, state.inkLevel[RED_INK], state.inkLevel[GREEN_INK], state.inkLevel[BLUE_INK],
+			  state.producerSleepTime, &state.control);
+
+	// the square clicked in the grid pane, and the traveler on it (the segment has
+	// no lifecycle times, so only what the traveler store knows)
+	static const char* const COLOR_NAMES[NUM_TRAV_TYPES] = {"red", "green", "blue"};
+	static const char* const DIRECTION_NAMES[NUM_TRAVEL_DIRECTIONS] = {"north", "west", "south", "east"};
+	unsigned int row, col;
+	if (selectedSquare(&row, &col))
+	{
+		char selectionLines[2][80];
+		const char* selection[2] = {selectionLines[0], selectionLines[1]};
+		int index = squareOccupant(&grid, row, col);
+		if (index < 0)
+		{
+			snprintf(selectionLines[0], sizeof(selectionLines[0]), "Square (%u, %u): free", row, col);
+			drawSelectionInfo(selection, 1);
+		}
+		else
+		{
+			unsigned char attributes = __atomic_load_n(&travelerStore.attributes[index], __ATOMIC_RELAXED);
+			snprintf(selectionLines[0], sizeof(selectionLines[0]), "Square (%u, %u): traveler #%d", row, col, index);
+			snprintf(selectionLines[1], sizeof(selectionLines[1]), "%s, heading %s", COLOR_NAMES[TRAVELER_TYPE(attributes)],
+					 DIRECTION_NAMES[TRAVELER_DIR(attributes)]);
+			drawSelectionInfo(selection, 2);
+		}
+	}
+
+	//	This is OpenGL/glut magic.
+	glutSwapBuffers();
+
+	glutSetWindow(gMainWindow);
+}
+
+/*
+ * Map segment /glthreads.<instance> read-only, check that its layout is the one this
+ * viewer was built for, and point the grid and traveler store into it.
+ */
+void attachSharedState(unsigned int instance)
+{
+	char name[64];
+	snprintf(name, sizeof(name), SHARED_STATE_NAME_FORMAT, instance);
+	int fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0)
+	{
+		fprintf(stderr, "Could not open %s (is a simulation running with -shared %u?)\n", name, instance);
+		exit(EXIT_FAILURE);
+	}
+
+	// the simulation sets the magic number last: give it a moment if it just started
+	SharedStateHeader probe;
+	for (unsigned int attempt=0; ; attempt++)
+	{
+		struct stat info;
+		if (fstat(fd, &info) == 0 && (size_t) info.st_size >= sizeof(probe) &&
+			pread(fd, &probe, sizeof(probe), 0) == (ssize_t) sizeof(probe) && probe.magic == SHARED_STATE_MAGIC)
+			break;
+		if (attempt == 50)
+		{
+			fprintf(stderr, "%s is not a simulation segment\n", name);
+			exit(EXIT_FAILURE);
+		}
+		usleep(20000);
+	}
+	if (probe.version != SHARED_STATE_VERSION || probe.headerSize != sizeof(SharedStateHeader) ||
+		probe.tileSize != GRID_TILE_SIZE)
+	{
+		fprintf(stderr, "%s has layout version %u, this viewer reads version %u\n", name, probe.version, SHARED_STATE_VERSION);
+		exit(EXIT_FAILURE);
+	}
+
+	const char* base = (const char*) mmap(NULL, probe.segmentSize, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED)
+	{
+		perror("mmap");
+		exit(EXIT_FAILURE);
+	}
+
+	header = (const SharedStateHeader*) base;
+	tileState = (const unsigned int*) (base + header->tileStateOffset);
+	sharedTiles = (GridTile*) (base + header->tilesOffset);
+	MAX_LEVEL = header->maxLevel;
+
+	// the front end only reads through these
+	grid.numRows = header->numRows;
+	grid.numCols = header->numCols;
+	grid.numTileRows = header->numTileRows;
+	grid.numTileCols = header->numTileCols;
+	grid.contention = (TileContention*) (base + header->contentionOffset);
+	grid.tiles = (GridTile**) calloc((size_t) grid.numTileRows * grid.numTileCols, sizeof(GridTile*));
+	if (grid.tiles == NULL)
+	{
+		fprintf(stderr, "Could not allocate the tile directory\n");
+		exit(EXIT_FAILURE);
+	}
+	travelerStore.count = header->numTravelers;
+	travelerStore.position = (unsigned int*) (base + header->positionOffset);
+	travelerStore.attributes = (unsigned char*) (base + header->attributesOffset);
+	travelerStore.live = (unsigned long long*) (base + header->liveOffset);
+}
+
+/*
+ * Add the tiles that became ready to the viewer's tile directory.  Tiles are never
+ * removed, so only the missing ones need to be checked.
+ */
+void updateTileDirectory(void)
+{
+	for (size_t t=0; t<(size_t) grid.numTileRows * grid.numTileCols; t++)
+	{
+		if (grid.tiles[t] == NULL && __atomic_load_n(&tileState[t], __ATOMIC_ACQUIRE) == SHARED_TILE_READY)
+			grid.tiles[t] = &sharedTiles[t];
+	}
+}
+
+
+int main(int argc, char** argv)
+{
+	unsigned int instance = 1;
+	if (argc == 3 && strcmp(argv[1], "-shared") == 0 && atoi(argv[2]) > 0)
+		instance = (unsigned int) atoi(argv[2]);
+	else if (argc != 1)
+	{
+		printf("Usage: %s [-shared N]\tview the simulation running with -shared N (default 1)\n", argv[0]);
+		exit(argc == 2 && strcmp(argv[1], "-help") == 0 ? 0 : EXIT_FAILURE);
+	}
+
+	attachSharedState(instance);
+	initializeFrontEnd(argc, argv, displayGridPane, displayStatePane);
+
+	//	The callback functions draw from the segment until the simulation terminates
+	glutMainLoop();
+	return 0;
+}
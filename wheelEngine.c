@@ -0,0 +1,474 @@
+//
+//  wheelEngine.c
+//  GL threads
+//
+//  Paced simulation engine built on a hierarchical timing wheel.  Instead of one
+//  sleeping thread per traveler, each traveler's next-step deadline (in ticks of
+//  wheelTick microseconds) is kept in a wheel of WHEEL_LEVELS levels of WHEEL_SIZE
+//  slots.  Level 0 holds the deadlines of the next WHEEL_SIZE ticks, one slot per
+//  tick; each level above covers WHEEL_SIZE times the range of the one below, and a
+//  slot is redistributed (cascaded) to the lower levels when level 0 wraps around.
+//
+//  The wheel is only touched by the first thread of the pool (the timer thread),
+//  which reads the one timerfd, advances the wheel and collects the travelers due.
+//  All threads of the pool then step these travelers, taking them in chunks, and
+//  the timer thread puts them back in the wheel at their next deadline.  A traveler
+//  whose next square is taken picks another move rather than wait, so no thread of
+//  the pool ever blocks on a square.
+//
+//  Nathan Larson 2017-05-02
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/timerfd.h>
+
+#include "simulation.h"
+#include "wheelEngine.h"
+#include "placement.h"
+#include "lifecycle.h"
+#include "arena.h"
+#include "contention.h"
+
+
+//-----------------------------------------------------------------------------
+//	Data types
+//-----------------------------------------------------------------------------
+
+#define WHEEL_BITS		8
+#define WHEEL_SIZE		(1 << WHEEL_BITS)
+#define WHEEL_MASK		(WHEEL_SIZE - 1)
+#define WHEEL_LEVELS	4
+
+// lateness of the steps, per pool thread: log2 histogram in microseconds
+#define JITTER_BUCKETS	32
+typedef struct JitterStats {
+								unsigned long long count;
+								unsigned long long totalNs;
+								unsigned long long maxNs;
+								unsigned long long bucket[JITTER_BUCKETS];
+} __attribute__((aligned(64))) JitterStats;
+
+
+//-----------------------------------------------------------------------------
+//	Global variables
+//-----------------------------------------------------------------------------
+
+unsigned int wheelThreads = 0;
+unsigned int wheelTick = 1000;
+
+// The wheel: heads of the slot lists (traveler index + 1, 0 for an empty slot),
+// linked through wheelNext.  Only the timer thread accesses them.
+static unsigned int wheelSlot[WHEEL_LEVELS][WHEEL_SIZE];
+static unsigned int* wheelNext;
+static unsigned long long currentTick = 0;
+
+// next-step deadline of each traveler, in ticks since the start (0: the traveler terminated)
+static unsigned long long* wheelDeadline;
+// squares left in the current segment of each traveler (0: pick a new move)
+static unsigned int* segmentLeft;
+// ink each traveler has taken but not used yet (as much as segmentLeft in reserve ink
+// mode, at most that much in stream mode)
+static unsigned int* inkHeld;
+// 1 while a traveler is stopped for lack of ink (so that each stop is counted once)
+static unsigned char* inkStalled;
+// steps between two moves of a traveler
+static unsigned long long stepTicks;
+// time of tick 0
+static struct timespec wheelStart;
+
+// The batch of travelers due, filled by the timer thread, and the position of the next
+// chunk to step.  A new batch is announced by incrementing batchNumber; the pool threads
+// report that they are done with it through batchDone.
+static unsigned int* dueList;
+static unsigned int dueCount;
+static unsigned int dueCursor;
+static unsigned int batchNumber = 0;
+static unsigned int batchDone = 0;
+static pthread_mutex_t batchLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t batchReady = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t batchFinished = PTHREAD_COND_INITIALIZER;
+
+// the pool threads only get woken up for batches larger than a chunk
+#define CHUNK_SIZE	64
+
+static JitterStats* jitterStats;
+
+
+//-----------------------------------------------------------------------------
+//	Function prototypes
+//-----------------------------------------------------------------------------
+
+static void wheelInsert(unsigned int index, unsigned long long deadline, unsigned long long earliest);
+static void wheelCascade(unsigned int level);
+static void wheelCollectDue(void);
+static void stepTraveler(unsigned int index);
+static void stepChunks(JitterStats* stats);
+static void* wheelTimerThread(void* arg);
+static void* wheelPoolThread(void* arg);
+
+
+//==================================================================================
+//	Timing wheel
+//==================================================================================
+
+/*
+ * Resolve the automatic number of threads
+ */
+int configureWheel(void)
+{
+	if (wheelThreads == 0)
+	{
+		long numCores = sysconf(_SC_NPROCESSORS_ONLN);
+		wheelThreads = (numCores > 0) ? (unsigned int) numCores : 1;
+	}
+	if (wheelTick < 100)
+	{
+		fprintf(stderr, "wheelTick (%u us) must be at least 100 us\n", wheelTick);
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * Put a traveler in the wheel at its deadline, or at the earliest tick whose slot
+ * hasn't been collected yet if the deadline is earlier.
+ */
+static void wheelInsert(unsigned int index, unsigned long long deadline, unsigned long long earliest)
+{
+	if (deadline < earliest)
+		deadline = earliest;
+
+	// the lowest level whose range covers the deadline
+	unsigned long long delta = deadline - currentTick;
+	unsigned int level = 0;
+	while (level < WHEEL_LEVELS - 1 && delta >= (1ULL << (WHEEL_BITS * (level + 1))))
+		level++;
+	// beyond the range of the top level, wait there for a full turn
+	if (delta >= (1ULL << (WHEEL_BITS * WHEEL_LEVELS)))
+		deadline = currentTick + (1ULL << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+
+	unsigned int* slot = &wheelSlot[level][(deadline >> (WHEEL_BITS * level)) & WHEEL_MASK];
+	wheelNext[index] = *slot;
+	*slot = index + 1;
+}
+
+/*
+ * Redistribute the slot of a level that the current tick has reached to the levels below
+ */
+static void wheelCascade(unsigned int level)
+{
+	unsigned int* slot = &wheelSlot[level][(currentTick >> (WHEEL_BITS * level)) & WHEEL_MASK];
+	unsigned int head = *slot;
+	*slot = 0;
+	while (head != 0)
+	{
+		unsigned int index = head - 1;
+		head = wheelNext[index];
+		wheelInsert(index, wheelDeadline[index], currentTick);
+	}
+}
+
+/*
+ * Advance the wheel by one tick, and append the travelers due at that tick to the batch
+ */
+static void wheelCollectDue(void)
+{
+	currentTick++;
+
+	// when a level wraps around, bring down the current slot of the level above (and,
+	// if that one wrapped around too, of the level above it)
+	for (unsigned int level=1; level<WHEEL_LEVELS; level++)
+	{
+		if ((currentTick & ((1ULL << (WHEEL_BITS * level)) - 1)) != 0)
+			break;
+		wheelCascade(level);
+	}
+
+	unsigned int* slot = &wheelSlot[0][currentTick & WHEEL_MASK];
+	unsigned int head = *slot;
+	*slot = 0;
+	while (head != 0)
+	{
+		unsigned int index = head - 1;
+		head = wheelNext[index];
+		dueList[dueCount++] = index;
+	}
+}
+
+
+//==================================================================================
+//	Stepping travelers
+//==================================================================================
+
+/*
+ * Move a traveler by one square, picking a new move (and taking its ink) when the
+ * current one is finished, and set its next deadline.
+ */
+static void stepTraveler(unsigned int index)
+{
+	TravelerInfo traveler;
+	TravelerInfo* info = &traveler;
+	loadTraveler(index, info);
+	currentLife = &travelerLife[index];
+
+	unsigned int* left = &segmentLeft[index];
+	wheelDeadline[index] += stepTicks;
+
+	if (!prepareStep(info, left, &inkHeld[index], &inkStalled[index]))
+		return;
+
+	unsigned int nextRow, nextCol;
+	squareAhead(info, &nextRow, &nextCol);
+	if (!claimSquare(nextRow, nextCol, index))
+	{
+		// blocked: pick another move at the next step rather than holding up the pool
+		abandonMove(info, left, &inkHeld[index]);
+		return;
+	}
+	leaveSquare(info, left, &inkHeld[index]);
+	info->row = nextRow;
+	info->col = nextCol;
+	publishTraveler(info);
+
+	// reached a corner: respawn in steady-state mode, otherwise terminate
+	if (isCorner(nextRow, nextCol))
+	{
+		releaseSquare(nextRow, nextCol);
+		endTravelerLife(index, info->type);
+		if (steadyState)
+		{
+			respawnTraveler(info);
+			*left = 0;
+			threadCounters->respawns++;
+		}
+		else
+		{
+			publishTravelerLive(index, 0);
+			wheelDeadline[index] = 0;
+			__atomic_sub_fetch(&numLiveThreads, 1, __ATOMIC_RELAXED);
+			pushFreeTraveler(index);
+		}
+	}
+}
+
+/*
+ * Step chunks of the current batch until there are none left, recording how late
+ * each traveler was stepped.
+ */
+static void stepChunks(JitterStats* stats)
+{
+	while (1)
+	{
+		unsigned int first = __atomic_fetch_add(&dueCursor, CHUNK_SIZE, __ATOMIC_RELAXED);
+		if (first >= dueCount)
+			break;
+		unsigned int end = (first + CHUNK_SIZE < dueCount) ? first + CHUNK_SIZE : dueCount;
+
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		long long nowNs = (now.tv_sec - wheelStart.tv_sec) * 1000000000LL + (now.tv_nsec - wheelStart.tv_nsec);
+
+		for (unsigned int k=first; k<end; k++)
+		{
+			unsigned int index = dueList[k];
+			long long late = nowNs - (long long) (wheelDeadline[index] * wheelTick * 1000ULL);
+			if (late < 0)
+				late = 0;
+			unsigned int b = 0;
+			while (b < JITTER_BUCKETS - 1 && ((unsigned long long) late >> 10) >= (1ULL << b))
+				b++;
+			stats->bucket[b]++;
+			stats->count++;
+			stats->totalNs += (unsigned long long) late;
+			if ((unsigned long long) late > stats->maxNs)
+				stats->maxNs = (unsigned long long) late;
+
+			stepTraveler(index);
+		}
+	}
+}
+
+/*
+ * Print the step jitter measured so far
+ */
+void printWheelJitter(void)
+{
+	unsigned long long count = 0, totalNs = 0, maxNs = 0;
+	unsigned long long bucket[JITTER_BUCKETS] = {0};
+	for (unsigned int t=0; t<wheelThreads; t++)
+	{
+		count += jitterStats[t].count;
+		totalNs += jitterStats[t].totalNs;
+		if (jitterStats[t].maxNs > maxNs)
+			maxNs = jitterStats[t].maxNs;
+		for (unsigned int b=0; b<JITTER_BUCKETS; b++)
+			bucket[b] += jitterStats[t].bucket[b];
+	}
+
+	// upper bound of the bucket holding the 99th percentile (bucket b: less than 2^b us)
+	unsigned long long seen = 0;
+	unsigned int p99 = 0;
+	while (p99 < JITTER_BUCKETS - 1 && (seen += bucket[p99]) * 100 < count * 99)
+		p99++;
+
+	printf("wheel: %u threads, tick %u us, %llu steps, jitter mean %.1f us, p99 < %llu us, max %.1f us\n",
+			wheelThreads, wheelTick, count, count > 0 ? totalNs * 1e-3 / count : 0.0, 1ULL << p99, maxNs * 1e-3);
+}
+
+
+//==================================================================================
+//	Threads
+//==================================================================================
+
+/*
+ * Schedule the first step of each traveler and start the threads
+ */
+void startWheelEngine(void)
+{
+	wheelNext = (unsigned int*) arenaAlloc(MAX_NUM_TRAVELER_THREADS, sizeof(unsigned int), "timing wheel");
+	wheelDeadline = (unsigned long long*) arenaAlloc(MAX_NUM_TRAVELER_THREADS, sizeof(unsigned long long), "timing wheel");
+	segmentLeft = (unsigned int*) arenaAlloc(MAX_NUM_TRAVELER_THREADS, sizeof(unsigned int), "traveler segments");
+	inkHeld = (unsigned int*) arenaAlloc(MAX_NUM_TRAVELER_THREADS, sizeof(unsigned int), "traveler segments");
+	inkStalled = (unsigned char*) arenaAlloc(MAX_NUM_TRAVELER_THREADS, sizeof(unsigned char), "traveler segments");
+	dueList = (unsigned int*) arenaAlloc(MAX_NUM_TRAVELER_THREADS, sizeof(unsigned int), "timing wheel");
+	jitterStats = (JitterStats*) arenaAlloc(wheelThreads, sizeof(JitterStats), "jitter statistics");
+	firstTouchArena();
+
+	// unpaced travelers step at every tick
+	stepTicks = (travelerSleepTime + wheelTick - 1) / wheelTick;
+	if (stepTicks == 0)
+		stepTicks = 1;
+
+	// claim the starting squares, and spread the first steps over one step time so
+	// that the travelers don't all come due at the same tick
+	for (unsigned int k=0; k<MAX_NUM_TRAVELER_THREADS; k++)
+	{
+		TravelerInfo traveler;
+		loadTraveler(k, &traveler);
+		claimStartSquare(&traveler);
+		wheelDeadline[k] = 1 + rand() % stepTicks;
+		wheelInsert(k, wheelDeadline[k], 1);
+	}
+	__atomic_store_n(&numLiveThreads, MAX_NUM_TRAVELER_THREADS, __ATOMIC_RELAXED);
+
+	// the first thread of the pool runs the timer
+	for (unsigned int t=0; t<wheelThreads; t++)
+	{
+		pthread_t thread;
+		int errCode = pthread_create(&thread, NULL, t == 0 ? wheelTimerThread : wheelPoolThread, (void*) (uintptr_t) t);
+		if (errCode != 0)
+		{
+			printf ("could not pthread_create wheel thread %u. %d\n", t, errCode);
+			exit(0);
+		}
+	}
+}
+
+/*
+ * This function is the main function of the timer thread.  At each expiration of the
+ * timer, it advances the wheel by the number of ticks elapsed, steps the travelers due
+ * with the rest of the pool, and puts them back in the wheel.
+ */
+static void* wheelTimerThread(void* arg)
+{
+	unsigned int t = (unsigned int) (uintptr_t) arg;
+	bindThreadCounters(&travelerCounters[t]);
+	pinCurrentThread(placementCpuForThread(t));
+
+	int timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (timerFd < 0)
+	{
+		perror("timerfd_create");
+		exit(EXIT_FAILURE);
+	}
+	struct itimerspec period;
+	period.it_interval.tv_sec = wheelTick / 1000000;
+	period.it_interval.tv_nsec = (wheelTick % 1000000) * 1000L;
+	period.it_value = period.it_interval;
+	clock_gettime(CLOCK_MONOTONIC, &wheelStart);
+	timerfd_settime(timerFd, 0, &period, NULL);
+
+	while (1)
+	{
+		// number of ticks since the last read (more than one if the last batch overran)
+		uint64_t expirations;
+		if (read(timerFd, &expirations, sizeof(expirations)) != sizeof(expirations))
+			continue;
+		waitWhilePaused();
+
+		dueCount = 0;
+		for (uint64_t e=0; e<expirations; e++)
+			wheelCollectDue();
+		if (dueCount == 0)
+			continue;
+
+		// small batches are stepped here; larger ones are shared with the pool
+		dueCursor = 0;
+		if (dueCount > CHUNK_SIZE && wheelThreads > 1)
+		{
+			pthread_mutex_lock(&batchLock);
+			batchDone = 0;
+			batchNumber++;
+			pthread_cond_broadcast(&batchReady);
+			pthread_mutex_unlock(&batchLock);
+
+			stepChunks(&jitterStats[t]);
+
+			pthread_mutex_lock(&batchLock);
+			while (batchDone < wheelThreads - 1)
+				pthread_cond_wait(&batchFinished, &batchLock);
+			pthread_mutex_unlock(&batchLock);
+		}
+		else
+			stepChunks(&jitterStats[t]);
+
+		// back in the wheel, at their next deadline.  Steps missed by a late traveler are
+		// skipped rather than caught up with.
+		for (unsigned int k=0; k<dueCount; k++)
+		{
+			unsigned int index = dueList[k];
+			if (wheelDeadline[index] == 0)
+				continue;
+			if (wheelDeadline[index] <= currentTick)
+				wheelDeadline[index] = currentTick + 1;
+			wheelInsert(index, wheelDeadline[index], currentTick + 1);
+		}
+		flushStaleContention();
+	}
+	return NULL;
+}
+
+/*
+ * This function is the main function of the other threads of the pool: step chunks of
+ * each batch the timer thread announces.
+ */
+static void* wheelPoolThread(void* arg)
+{
+	unsigned int t = (unsigned int) (uintptr_t) arg;
+	bindThreadCounters(&travelerCounters[t]);
+	pinCurrentThread(placementCpuForThread(t));
+	unsigned int lastBatch = 0;
+
+	while (1)
+	{
+		pthread_mutex_lock(&batchLock);
+		while (batchNumber == lastBatch)
+			pthread_cond_wait(&batchReady, &batchLock);
+		lastBatch = batchNumber;
+		pthread_mutex_unlock(&batchLock);
+
+		stepChunks(&jitterStats[t]);
+		flushStaleContention();
+
+		pthread_mutex_lock(&batchLock);
+		if (++batchDone == wheelThreads - 1)
+			pthread_cond_signal(&batchFinished);
+		pthread_mutex_unlock(&batchLock);
+	}
+	return NULL;
+}
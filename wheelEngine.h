@@ -0,0 +1,28 @@
+//
+//  wheelEngine.h
+//  GL threads
+//
+//  Paced simulation engine built on a hierarchical timing wheel: each traveler's
+//  next-step deadline is kept in the wheel, and a small pool of threads steps the
+//  travelers that are due, in batches, at each tick of a single timer.
+//
+//  Nathan Larson 2017-05-02
+
+#ifndef WHEEL_ENGINE_H
+#define WHEEL_ENGINE_H
+
+// number of threads stepping the travelers (0: one per core), and wheel tick in microseconds
+extern unsigned int wheelThreads;
+extern unsigned int wheelTick;
+
+// Resolve the automatic number of threads.  Returns 0 (after printing why) if the
+// settings can't be used.
+int configureWheel(void);
+
+// Schedule the first step of each traveler and start the threads
+void startWheelEngine(void);
+
+// Print the step jitter measured so far (how late travelers were stepped)
+void printWheelJitter(void);
+
+#endif // WHEEL_ENGINE_H